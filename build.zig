@@ -37,6 +37,18 @@ pub fn build(b: *std.Build) void {
     const test_step = b.step("test", "Run unit tests");
     test_step.dependOn(&run_exe_unit_tests.step);
     
+    const bench = b.addExecutable(.{
+        .name = "bench",
+        .root_source_file = .{ .path = "src/bench.zig" },
+        .target = target,
+        .optimize = .ReleaseFast,
+    });
+
+    const run_bench = b.addRunArtifact(bench);
+
+    const bench_step = b.step("bench", "Run the lexer and compiler benchmarks");
+    bench_step.dependOn(&run_bench.step);
+
     const docs = b.addObject(.{
       .name = "Lang",
       .root_source_file = .{ .path = "src/main.zig" },
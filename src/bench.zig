@@ -0,0 +1,113 @@
+//! Lexing throughput benchmark, tokenizes a large generated source a few
+//! times and reports the best rate. Also compiles a generated program with
+//! many functions serially and in parallel mode to compare the two. Run with
+//! `zig build bench`.
+
+const std = @import("std");
+const compiler = @import("compiler/compiler.zig");
+const err = @import("compiler/error.zig");
+const lexer = @import("compiler/lexer.zig");
+
+/// Copies of the snippet in the generated source, about 16MB
+const copies = 64 * 1024;
+const runs = 5;
+
+const snippet =
+    \\fn scale_values(values: []int, factor: int) -> int {
+    \\    // sums every value after scaling it
+    \\    var total := 0;
+    \\    for item in values {
+    \\        total += item * factor + 1234567;
+    \\    }
+    \\    if total >= 100 and factor != 0 { print("large result"); }
+    \\    return total;
+    \\}
+    \\
+;
+
+/// Functions in the generated program, each one calls the one before it so
+/// that none are removed as unused
+const function_count = 128;
+/// Loops in the body of every generated function
+const loops_per_function = 24;
+
+const loop_snippet =
+    \\    for var j := 0; j < n; j = j + 1; {
+    \\        match j {
+    \\            0 => { total = total + 3; }
+    \\            1 => { total = total + 5; }
+    \\            2 => { total = total * 2; }
+    \\            else => { total = total + j; }
+    \\        }
+    \\    }
+    \\
+;
+
+pub fn main() !void {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    const allocator = gpa.allocator();
+
+    try benchLexer(allocator);
+    try benchCompile(allocator);
+}
+
+fn benchLexer(allocator: std.mem.Allocator) !void {
+    const source = try allocator.alloc(u8, snippet.len * copies);
+    defer allocator.free(source);
+    for (0..copies) |i| {
+        @memcpy(source[i * snippet.len ..][0..snippet.len], snippet);
+    }
+
+    var best: u64 = std.math.maxInt(u64);
+    var token_count: usize = 0;
+    for (0..runs) |_| {
+        var arena = std.heap.ArenaAllocator.init(allocator);
+        defer arena.deinit();
+        var err_ctx = err.ErrorContext{ .source = source, .allocator = arena.allocator() };
+        var lex = lexer.Lexer.init(arena.allocator(), &err_ctx, source);
+
+        var timer = try std.time.Timer.start();
+        try lex.tokenize();
+        best = @min(best, timer.read());
+        token_count = lex.tokens.len;
+    }
+
+    const megabytes = @as(f64, @floatFromInt(source.len)) / (1024 * 1024);
+    const seconds = @as(f64, @floatFromInt(best)) / std.time.ns_per_s;
+    std.debug.print("lexed {d:.1}MB into {d} tokens in {d:.2}ms, {d:.1}MB/s\n", .{ megabytes, token_count, seconds * 1000, megabytes / seconds });
+}
+
+fn benchCompile(allocator: std.mem.Allocator) !void {
+    var source = std.ArrayList(u8).init(allocator);
+    defer source.deinit();
+    const writer = source.writer();
+    try writer.writeAll("fn f0(n: int) -> int {\n    return n;\n}\n");
+    for (1..function_count) |i| {
+        try writer.print("fn f{d}(n: int) -> int {{\n    var total := 0;\n", .{i});
+        for (0..loops_per_function) |_| {
+            try writer.writeAll(loop_snippet);
+        }
+        try writer.print("    return total + f{d}(n);\n}}\n", .{i - 1});
+    }
+    try writer.print("print(f{d}(8));\n", .{function_count - 1});
+
+    const serial = try bestCompileTime(allocator, source.items, .{});
+    const parallel = try bestCompileTime(allocator, source.items, .{ .parallel = true });
+
+    const kilobytes = @as(f64, @floatFromInt(source.items.len)) / 1024;
+    const serial_ms = @as(f64, @floatFromInt(serial)) / std.time.ns_per_ms;
+    const parallel_ms = @as(f64, @floatFromInt(parallel)) / std.time.ns_per_ms;
+    std.debug.print("compiled {d} functions, {d:.1}KB, serially in {d:.2}ms and in parallel in {d:.2}ms, {d:.2}x\n", .{ function_count, kilobytes, serial_ms, parallel_ms, serial_ms / parallel_ms });
+}
+
+fn bestCompileTime(allocator: std.mem.Allocator, source: []const u8, options: compiler.Options) !u64 {
+    var best: u64 = std.math.maxInt(u64);
+    for (0..runs) |_| {
+        var timer = try std.time.Timer.start();
+        var result = try compiler.compile(allocator, source, options);
+        best = @min(best, timer.read());
+        result.deinit(allocator);
+    }
+    return best;
+}
@@ -1,6 +1,8 @@
 //! Abstract Syntax Tree, used in passes and code generation
 
 const std = @import("std");
+const byte = @import("../runtime/bytecode.zig");
+const lexer = @import("lexer.zig");
 const types = @import("types.zig");
 
 pub const Operator = union(enum) {
@@ -19,16 +21,28 @@ pub const Operator = union(enum) {
     boolean_and,
     call: struct {
         args: std.ArrayListUnmanaged(*Node),
+        discarded: u8 = 0, // tuple values popped after a bare call statement, set during type checking
     },
     index: struct {
         index: *Node,
+        column: ?*Node = null, // second index of matrices
+        bytes: bool = false, // indexes a byte buffer, set during type checking
+    },
+    field: struct {
+        name: []const u8,
+        name_id: lexer.NameId,
+        index: u8 = undefined, // set during type checking
     },
 };
 
 pub const SymbolDecl = struct {
     name: []const u8,
+    name_id: lexer.NameId, // symbols are resolved by id, the name is kept for errors
     decl_type: ?types.Type = null,
     function_decl: ?*Node = null,
+    frame_array: bool = false, // fixed array stored in consecutive local slots instead of the heap
+    constant: bool = false, // declared with const, nothing reachable through it can change
+    constant_value: ?*Node = null, // scalar literal that reads of a const are replaced with
 };
 
 /// Abstract Syntax Tree Node, contains both
@@ -46,16 +60,160 @@ pub const Node = struct {
         function_value: FunctionValue,
         builtin_call: BuiltinCall,
         array_init: ArrayInit,
+        tuple_init: TupleInit,
+        struct_init: StructInit,
+        container_init: ContainerInit,
         block: Block,
         var_decl: VarDecl,
+        tuple_decl: TupleDecl,
         var_assign: VarAssign,
         while_loop: WhileLoop,
         for_loop: ForLoop,
+        for_each: ForEach,
         array_set: ArraySet,
+        field_set: FieldSet,
         if_stmt: IfStatement,
+        match_stmt: MatchStatement,
         return_stmt: ReturnStatement,
+        loop_kernel: LoopKernel,
     },
 
+    /// Calls visit on every direct child of the node, stopping early and
+    /// returning false as soon as visit returns false
+    pub fn visitChildren(self: *Node, context: anytype, comptime visit: fn (@TypeOf(context), *Node) bool) bool {
+        switch (self.data) {
+            .int_constant, .boolean_constant, .string_constant, .var_get => {},
+            .container_init => |*container| {
+                if (container.comparator) |comparator| {
+                    if (!visit(context, comparator)) return false;
+                }
+            },
+            .unary_op => |*unary| {
+                if (!visit(context, unary.expr)) return false;
+                switch (unary.op) {
+                    .call => |*call| {
+                        for (call.args.items) |arg| {
+                            if (!visit(context, arg)) return false;
+                        }
+                    },
+                    .index => |*index| {
+                        if (!visit(context, index.index)) return false;
+                        if (index.column) |column| {
+                            if (!visit(context, column)) return false;
+                        }
+                    },
+                    else => {},
+                }
+            },
+            .binary_op => |*binary| {
+                if (!visit(context, binary.lhs)) return false;
+                if (!visit(context, binary.rhs)) return false;
+            },
+            .function_value => |*func| {
+                // Generic functions only exist as their instances after type
+                // checking, their own body is never checked
+                if (func.type_params.len > 0) {
+                    for (func.instances.items) |*instance| {
+                        if (!visit(context, instance.node)) return false;
+                    }
+                } else if (!visit(context, func.body)) return false;
+            },
+            .builtin_call => |*call| {
+                for (call.args) |arg| {
+                    if (!visit(context, arg)) return false;
+                }
+            },
+            .array_init => |*array| {
+                for (array.items.items) |item| {
+                    if (!visit(context, item)) return false;
+                }
+            },
+            .tuple_init => |*tuple| {
+                for (tuple.items.items) |item| {
+                    if (!visit(context, item)) return false;
+                }
+            },
+            .struct_init => |*struct_init| {
+                for (struct_init.fields) |field| {
+                    if (!visit(context, field.expr)) return false;
+                }
+            },
+            .block => |*block| {
+                for (block.list.items) |statement| {
+                    if (!visit(context, statement)) return false;
+                }
+            },
+            .var_decl => |*var_decl| {
+                if (!visit(context, var_decl.expr)) return false;
+            },
+            .tuple_decl => |*tuple_decl| {
+                if (!visit(context, tuple_decl.expr)) return false;
+            },
+            .var_assign => |*var_assign| {
+                if (!visit(context, var_assign.expr)) return false;
+            },
+            .while_loop => |*while_loop| {
+                if (!visit(context, while_loop.expr)) return false;
+                if (!visit(context, while_loop.body)) return false;
+            },
+            .for_loop => |*for_loop| {
+                if (!visit(context, for_loop.init)) return false;
+                if (!visit(context, for_loop.condition)) return false;
+                if (!visit(context, for_loop.after)) return false;
+                if (!visit(context, for_loop.body)) return false;
+            },
+            .for_each => |*for_each| {
+                if (!visit(context, for_each.iterable)) return false;
+                if (for_each.range_end) |range_end| {
+                    if (!visit(context, range_end)) return false;
+                }
+                if (!visit(context, for_each.body)) return false;
+            },
+            .array_set => |*array_set| {
+                if (!visit(context, array_set.array)) return false;
+                if (!visit(context, array_set.index)) return false;
+                if (array_set.column) |column| {
+                    if (!visit(context, column)) return false;
+                }
+                if (!visit(context, array_set.expr)) return false;
+            },
+            .field_set => |*field_set| {
+                if (!visit(context, field_set.record)) return false;
+                if (!visit(context, field_set.expr)) return false;
+            },
+            .if_stmt => |*if_stmt| {
+                if (!visit(context, if_stmt.expr)) return false;
+                if (!visit(context, if_stmt.true_body)) return false;
+                if (if_stmt.false_body) |false_body| {
+                    if (!visit(context, false_body)) return false;
+                }
+            },
+            .match_stmt => |*match_stmt| {
+                if (!visit(context, match_stmt.expr)) return false;
+                for (match_stmt.cases.items) |*case| {
+                    for (case.values.items) |case_value| {
+                        if (!visit(context, case_value)) return false;
+                    }
+                    if (!visit(context, case.body)) return false;
+                }
+                if (match_stmt.else_body) |else_body| {
+                    if (!visit(context, else_body)) return false;
+                }
+            },
+            .return_stmt => |*ret| {
+                if (ret.expr) |expr| {
+                    if (!visit(context, expr)) return false;
+                }
+            },
+            .loop_kernel => |*kernel| {
+                for (kernel.operands) |operand| {
+                    if (!visit(context, operand)) return false;
+                }
+            },
+        }
+        return true;
+    }
+
     const IntConstant = struct {
         value: i64,
     };
@@ -69,7 +227,8 @@ pub const Node = struct {
     };
 
     const VarGet = struct {
-        name: []u8,
+        name: []const u8,
+        name_id: lexer.NameId,
     };
 
     const UnaryOp = struct {
@@ -85,12 +244,25 @@ pub const Node = struct {
 
     const FunctionValue = struct {
         self_arg: bool = false,
+        memo: bool = false, // results are cached by argument values
         name: ?[]const u8,
+        name_id: lexer.NameId = undefined, // only set for named functions
         args: std.ArrayListUnmanaged(SymbolDecl) = std.ArrayListUnmanaged(SymbolDecl){},
         ret_type: types.Type,
         body: *Node,
         func_idx: usize = undefined, // used in self builtin
         func_type: types.Type = undefined, // used in self builtin
+        type_params: []const []const u8 = &.{}, // names of the type parameters of a generic function
+        instances: std.ArrayListUnmanaged(Instance) = std.ArrayListUnmanaged(Instance){}, // created while type checking calls to a generic function
+        origin: ?*Node = null, // generic function this is an instance of
+    };
+
+    /// Copy of a generic function with its type parameters bound, every
+    /// instance is type checked and generated as its own function
+    pub const Instance = struct {
+        bindings: []const types.Type,
+        node: *Node,
+        decl: *SymbolDecl, // calls to the instance are pointed at this
     };
 
     const BuiltinCall = struct {
@@ -102,6 +274,27 @@ pub const Node = struct {
         items: std.ArrayListUnmanaged(*Node) = std.ArrayListUnmanaged(*Node){},
     };
 
+    const TupleInit = struct {
+        items: std.ArrayListUnmanaged(*Node) = std.ArrayListUnmanaged(*Node){},
+    };
+
+    const StructInit = struct {
+        structure: *types.Struct,
+        fields: []FieldInit, // in declaration order once types are checked
+    };
+
+    /// Empty map, set or priority queue
+    const ContainerInit = struct {
+        container_type: types.Type,
+        comparator: ?*Node = null, // priority queue order, pops the item it returns true for first
+    };
+
+    pub const FieldInit = struct {
+        name: []const u8,
+        name_id: lexer.NameId,
+        expr: *Node,
+    };
+
     const Block = struct {
         list: std.ArrayListUnmanaged(*Node) = std.ArrayListUnmanaged(*Node){},
     };
@@ -111,8 +304,15 @@ pub const Node = struct {
         expr: *Node,
     };
 
+    /// Destructuring declaration, `var (a, b) := expr;`
+    const TupleDecl = struct {
+        symbols: std.ArrayListUnmanaged(SymbolDecl) = std.ArrayListUnmanaged(SymbolDecl){},
+        expr: *Node,
+    };
+
     const VarAssign = struct {
-        name: []u8,
+        name: []const u8,
+        name_id: lexer.NameId,
         expr: *Node,
     };
 
@@ -128,9 +328,28 @@ pub const Node = struct {
         body: *Node,
     };
 
+    /// `for x in array { }`, or `for i in iterable..range_end { }` over a
+    /// range of integers
+    const ForEach = struct {
+        symbol: SymbolDecl,
+        iterable: *Node,
+        range_end: ?*Node,
+        body: *Node,
+    };
+
     const ArraySet = struct {
         array: *Node,
         index: *Node,
+        column: ?*Node = null, // second index of matrices
+        bytes: bool = false, // sets a byte of a byte buffer, set during type checking
+        expr: *Node,
+    };
+
+    const FieldSet = struct {
+        record: *Node,
+        name: []const u8,
+        name_id: lexer.NameId,
+        index: u8 = undefined, // set during type checking
         expr: *Node,
     };
 
@@ -140,7 +359,215 @@ pub const Node = struct {
         false_body: ?*Node,
     };
 
+    pub const MatchStatement = struct {
+        expr: *Node,
+        cases: std.ArrayListUnmanaged(MatchCase),
+        else_body: ?*Node,
+    };
+
+    /// Int or string constants that all run the same body
+    pub const MatchCase = struct {
+        values: std.ArrayListUnmanaged(*Node),
+        body: *Node,
+    };
+
     const ReturnStatement = struct {
         expr: ?*Node,
     };
+
+    /// Loop replaced with a native array kernel, only created after type
+    /// checking by the loop idiom pass
+    const LoopKernel = struct {
+        kind: byte.Kernel,
+        op: byte.KernelOp = .add,
+        operands: []*Node, // pushed in order before the kernel runs
+        result: ?*SymbolDecl = null, // variable the kernel's result is stored in
+    };
+};
+
+pub const NodeSet = std.AutoHashMapUnmanaged(*Node, void);
+
+/// Deep copy of a generic function with its type parameters replaced by the
+/// bound types. Reads of variables declared inside of the copy, and of the
+/// function itself, are pointed at the copied declarations.
+pub fn instantiate(allocator: std.mem.Allocator, type_table: *types.TypeTable, generic: *Node, bindings: []const types.Type) std.mem.Allocator.Error!*Node {
+    var cloner = Cloner{ .allocator = allocator, .type_table = type_table, .bindings = bindings };
+    defer cloner.decls.deinit(allocator);
+    defer cloner.funcs.deinit(allocator);
+    const node = try cloner.clone(generic);
+    const func = &node.data.function_value;
+    func.type_params = &.{};
+    func.instances = std.ArrayListUnmanaged(Node.Instance){};
+    func.origin = generic;
+    return node;
+}
+
+const Cloner = struct {
+    allocator: std.mem.Allocator,
+    type_table: *types.TypeTable,
+    bindings: []const types.Type,
+    decls: std.AutoHashMapUnmanaged(*SymbolDecl, *SymbolDecl) = std.AutoHashMapUnmanaged(*SymbolDecl, *SymbolDecl){},
+    funcs: std.AutoHashMapUnmanaged(*Node, *Node) = std.AutoHashMapUnmanaged(*Node, *Node){},
+
+    const Error = std.mem.Allocator.Error;
+
+    fn clone(self: *Cloner, node: *Node) Error!*Node {
+        const copy = try self.allocator.create(Node);
+        copy.* = node.*;
+        if (node.symbol_decl) |decl| {
+            copy.symbol_decl = try self.mapDecl(decl);
+        }
+        switch (copy.data) {
+            .int_constant, .boolean_constant, .string_constant, .var_get => {},
+            .container_init => |*container| {
+                container.container_type = try container.container_type.substitute(self.type_table, self.allocator, self.bindings);
+                if (container.comparator) |comparator| {
+                    container.comparator = try self.clone(comparator);
+                }
+            },
+            .unary_op => |*unary| {
+                unary.expr = try self.clone(unary.expr);
+                switch (unary.op) {
+                    .call => |*call| call.args = try self.cloneList(call.args),
+                    .index => |*index| {
+                        index.index = try self.clone(index.index);
+                        if (index.column) |column| {
+                            index.column = try self.clone(column);
+                        }
+                    },
+                    else => {},
+                }
+            },
+            .binary_op => |*binary| {
+                binary.lhs = try self.clone(binary.lhs);
+                binary.rhs = try self.clone(binary.rhs);
+            },
+            .function_value => |*func| {
+                try self.funcs.put(self.allocator, node, copy);
+                func.args = try func.args.clone(self.allocator);
+                for (node.data.function_value.args.items, func.args.items) |*old, *new| {
+                    try self.declare(old, new);
+                }
+                func.ret_type = try func.ret_type.substitute(self.type_table, self.allocator, self.bindings);
+                func.body = try self.clone(func.body);
+            },
+            .builtin_call => |*call| {
+                const args = try self.allocator.alloc(*Node, call.args.len);
+                for (call.args, args) |arg, *new| {
+                    new.* = try self.clone(arg);
+                }
+                call.args = args;
+            },
+            .array_init => |*array| array.items = try self.cloneList(array.items),
+            .tuple_init => |*tuple| tuple.items = try self.cloneList(tuple.items),
+            .struct_init => |*struct_init| {
+                const fields = try self.allocator.dupe(Node.FieldInit, struct_init.fields);
+                for (fields) |*field| {
+                    field.expr = try self.clone(field.expr);
+                }
+                struct_init.fields = fields;
+            },
+            .block => |*block| block.list = try self.cloneList(block.list),
+            .var_decl => |*var_decl| {
+                var_decl.expr = try self.clone(var_decl.expr);
+                try self.declare(&node.data.var_decl.symbol, &var_decl.symbol);
+            },
+            .tuple_decl => |*tuple_decl| {
+                tuple_decl.expr = try self.clone(tuple_decl.expr);
+                tuple_decl.symbols = try tuple_decl.symbols.clone(self.allocator);
+                for (node.data.tuple_decl.symbols.items, tuple_decl.symbols.items) |*old, *new| {
+                    try self.declare(old, new);
+                }
+            },
+            .var_assign => |*var_assign| var_assign.expr = try self.clone(var_assign.expr),
+            .while_loop => |*while_loop| {
+                while_loop.expr = try self.clone(while_loop.expr);
+                while_loop.body = try self.clone(while_loop.body);
+            },
+            .for_loop => |*for_loop| {
+                for_loop.init = try self.clone(for_loop.init);
+                for_loop.condition = try self.clone(for_loop.condition);
+                for_loop.after = try self.clone(for_loop.after);
+                for_loop.body = try self.clone(for_loop.body);
+            },
+            .for_each => |*for_each| {
+                for_each.iterable = try self.clone(for_each.iterable);
+                if (for_each.range_end) |range_end| {
+                    for_each.range_end = try self.clone(range_end);
+                }
+                try self.declare(&node.data.for_each.symbol, &for_each.symbol);
+                for_each.body = try self.clone(for_each.body);
+            },
+            .array_set => |*array_set| {
+                array_set.array = try self.clone(array_set.array);
+                array_set.index = try self.clone(array_set.index);
+                if (array_set.column) |column| {
+                    array_set.column = try self.clone(column);
+                }
+                array_set.expr = try self.clone(array_set.expr);
+            },
+            .field_set => |*field_set| {
+                field_set.record = try self.clone(field_set.record);
+                field_set.expr = try self.clone(field_set.expr);
+            },
+            .if_stmt => |*if_stmt| {
+                if_stmt.expr = try self.clone(if_stmt.expr);
+                if_stmt.true_body = try self.clone(if_stmt.true_body);
+                if (if_stmt.false_body) |false_body| {
+                    if_stmt.false_body = try self.clone(false_body);
+                }
+            },
+            .match_stmt => |*match_stmt| {
+                match_stmt.expr = try self.clone(match_stmt.expr);
+                match_stmt.cases = try match_stmt.cases.clone(self.allocator);
+                for (match_stmt.cases.items) |*case| {
+                    case.values = try self.cloneList(case.values);
+                    case.body = try self.clone(case.body);
+                }
+                if (match_stmt.else_body) |else_body| {
+                    match_stmt.else_body = try self.clone(else_body);
+                }
+            },
+            .return_stmt => |*ret| {
+                if (ret.expr) |expr| {
+                    ret.expr = try self.clone(expr);
+                }
+            },
+            .loop_kernel => unreachable, // created after type checking
+        }
+        return copy;
+    }
+
+    fn cloneList(self: *Cloner, list: std.ArrayListUnmanaged(*Node)) Error!std.ArrayListUnmanaged(*Node) {
+        var copy = try std.ArrayListUnmanaged(*Node).initCapacity(self.allocator, list.items.len);
+        for (list.items) |item| {
+            copy.appendAssumeCapacity(try self.clone(item));
+        }
+        return copy;
+    }
+
+    /// Records the copy of a declaration so reads of it can be redirected
+    fn declare(self: *Cloner, old: *SymbolDecl, new: *SymbolDecl) Error!void {
+        if (old.decl_type) |decl_type| {
+            new.decl_type = try decl_type.substitute(self.type_table, self.allocator, self.bindings);
+        }
+        try self.decls.put(self.allocator, old, new);
+    }
+
+    fn mapDecl(self: *Cloner, decl: *SymbolDecl) Error!*SymbolDecl {
+        if (self.decls.get(decl)) |mapped| {
+            return mapped;
+        }
+        // Reads of a copied function itself, through self or its name
+        if (decl.function_decl) |func| {
+            if (self.funcs.get(func)) |copy| {
+                const mapped = try self.allocator.create(SymbolDecl);
+                mapped.* = decl.*;
+                mapped.function_decl = copy;
+                try self.decls.put(self.allocator, decl, mapped);
+                return mapped;
+            }
+        }
+        return decl;
+    }
 };
@@ -1,7 +1,27 @@
 const std = @import("std");
+const byte = @import("../runtime/bytecode.zig");
 const types = @import("types.zig");
 
 const void_type: types.Type = .void;
+const int_type: types.Type = .int;
+
+/// Argument or return type of a map or set builtin, relative to the
+/// container passed as the first argument
+pub const ContainerType = enum {
+    key, // map key or set item
+    value, // map value
+    key_array, // array of keys or items
+    boolean,
+    void,
+};
+
+pub const ContainerSignature = struct {
+    map: bool = true,
+    set: bool = true,
+    pqueue: bool = false,
+    args: []const ContainerType, // arguments after the container
+    ret: ContainerType,
+};
 
 pub const Data = struct {
     id: u8,
@@ -10,36 +30,61 @@ pub const Data = struct {
     deep_check_types: bool = true,
     array_inner_type: bool = false,
     ret_type: ?types.Type,
+    opcode: ?byte.Opcode = null, // dedicated opcode, otherwise called through CALL_BUILTIN
+    pure: bool = true, // no side effects and the same result for the same arguments
+    container: ?ContainerSignature = null, // replaces arg_types for map and set builtins
+    fresh: bool = false, // returns a new object that nothing else references
+    move_arg: bool = false, // opcode takes a u8 that is 1 if the first argument is fresh and can be taken over
+    mutates: bool = false, // changes its first argument or stores the others in it
 };
 
+/// Looks up a builtin by its id
+pub fn fromId(id: u8) Data {
+    for (lookup.kvs) |pair| {
+        if (pair.value.id == id) {
+            return pair.value;
+        }
+    }
+    unreachable;
+}
+
 pub const lookup = std.ComptimeStringMap(Data, .{
     .{ "print", .{
         .id = 0,
         .arg_count = 1,
         .arg_types = null,
         .ret_type = .void,
+        .pure = false,
     } },
     .{ "to_string", .{
         .id = 1,
         .arg_count = 1,
         .arg_types = null,
         .ret_type = .string,
+        .fresh = true,
     } },
     .{ "length", .{
         .id = 2,
         .arg_count = 1,
         .arg_types = &.{&.{
             types.Type{ .array = .{ .base = @constCast(&void_type) } },
+            types.Type{ .fixed_array = .{ .base = @constCast(&void_type), .len = 0 } },
             .string,
+            .bytes,
+            types.Type{ .map = .{ .key = @constCast(&void_type), .value = @constCast(&void_type) } },
+            types.Type{ .set = .{ .item = @constCast(&void_type) } },
+            types.Type{ .pqueue = .{ .item = @constCast(&void_type) } },
         }},
         .deep_check_types = false,
         .ret_type = .int,
+        .opcode = .LENGTH,
     } },
     .{ "clone", .{
         .id = 3,
         .arg_count = 1,
         .arg_types = null,
         .ret_type = null,
+        .fresh = true,
     } },
     .{ "append", .{
         .id = 4,
@@ -50,6 +95,9 @@ pub const lookup = std.ComptimeStringMap(Data, .{
         .deep_check_types = false,
         .array_inner_type = true,
         .ret_type = .void,
+        .opcode = .ARRAY_PUSH,
+        .pure = false,
+        .mutates = true,
     } },
     .{ "random", .{
         .id = 5,
@@ -60,5 +108,200 @@ pub const lookup = std.ComptimeStringMap(Data, .{
             .int,
         } },
         .ret_type = .int,
+        .opcode = .RANDOM,
+        .pure = false,
+    } },
+    .{ "map_put", .{
+        .id = 6,
+        .arg_count = 3,
+        .arg_types = null,
+        .ret_type = .void,
+        .pure = false,
+        .mutates = true,
+        .container = .{ .set = false, .args = &.{ .key, .value }, .ret = .void },
+    } },
+    .{ "map_get", .{
+        .id = 7,
+        .arg_count = 2,
+        .arg_types = null,
+        .ret_type = null,
+        .container = .{ .set = false, .args = &.{.key}, .ret = .value },
+    } },
+    .{ "map_contains", .{
+        .id = 8,
+        .arg_count = 2,
+        .arg_types = null,
+        .ret_type = .boolean,
+        .container = .{ .set = false, .args = &.{.key}, .ret = .boolean },
+    } },
+    .{ "map_remove", .{
+        .id = 9,
+        .arg_count = 2,
+        .arg_types = null,
+        .ret_type = .boolean,
+        .pure = false,
+        .mutates = true,
+        .container = .{ .set = false, .args = &.{.key}, .ret = .boolean },
+    } },
+    .{ "set_insert", .{
+        .id = 10,
+        .arg_count = 2,
+        .arg_types = null,
+        .ret_type = .void,
+        .pure = false,
+        .mutates = true,
+        .container = .{ .map = false, .args = &.{.key}, .ret = .void },
+    } },
+    .{ "map_keys", .{
+        .id = 11,
+        .arg_count = 1,
+        .arg_types = null,
+        .ret_type = null,
+        .container = .{ .set = false, .args = &.{}, .ret = .key_array },
+        .fresh = true,
+    } },
+    .{ "matrix", .{
+        .id = 12,
+        .arg_count = 2,
+        .arg_types = &.{ &.{.int}, &.{.int} },
+        .ret_type = .matrix,
+        .fresh = true,
+    } },
+    .{ "matrix_rows", .{
+        .id = 13,
+        .arg_count = 1,
+        .arg_types = &.{&.{.matrix}},
+        .ret_type = .int,
+    } },
+    .{ "matrix_cols", .{
+        .id = 14,
+        .arg_count = 1,
+        .arg_types = &.{&.{.matrix}},
+        .ret_type = .int,
+    } },
+    .{ "matrix_row_sums", .{
+        .id = 15,
+        .arg_count = 1,
+        .arg_types = &.{&.{.matrix}},
+        .ret_type = types.Type{ .array = .{ .base = @constCast(&int_type) } },
+        .fresh = true,
+    } },
+    .{ "matrix_col_sums", .{
+        .id = 16,
+        .arg_count = 1,
+        .arg_types = &.{&.{.matrix}},
+        .ret_type = types.Type{ .array = .{ .base = @constCast(&int_type) } },
+        .fresh = true,
+    } },
+    .{ "matrix_transpose", .{
+        .id = 17,
+        .arg_count = 1,
+        .arg_types = &.{&.{.matrix}},
+        .ret_type = .matrix,
+        .fresh = true,
+    } },
+    .{ "matrix_multiply", .{
+        .id = 18,
+        .arg_count = 2,
+        .arg_types = &.{ &.{.matrix}, &.{.matrix} },
+        .ret_type = .matrix,
+        .fresh = true,
+    } },
+    .{ "bytes_new", .{
+        .id = 19,
+        .arg_count = 1,
+        .arg_types = &.{&.{.int}},
+        .ret_type = .bytes,
+        .fresh = true,
+    } },
+    .{ "bytes_fill", .{
+        .id = 20,
+        .arg_count = 2,
+        .arg_types = &.{ &.{.bytes}, &.{.int} },
+        .ret_type = .void,
+        .pure = false,
+        .mutates = true,
+    } },
+    .{ "bytes_copy", .{
+        .id = 21,
+        .arg_count = 3,
+        .arg_types = &.{ &.{.bytes}, &.{.int}, &.{.bytes} },
+        .ret_type = .void,
+        .pure = false,
+        .mutates = true,
+    } },
+    .{ "bytes_find", .{
+        .id = 22,
+        .arg_count = 3,
+        .arg_types = &.{ &.{.bytes}, &.{.int}, &.{.int} },
+        .ret_type = .int,
+    } },
+    .{ "to_bytes", .{
+        .id = 23,
+        .arg_count = 1,
+        .arg_types = &.{&.{.string}},
+        .ret_type = .bytes,
+        .opcode = .TO_BYTES,
+        .fresh = true,
+        .move_arg = true,
+    } },
+    .{ "from_bytes", .{
+        .id = 24,
+        .arg_count = 1,
+        .arg_types = &.{&.{.bytes}},
+        .ret_type = .string,
+        .opcode = .FROM_BYTES,
+        .fresh = true,
+        .move_arg = true,
+    } },
+    .{ "pqueue_push", .{
+        .id = 25,
+        .arg_count = 2,
+        .arg_types = null,
+        .ret_type = .void,
+        .pure = false,
+        .mutates = true,
+        .container = .{ .map = false, .set = false, .pqueue = true, .args = &.{.key}, .ret = .void },
+    } },
+    .{ "pqueue_pop", .{
+        .id = 26,
+        .arg_count = 1,
+        .arg_types = null,
+        .ret_type = null,
+        .pure = false,
+        .mutates = true,
+        .container = .{ .map = false, .set = false, .pqueue = true, .args = &.{}, .ret = .key },
+    } },
+    .{ "pqueue_peek", .{
+        .id = 27,
+        .arg_count = 1,
+        .arg_types = null,
+        .ret_type = null,
+        .container = .{ .map = false, .set = false, .pqueue = true, .args = &.{}, .ret = .key },
+    } },
+    // Set versions of the map builtins, they share the implementation
+    .{ "set_contains", .{
+        .id = 28,
+        .arg_count = 2,
+        .arg_types = null,
+        .ret_type = .boolean,
+        .container = .{ .map = false, .args = &.{.key}, .ret = .boolean },
+    } },
+    .{ "set_remove", .{
+        .id = 29,
+        .arg_count = 2,
+        .arg_types = null,
+        .ret_type = .boolean,
+        .pure = false,
+        .mutates = true,
+        .container = .{ .map = false, .args = &.{.key}, .ret = .boolean },
+    } },
+    .{ "set_items", .{
+        .id = 30,
+        .arg_count = 1,
+        .arg_types = null,
+        .ret_type = null,
+        .container = .{ .map = false, .args = &.{}, .ret = .key_array },
+        .fresh = true,
     } },
 });
@@ -3,10 +3,16 @@
 const std = @import("std");
 const err = @import("error.zig");
 const lexer = @import("lexer.zig");
+const parallel = @import("parallel.zig");
 const parser = @import("parser.zig");
+const types = @import("types.zig");
 const value = @import("../runtime/value.zig");
 const code_pass = @import("passes/bytecode_backend.zig");
+const frame_pass = @import("passes/frame_array.zig");
+const idiom_pass = @import("passes/loop_idiom.zig");
+const unroll_pass = @import("passes/loop_unroll.zig");
 const symbol_pass = @import("passes/symbol_populate.zig");
+const shake_pass = @import("passes/tree_shake.zig");
 const type_pass = @import("passes/type_check.zig");
 
 /// Container for the bytecode and constants that are obtained
@@ -33,8 +39,12 @@ pub const CompileResult = struct {
     }
 };
 
+pub const Options = struct {
+    parallel: bool = false, // type check and generate top level functions on a thread pool, see parallel.zig
+};
+
 /// Compiles the passed source code into bytecode and related data
-pub fn compile(allocator: std.mem.Allocator, source: []const u8) anyerror!CompileResult {
+pub fn compile(allocator: std.mem.Allocator, source: []const u8, options: Options) anyerror!CompileResult {
     var arena = std.heap.ArenaAllocator.init(allocator);
     defer arena.deinit();
     const arena_allocator = arena.allocator();
@@ -44,7 +54,7 @@ pub fn compile(allocator: std.mem.Allocator, source: []const u8) anyerror!Compil
         .allocator = arena_allocator,
     };
 
-    const result = runPasses(arena_allocator, allocator, &err_ctx, source) catch |comp_err| {
+    const result = runPasses(arena_allocator, allocator, &err_ctx, source, options) catch |comp_err| {
         if (err_ctx.hasErrors()) {
             err_ctx.printErrors();
         }
@@ -55,21 +65,51 @@ pub fn compile(allocator: std.mem.Allocator, source: []const u8) anyerror!Compil
 }
 
 /// Wrapper over the compiler passes so that handling errors is simpler in the compile function
-fn runPasses(arena_allocator: std.mem.Allocator, gpa_allocator: std.mem.Allocator, err_ctx: *err.ErrorContext, source: []const u8) anyerror!CompileResult {
+fn runPasses(arena_allocator: std.mem.Allocator, gpa_allocator: std.mem.Allocator, err_ctx: *err.ErrorContext, source: []const u8, options: Options) anyerror!CompileResult {
+    var parallel_ctx: parallel.Context = undefined;
+    if (options.parallel) {
+        try parallel_ctx.init(gpa_allocator);
+    }
+    defer if (options.parallel) parallel_ctx.deinit();
+
     var lex = lexer.Lexer.init(arena_allocator, err_ctx, source);
     try lex.tokenize();
 
-    var parse = parser.Parser.init(arena_allocator, err_ctx, &lex);
+    // Shared so types built while parsing and type checking are deduplicated
+    // against each other
+    var type_table = types.TypeTable.init(gpa_allocator);
+    defer type_table.deinit();
+    var parse = parser.Parser.init(arena_allocator, err_ctx, &lex, &type_table);
     try parse.parse();
 
     var symbol_populate_pass = try symbol_pass.Pass.init(arena_allocator, err_ctx, &parse.root);
     try symbol_populate_pass.run();
 
-    var type_check_pass = type_pass.Pass.init(arena_allocator, err_ctx, &parse.root);
-    try type_check_pass.run();
+    var type_check_pass = type_pass.Pass.init(arena_allocator, err_ctx, &parse.root, &type_table);
+    if (options.parallel) {
+        try parallel_ctx.typeCheck(&type_check_pass);
+    } else {
+        try type_check_pass.run();
+    }
+
+    var tree_shake_pass = shake_pass.Pass.init(arena_allocator, err_ctx, &parse.root);
+    try tree_shake_pass.run();
+
+    var loop_idiom_pass = idiom_pass.Pass.init(arena_allocator, err_ctx, &parse.root);
+    try loop_idiom_pass.run();
+
+    var loop_unroll_pass = unroll_pass.Pass.init(arena_allocator, err_ctx, &parse.root);
+    try loop_unroll_pass.run();
+
+    var frame_array_pass = frame_pass.Pass.init(arena_allocator, err_ctx, &parse.root);
+    try frame_array_pass.run();
 
     var codegen_pass = try code_pass.Pass.init(arena_allocator, err_ctx, &parse.root);
-    try codegen_pass.run();
+    if (options.parallel) {
+        try parallel_ctx.generate(&codegen_pass);
+    } else {
+        try codegen_pass.run();
+    }
 
     const bytecode = try gpa_allocator.alloc([]const u8, codegen_pass.bytecode.items.len);
     for (0..codegen_pass.bytecode.items.len) |i| {
@@ -12,6 +12,11 @@ pub const ErrorTag = enum(u16) {
     mismatched_types,
     constant_overflow,
     local_overflow,
+    jump_overflow,
+    impure_function,
+    index_out_of_bounds,
+    duplicate_case,
+    constant_assignment,
 };
 
 /// Error metadata, contains all information needed to construct
@@ -66,6 +71,17 @@ pub const ErrorContext = struct {
         }
     }
 
+    /// Moves the errors of other to the end of this context, copying them so
+    /// that other can be freed afterwards
+    pub fn takeErrors(self: *ErrorContext, other: *ErrorContext) std.mem.Allocator.Error!void {
+        while (other.errors.popFirst()) |other_node| {
+            const node = try self.allocator.create(Node);
+            node.data = other_node.data;
+            node.data.message = try self.allocator.dupe(u8, other_node.data.message);
+            self.errors.append(node);
+        }
+    }
+
     pub fn hasErrors(self: *ErrorContext) bool {
         return self.errors.first != null;
     }
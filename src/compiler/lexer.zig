@@ -15,10 +15,12 @@ pub const TokenTag = enum {
     r_square,
     comma,
     period,
+    period_period,
     semicolon,
     colon,
     colon_equals,
     right_arrow,
+    fat_arrow,
     percent,
     bang,
     bang_equals,
@@ -49,10 +51,18 @@ pub const TokenTag = enum {
     keyword_false,
     keyword_and,
     keyword_or,
+    keyword_memo,
+    keyword_struct,
+    keyword_map,
+    keyword_set,
+    keyword_pqueue,
+    keyword_in,
+    keyword_match,
+    keyword_const,
 };
 
 /// Used when parsing identifiers
-const keyword_lookup = std.ComptimeStringMap(TokenTag, .{
+const keywords = .{
     .{ "var", TokenTag.keyword_var },
     .{ "if", TokenTag.keyword_if },
     .{ "while", TokenTag.keyword_while },
@@ -64,12 +74,82 @@ const keyword_lookup = std.ComptimeStringMap(TokenTag, .{
     .{ "true", TokenTag.keyword_true },
     .{ "and", TokenTag.keyword_and },
     .{ "or", TokenTag.keyword_or },
-});
+    .{ "memo", TokenTag.keyword_memo },
+    .{ "struct", TokenTag.keyword_struct },
+    .{ "map", TokenTag.keyword_map },
+    .{ "set", TokenTag.keyword_set },
+    .{ "pqueue", TokenTag.keyword_pqueue },
+    .{ "in", TokenTag.keyword_in },
+    .{ "match", TokenTag.keyword_match },
+    .{ "const", TokenTag.keyword_const },
+};
+
+/// Perfect hash over the keywords, every keyword gets its own slot so a
+/// lookup is a hash and at most one string compare
+const keyword_lookup = struct {
+    const Entry = struct { name: []const u8, tag: TokenTag };
+
+    const slot_count = 64;
+    const seed: u32 = findSeed();
+    const table: [slot_count]?Entry = buildTable(seed) orelse unreachable;
+
+    /// Only looks at the length and the first and last characters, which
+    /// tell all the keywords apart
+    fn slot(hash_seed: u32, word: []const u8) usize {
+        var hash: u32 = @truncate(word.len);
+        hash = hash *% hash_seed +% word[0];
+        hash = hash *% hash_seed +% word[word.len - 1];
+        return (hash ^ (hash >> 11)) % slot_count;
+    }
+
+    fn buildTable(hash_seed: u32) ?[slot_count]?Entry {
+        var slots = [_]?Entry{null} ** slot_count;
+        inline for (keywords) |keyword| {
+            const index = slot(hash_seed, keyword[0]);
+            if (slots[index] != null) {
+                return null;
+            }
+            slots[index] = Entry{ .name = keyword[0], .tag = keyword[1] };
+        }
+        return slots;
+    }
+
+    fn findSeed() u32 {
+        @setEvalBranchQuota(1_000_000);
+        var candidate: u32 = 31;
+        while (candidate < 10_000) : (candidate += 2) {
+            if (buildTable(candidate) != null) {
+                return candidate;
+            }
+        }
+        @compileError("No perfect hash seed found for the keywords");
+    }
+
+    fn get(word: []const u8) ?TokenTag {
+        const entry = table[slot(seed, word)] orelse return null;
+        return if (std.mem.eql(u8, entry.name, word)) entry.tag else null;
+    }
+};
+
+/// Bytes classified per step when scanning
+const lanes = 16;
+const Lane = @Vector(lanes, u8);
+const LaneMask = std.meta.Int(.unsigned, lanes);
+
+/// Character classes that are skipped a whole vector at a time
+const CharClass = enum { identifier, number, whitespace };
+
+/// Interned identifier, equal names always get the same id
+pub const NameId = u32;
+
+/// Interned before lexing so passes can refer to the implicit self argument
+pub const self_name: NameId = 0;
 
 pub const Token = struct {
     tag: TokenTag,
     start: usize,
     end: usize,
+    name: NameId = undefined, // only set for identifiers
 };
 
 pub const Error = error{
@@ -77,15 +157,23 @@ pub const Error = error{
     UnterminatedString,
 } || std.mem.Allocator.Error;
 
-/// Lexer pass, pre-generates all tokens into a queue and feeds them back. It is not
-/// incrementally tokenized.
+/// Rough number of source bytes per token, used to size the token list up
+/// front so it rarely has to grow
+const bytes_per_token = 4;
+
+/// Lexer pass, pre-generates all tokens into a contiguous list and feeds them
+/// back by position. It is not incrementally tokenized.
 pub const Lexer = struct {
     source: []const u8,
     index: usize = 0,
-    queue: std.DoublyLinkedList(Token) = .{},
+    tokens: std.MultiArrayList(Token) = .{},
+    position: usize = 0, // of the next token handed to the parser
     err_ctx: *err.ErrorContext,
     allocator: std.mem.Allocator,
 
+    name_ids: std.StringHashMapUnmanaged(NameId) = std.StringHashMapUnmanaged(NameId){},
+    names: std.ArrayListUnmanaged([]const u8) = std.ArrayListUnmanaged([]const u8){}, // indexed by id, slices of the source
+
     pub fn init(allocator: std.mem.Allocator, err_ctx: *err.ErrorContext, source: []const u8) Lexer {
         return Lexer{
             .source = source,
@@ -94,26 +182,31 @@ pub const Lexer = struct {
         };
     }
 
-    /// Returns most recent token
-    pub fn peekToken(self: *Lexer) ?*Token {
-        if (self.queue.first) |node| {
-            return &node.data;
+    /// Returns the token ahead of the next one by offset, without consuming
+    /// anything
+    pub fn peekToken(self: *const Lexer, offset: usize) ?Token {
+        const index = self.position + offset;
+        if (index >= self.tokens.len) {
+            return null;
         }
-        return null;
+        return self.tokens.get(index);
     }
 
-    /// Pops token off of queue and returns it
-    pub fn nextToken(self: *Lexer) ?Token {
-        if (self.queue.popFirst()) |node| {
-            const token = node.data;
-            self.allocator.destroy(node);
-            return token;
+    /// Tag of the token ahead of the next one by offset, only reads the
+    /// packed tag array
+    pub fn peekTag(self: *const Lexer, offset: usize) ?TokenTag {
+        const index = self.position + offset;
+        if (index >= self.tokens.len) {
+            return null;
         }
-        return null;
+        return self.tokens.items(.tag)[index];
     }
 
-    /// Queues all tokens in the contained source
+    /// Stores all tokens in the contained source
     pub fn tokenize(self: *Lexer) Error!void {
+        try self.tokens.ensureTotalCapacity(self.allocator, self.source.len / bytes_per_token + 1);
+        const self_id = try self.intern("self");
+        std.debug.assert(self_id == self_name);
         while (self.index < self.source.len) {
             self.skipWhitespace();
             if (self.peekChar() == null) {
@@ -141,12 +234,7 @@ pub const Lexer = struct {
         std.debug.assert(self.peekChar() != null);
         std.debug.assert(isNumber(self.peekChar().?));
         const start = self.index;
-        while (self.peekChar()) |c| {
-            if (!isNumber(c)) {
-                break;
-            }
-            _ = self.nextChar();
-        }
+        self.skipClass(.number);
         const end = self.index;
         try self.pushToken(Token{ .tag = .number, .start = start, .end = end });
     }
@@ -155,15 +243,28 @@ pub const Lexer = struct {
         std.debug.assert(self.peekChar() != null);
         std.debug.assert(isIdentifier(self.peekChar().?));
         const start = self.index;
-        while (self.peekChar()) |c| {
-            if (!isIdentifier(c)) {
-                break;
-            }
-            _ = self.nextChar();
-        }
+        self.skipClass(.identifier);
         const end = self.index;
-        const tag = if (keyword_lookup.get(self.source[start..end])) |keyword| keyword else TokenTag.identifier;
-        try self.pushToken(Token{ .tag = tag, .start = start, .end = end });
+        if (keyword_lookup.get(self.source[start..end])) |keyword| {
+            try self.pushToken(Token{ .tag = keyword, .start = start, .end = end });
+            return;
+        }
+        const name = try self.intern(self.source[start..end]);
+        try self.pushToken(Token{ .tag = .identifier, .start = start, .end = end, .name = name });
+    }
+
+    /// Text of an interned name, shared by every occurrence of it
+    pub fn nameOf(self: *const Lexer, name: NameId) []const u8 {
+        return self.names.items[name];
+    }
+
+    fn intern(self: *Lexer, text: []const u8) Error!NameId {
+        const entry = try self.name_ids.getOrPut(self.allocator, text);
+        if (!entry.found_existing) {
+            entry.value_ptr.* = @intCast(self.names.items.len);
+            try self.names.append(self.allocator, text);
+        }
+        return entry.value_ptr.*;
     }
 
     fn tokenizeString(self: *Lexer) Error!void {
@@ -171,12 +272,8 @@ pub const Lexer = struct {
         std.debug.assert(start_char == '\"');
 
         const start = self.index;
-        while (self.peekChar()) |c| {
-            _ = self.nextChar();
-            if (c == '\"') {
-                break;
-            }
-        }
+        // Past the closing quote, or the end of the source if there is none
+        self.index = if (self.findByte('\"')) |quote| quote + 1 else self.source.len;
         const end = self.index;
 
         if (end >= self.source.len - 1) {
@@ -200,7 +297,12 @@ pub const Lexer = struct {
             '[' => tag = .l_square,
             ']' => tag = .r_square,
             ',' => tag = .comma,
-            '.' => tag = .period,
+            '.' => if (self.peekChar() == '.') {
+                _ = self.nextChar();
+                tag = .period_period;
+            } else {
+                tag = .period;
+            },
             '%' => tag = .percent,
             '!' => if (self.peekChar()) |c| {
                 switch (c) {
@@ -270,6 +372,10 @@ pub const Lexer = struct {
                         _ = self.nextChar();
                         tag = .equals_equals;
                     },
+                    '>' => {
+                        _ = self.nextChar();
+                        tag = .fat_arrow;
+                    },
                     else => tag = .equals,
                 }
             },
@@ -311,17 +417,71 @@ pub const Lexer = struct {
     }
 
     fn ignoreLine(self: *Lexer) void {
-        while (self.nextChar()) |c| {
-            if (c == '\n') {
+        self.index = if (self.findByte('\n')) |newline| newline + 1 else self.source.len;
+    }
+
+    /// Index of the next occurrence of the byte, null if there is none
+    fn findByte(self: *const Lexer, byte: u8) ?usize {
+        const needle: Lane = @splat(byte);
+        var i = self.index;
+        while (i + lanes <= self.source.len) : (i += lanes) {
+            const chunk: Lane = self.source[i..][0..lanes].*;
+            const matches: LaneMask = @bitCast(chunk == needle);
+            if (matches != 0) {
+                return i + @ctz(matches);
+            }
+        }
+        return std.mem.indexOfScalarPos(u8, self.source, i, byte);
+    }
+
+    /// Advances past every character in the class, a vector at a time
+    fn skipClass(self: *Lexer, comptime class: CharClass) void {
+        while (self.index + lanes <= self.source.len) {
+            const chunk: Lane = self.source[self.index..][0..lanes].*;
+            const outside = ~classMask(chunk, class);
+            if (outside != 0) {
+                self.index += @ctz(outside);
+                return;
+            }
+            self.index += lanes;
+        }
+        while (self.peekChar()) |c| {
+            const inside = switch (class) {
+                .identifier => isIdentifier(c),
+                .number => isNumber(c),
+                .whitespace => isWhitespace(c),
+            };
+            if (!inside) {
                 break;
             }
+            self.index += 1;
         }
     }
 
+    /// Bit per byte of the chunk that is in the class
+    fn classMask(chunk: Lane, comptime class: CharClass) LaneMask {
+        return switch (class) {
+            .identifier => inRange(chunk, 'a', 'z') | inRange(chunk, 'A', 'Z') | inRange(chunk, '0', '9') | equalTo(chunk, '_'),
+            .number => inRange(chunk, '0', '9'),
+            .whitespace => equalTo(chunk, ' ') | equalTo(chunk, '\n') | equalTo(chunk, '\t') | equalTo(chunk, '\r'),
+        };
+    }
+
+    inline fn inRange(chunk: Lane, comptime low: u8, comptime high: u8) LaneMask {
+        const low_lane: Lane = @splat(low);
+        const high_lane: Lane = @splat(high);
+        const above: LaneMask = @bitCast(chunk >= low_lane);
+        const below: LaneMask = @bitCast(chunk <= high_lane);
+        return above & below;
+    }
+
+    inline fn equalTo(chunk: Lane, comptime char: u8) LaneMask {
+        const char_lane: Lane = @splat(char);
+        return @bitCast(chunk == char_lane);
+    }
+
     fn pushToken(self: *Lexer, token: Token) Error!void {
-        const node = try self.allocator.create(std.DoublyLinkedList(Token).Node);
-        node.* = .{ .prev = null, .next = null, .data = token };
-        self.queue.append(node);
+        try self.tokens.append(self.allocator, token);
     }
 
     fn peekChar(self: *Lexer) ?u8 {
@@ -341,12 +501,7 @@ pub const Lexer = struct {
     }
 
     fn skipWhitespace(self: *Lexer) void {
-        while (self.peekChar()) |c| {
-            if (!isWhitespace(c)) {
-                break;
-            }
-            _ = self.nextChar();
-        }
+        self.skipClass(.whitespace);
     }
 
     fn isWhitespace(c: u8) bool {
@@ -0,0 +1,211 @@
+//! Parallel mode of the compiler. Once symbols are populated, the body of a
+//! top level function only depends on the signatures of other functions, so
+//! bodies are type checked and generated on a thread pool. Every function is
+//! a unit with its own arena and error context, and units are merged back in
+//! declaration order so the output doesn't depend on scheduling.
+
+const std = @import("std");
+const ast = @import("ast.zig");
+const err = @import("error.zig");
+const code_pass = @import("passes/bytecode_backend.zig");
+const type_pass = @import("passes/type_check.zig");
+
+/// Top level function compiled on a worker thread
+const Unit = struct {
+    func: *ast.Node,
+    arena: std.heap.ArenaAllocator,
+    err_ctx: err.ErrorContext,
+    codegen: code_pass.Pass = undefined, // output of the unit, linked after the root
+    failure: ?anyerror = null,
+};
+
+/// Owns the thread pool and the arenas of every unit, which hold memory
+/// that is used until the compile result is copied out
+pub const Context = struct {
+    pool: std.Thread.Pool = undefined,
+    units: std.ArrayListUnmanaged(*Unit) = std.ArrayListUnmanaged(*Unit){},
+    allocator: std.mem.Allocator, // has to be thread safe, backs the unit arenas
+
+    /// Initialized in place, the pool can't be moved
+    pub fn init(self: *Context, allocator: std.mem.Allocator) !void {
+        self.* = Context{ .allocator = allocator };
+        try self.pool.init(.{ .allocator = allocator });
+    }
+
+    pub fn deinit(self: *Context) void {
+        self.pool.deinit();
+        for (self.units.items) |unit| {
+            unit.arena.deinit();
+            self.allocator.destroy(unit);
+        }
+        self.units.deinit(self.allocator);
+    }
+
+    /// Checks every signature up front, then the bodies of the top level
+    /// functions in parallel, then everything else. Falls back to checking
+    /// serially if there are generic functions, as their instances are
+    /// created by the calls inside of other bodies.
+    pub fn typeCheck(self: *Context, pass: *type_pass.Pass) !void {
+        var functions = FunctionCollector{ .allocator = pass.allocator };
+        try functions.collect(pass.root);
+        if (functions.generic) {
+            return pass.run();
+        }
+
+        var signed = ast.NodeSet{};
+        for (functions.named.items) |func| {
+            try pass.checkSignature(func);
+            try signed.put(pass.allocator, func, {});
+        }
+
+        const units = try self.createUnits(pass.root, pass.err_ctx.source);
+        var wait_group = std.Thread.WaitGroup{};
+        const spawn_failure = self.spawnAll(units, &wait_group, checkUnit, .{ pass, &signed });
+        wait_group.wait();
+        try finish(units, pass.err_ctx, spawn_failure);
+
+        const unit_set = try unitSet(pass.allocator, units);
+        // Both sets only live until this returns
+        pass.signed = &signed;
+        pass.units = &unit_set;
+        defer {
+            pass.signed = null;
+            pass.units = null;
+        }
+        try pass.run();
+    }
+
+    /// Generates the top level functions in parallel with the root, then
+    /// links the root and every unit into one output
+    pub fn generate(self: *Context, pass: *code_pass.Pass) !void {
+        const units = try self.createUnits(pass.root, pass.err_ctx.source);
+        const unit_set = try unitSet(pass.allocator, units);
+        pass.relocate = true;
+        pass.units = &unit_set;
+        defer pass.units = null;
+
+        var wait_group = std.Thread.WaitGroup{};
+        const spawn_failure = self.spawnAll(units, &wait_group, generateUnit, .{pass.root});
+        // The root only refers to the units through relocations, so it is
+        // generated while the workers run
+        const root_result = pass.run();
+        wait_group.wait();
+        // Unit errors are merged first so a failing root doesn't hide them
+        try finish(units, pass.err_ctx, spawn_failure);
+        try root_result;
+
+        const unit_passes = try pass.allocator.alloc(*code_pass.Pass, units.len);
+        for (units, unit_passes) |unit, *unit_pass| {
+            unit_pass.* = &unit.codegen;
+        }
+        try pass.link(unit_passes);
+    }
+
+    /// A unit for every named function declared at the top level
+    fn createUnits(self: *Context, root: *ast.Node, source: []const u8) ![]*Unit {
+        const start = self.units.items.len;
+        for (root.data.block.list.items) |statement| {
+            switch (statement.data) {
+                .function_value => |*func| if (func.name == null or func.type_params.len > 0) continue,
+                else => continue,
+            }
+            const unit = try self.allocator.create(Unit);
+            unit.* = Unit{
+                .func = statement,
+                .arena = std.heap.ArenaAllocator.init(self.allocator),
+                .err_ctx = undefined,
+            };
+            unit.err_ctx = err.ErrorContext{ .source = source, .allocator = unit.arena.allocator() };
+            try self.units.append(self.allocator, unit);
+        }
+        return self.units.items[start..];
+    }
+
+    /// Runs the work for every unit on the pool, returns the error that
+    /// stopped spawning if not every unit could be started
+    fn spawnAll(self: *Context, units: []*Unit, wait_group: *std.Thread.WaitGroup, comptime work: anytype, args: anytype) ?anyerror {
+        const Runner = struct {
+            fn run(unit: *Unit, group: *std.Thread.WaitGroup, work_args: @TypeOf(args)) void {
+                defer group.finish();
+                @call(.auto, work, .{unit} ++ work_args) catch |unit_err| {
+                    unit.failure = unit_err;
+                };
+            }
+        };
+        for (units) |unit| {
+            wait_group.start();
+            self.pool.spawn(Runner.run, .{ unit, wait_group, args }) catch |spawn_err| {
+                wait_group.finish();
+                return spawn_err;
+            };
+        }
+        return null;
+    }
+
+    /// Moves the errors of the units into the main context in declaration
+    /// order and returns the first failure
+    fn finish(units: []*Unit, err_ctx: *err.ErrorContext, spawn_failure: ?anyerror) !void {
+        for (units) |unit| {
+            try err_ctx.takeErrors(&unit.err_ctx);
+        }
+        if (spawn_failure) |failure| {
+            return failure;
+        }
+        for (units) |unit| {
+            if (unit.failure) |failure| {
+                return failure;
+            }
+        }
+    }
+
+    fn unitSet(allocator: std.mem.Allocator, units: []*Unit) !ast.NodeSet {
+        var set = ast.NodeSet{};
+        for (units) |unit| {
+            try set.put(allocator, unit.func, {});
+        }
+        return set;
+    }
+};
+
+fn checkUnit(unit: *Unit, pass: *type_pass.Pass, signed: *const ast.NodeSet) type_pass.Error!void {
+    var unit_pass = type_pass.Pass.init(unit.arena.allocator(), &unit.err_ctx, pass.root, pass.type_table);
+    unit_pass.signed = signed;
+    try unit_pass.checkBody(unit.func);
+}
+
+fn generateUnit(unit: *Unit, root: *ast.Node) code_pass.Error!void {
+    unit.codegen = try code_pass.Pass.init(unit.arena.allocator(), &unit.err_ctx, root);
+    unit.codegen.relocate = true;
+    try unit.codegen.runUnit(unit.func);
+}
+
+/// Finds every named function, and whether any of them are generic
+const FunctionCollector = struct {
+    named: std.ArrayListUnmanaged(*ast.Node) = std.ArrayListUnmanaged(*ast.Node){},
+    generic: bool = false,
+    failure: ?std.mem.Allocator.Error = null,
+    allocator: std.mem.Allocator,
+
+    fn collect(self: *FunctionCollector, node: *ast.Node) std.mem.Allocator.Error!void {
+        if (!self.visit(node)) {
+            return self.failure.?;
+        }
+    }
+
+    fn visit(self: *FunctionCollector, node: *ast.Node) bool {
+        switch (node.data) {
+            .function_value => |*func| {
+                if (func.type_params.len > 0) {
+                    self.generic = true;
+                } else if (func.name != null) {
+                    self.named.append(self.allocator, node) catch |append_err| {
+                        self.failure = append_err;
+                        return false;
+                    };
+                }
+            },
+            else => {},
+        }
+        return node.visitChildren(self, visit);
+    }
+};
@@ -23,14 +23,16 @@ pub const Error = error{
 pub const Parser = struct {
     lexer: *lexer.Lexer,
     root: ast.Node,
-    current: ?lexer.Token = null,
-    previous: ?lexer.Token = null,
+    structs: std.AutoHashMapUnmanaged(lexer.NameId, *types.Struct) = std.AutoHashMapUnmanaged(lexer.NameId, *types.Struct){},
+    type_table: *types.TypeTable,
+    type_params: []const lexer.NameId = &.{}, // of the generic function being parsed
     err_ctx: *err.ErrorContext,
     allocator: std.mem.Allocator,
 
-    pub fn init(allocator: std.mem.Allocator, err_ctx: *err.ErrorContext, lex: *lexer.Lexer) Parser {
+    pub fn init(allocator: std.mem.Allocator, err_ctx: *err.ErrorContext, lex: *lexer.Lexer, type_table: *types.TypeTable) Parser {
         const parser = Parser{
             .lexer = lex,
+            .type_table = type_table,
             .root = ast.Node{ .index = 0, .data = .{ .block = .{
                 .list = std.ArrayListUnmanaged(*ast.Node){},
             } } },
@@ -42,27 +44,93 @@ pub const Parser = struct {
 
     /// Performs all parsing of the tokens held within the passed lexer
     pub fn parse(self: *Parser) Error!void {
-        _ = self.nextToken();
-        _ = self.nextToken();
-        while (self.previous != null) {
+        while (self.peekTag() != null) {
+            // Struct declarations only introduce a type so they have no node
+            if (self.peekTag().? == .keyword_struct) {
+                try self.parseStructDecl();
+                continue;
+            }
             const statement = try self.parseStatement();
             try self.root.data.block.list.append(self.allocator, statement);
         }
     }
 
     fn parseType(self: *Parser) Error!types.Type {
-        if (self.previous == null) {
+        if (self.peekTag() == null) {
             try self.err_ctx.newError(.unexpected_end, "Expected type, found end", .{}, null);
             return Error.UnexpectedEnd;
         }
 
-        switch (self.previous.?.tag) {
+        switch (self.peekTag().?) {
+            .l_paren => {
+                const start = try self.expectToken(.l_paren);
+
+                var item_types = std.ArrayListUnmanaged(*types.Type){};
+
+                while (self.peekNot(.r_paren)) {
+                    try item_types.append(self.allocator, try self.type_table.intern(try self.parseType()));
+                    if (self.peekNot(.r_paren)) {
+                        _ = try self.expectToken(.comma);
+                    }
+                }
+
+                _ = try self.expectToken(.r_paren);
+
+                if (item_types.items.len < 2) {
+                    try self.err_ctx.errorFromToken(.unexpected_token, "Expected at least two types in tuple type", .{}, start);
+                    return Error.UnexpectedToken;
+                }
+
+                return types.Type{ .tuple = .{ .items = item_types.items } };
+            },
+            .keyword_map => {
+                self.nextToken();
+                _ = try self.expectToken(.l_square);
+                const key = try self.parseHashableType();
+                _ = try self.expectToken(.r_square);
+                const map_value = try self.parseType();
+                if (map_value.equal(&.void)) {
+                    try self.err_ctx.errorFromToken(.unexpected_token, "Void is a not a permitted map value type", .{}, self.peekToken().?);
+                    return Error.UnexpectedToken;
+                }
+                return types.Type{ .map = .{
+                    .key = try self.type_table.intern(key),
+                    .value = try self.type_table.intern(map_value),
+                } };
+            },
+            .keyword_set => {
+                self.nextToken();
+                _ = try self.expectToken(.l_square);
+                const item = try self.parseHashableType();
+                _ = try self.expectToken(.r_square);
+                return types.Type{ .set = .{ .item = try self.type_table.intern(item) } };
+            },
+            .keyword_pqueue => {
+                self.nextToken();
+                _ = try self.expectToken(.l_square);
+                const item = try self.parseType();
+                if (item.equal(&.void)) {
+                    try self.err_ctx.errorFromToken(.unexpected_token, "Void is a not a permitted priority queue item type", .{}, self.peekToken().?);
+                    return Error.UnexpectedToken;
+                }
+                _ = try self.expectToken(.r_square);
+                return types.Type{ .pqueue = .{ .item = try self.type_table.intern(item) } };
+            },
             .l_square => {
-                _ = self.nextToken();
+                self.nextToken();
                 const inner = try self.parseType();
+                const heap_inner = try self.type_table.intern(inner);
+                if (self.peekTag() == .semicolon) {
+                    self.nextToken();
+                    const number = try self.expectToken(.number);
+                    const len = std.fmt.parseInt(usize, self.lexer.source[number.start..number.end], 10) catch {
+                        try self.err_ctx.errorFromToken(.unexpected_token, "Fixed array length is too large", .{}, number);
+                        return Error.UnexpectedToken;
+                    };
+                    _ = try self.expectToken(.r_square);
+                    return types.Type{ .fixed_array = .{ .base = heap_inner, .len = len } };
+                }
                 _ = try self.expectToken(.r_square);
-                const heap_inner = try self.allocator.create(types.Type);
-                heap_inner.* = inner;
                 return types.Type{ .array = .{ .base = heap_inner } };
             },
             .identifier => {
@@ -71,18 +139,26 @@ pub const Parser = struct {
                 if (types.builtin_lookup.get(raw_name)) |builtin_type| {
                     return builtin_type;
                 }
+                for (self.type_params, 0..) |param, i| {
+                    if (param == name.name) {
+                        return types.Type{ .param = .{ .index = i, .name = raw_name } };
+                    }
+                }
+                if (self.structs.get(name.name)) |structure| {
+                    return types.Type{ .structure = structure };
+                }
                 try self.err_ctx.errorFromToken(.unexpected_end, "Failed to parse type \"{s}\"", .{raw_name}, name);
                 return Error.UnexpectedToken;
             },
             .keyword_fn => {
-                _ = self.nextToken();
+                self.nextToken();
                 _ = try self.expectToken(.l_paren);
 
-                var arg_types = std.ArrayListUnmanaged(types.Type){};
+                var arg_types = std.ArrayListUnmanaged(*types.Type){};
 
-                while (self.previous != null and self.previous.?.tag != .r_paren) {
-                    try arg_types.append(self.allocator, try self.parseType());
-                    if (self.previous != null and self.previous.?.tag != .r_paren) {
+                while (self.peekNot(.r_paren)) {
+                    try arg_types.append(self.allocator, try self.type_table.intern(try self.parseType()));
+                    if (self.peekNot(.r_paren)) {
                         _ = try self.expectToken(.comma);
                     }
                 }
@@ -90,26 +166,35 @@ pub const Parser = struct {
                 _ = try self.expectToken(.r_paren);
                 _ = try self.expectToken(.right_arrow);
 
-                const ret_type_raw = try self.parseType();
-                const ret_type = try self.allocator.create(types.Type);
-                ret_type.* = ret_type_raw;
+                const ret_type = try self.type_table.intern(try self.parseType());
 
                 return types.Type{
                     .function = .{
-                        .args = arg_types,
+                        .args = arg_types.items,
                         .ret = ret_type,
                     },
                 };
             },
             else => {
-                try self.err_ctx.errorFromToken(.unexpected_end, "Failed to parse type", .{}, self.previous.?);
+                try self.err_ctx.errorFromToken(.unexpected_end, "Failed to parse type", .{}, self.peekToken().?);
                 return Error.UnexpectedToken;
             },
         }
     }
 
+    /// Map keys and set items are hashed by value
+    fn parseHashableType(self: *Parser) Error!types.Type {
+        const start = self.peekToken();
+        const parsed = try self.parseType();
+        if (!parsed.isHashable()) {
+            try self.err_ctx.errorFromToken(.unexpected_token, "Expected int, bool or string as map key or set item, found type \"{any}\"", .{parsed}, start.?);
+            return Error.UnexpectedToken;
+        }
+        return parsed;
+    }
+
     fn parseExpression(self: *Parser) Error!*ast.Node {
-        if (self.previous == null) {
+        if (self.peekTag() == null) {
             try self.err_ctx.newError(.unexpected_end, "Expected expression, found end", .{}, null);
             return Error.UnexpectedEnd;
         }
@@ -121,9 +206,8 @@ pub const Parser = struct {
         var lhs = try self.parseBasicExpression();
 
         // binary expressions
-        while (self.previous) |prev| {
-            const index = prev.start;
-            const op = switch (prev.tag) {
+        while (self.peekTag()) |tag| {
+            const op = switch (tag) {
                 .plus => ast.Operator.add,
                 .minus => ast.Operator.sub,
                 .star => ast.Operator.mul,
@@ -131,6 +215,7 @@ pub const Parser = struct {
                 .percent => ast.Operator.mod,
                 .l_paren => ast.Operator{ .call = undefined },
                 .l_square => ast.Operator{ .index = undefined },
+                .period => ast.Operator{ .field = undefined },
                 .equals_equals => ast.Operator.equals,
                 .bang_equals => ast.Operator.not_equals,
                 .greater_than => ast.Operator.greater_than,
@@ -146,7 +231,7 @@ pub const Parser = struct {
                 if (precedence.lhs < min_precedence) {
                     break;
                 }
-                _ = self.nextToken();
+                self.nextToken();
                 const node = try self.parsePostfix(op, lhs);
                 lhs = node;
                 continue;
@@ -157,7 +242,8 @@ pub const Parser = struct {
                     break;
                 }
 
-                _ = self.nextToken();
+                const index = self.peekToken().?.start;
+                self.nextToken();
 
                 const rhs = try self.parsePrecedenceExpression(precedence.rhs);
 
@@ -181,21 +267,30 @@ pub const Parser = struct {
     }
 
     fn parseBasicExpression(self: *Parser) Error!*ast.Node {
-        const expression = switch (self.previous.?.tag) {
+        const expression = switch (self.peekTag().?) {
             .l_paren => try self.parseParen(),
             .l_square => try self.parseArrayInit(),
             .identifier => blk: {
-                if (builtin.lookup.has(self.lexer.source[self.previous.?.start..self.previous.?.end])) {
+                const token = self.peekToken().?;
+                const name = self.lexer.source[token.start..token.end];
+                if (builtin.lookup.has(name)) {
                     break :blk try self.parseBuiltin();
                 }
+                if (self.structs.get(token.name)) |structure| {
+                    if (self.lexer.peekTag(1) == .l_curly) {
+                        break :blk try self.parseStructInit(structure);
+                    }
+                }
                 break :blk try self.parseVarGet();
             },
             .number => try self.parseIntConstant(),
             .string_literal => try self.parseStringConstant(),
             .keyword_fn => try self.parseFunctionValue(),
+            .keyword_map, .keyword_set, .keyword_pqueue => try self.parseContainerInit(),
             .keyword_true, .keyword_false => try self.parseBoolean(),
             else => {
-                try self.err_ctx.errorFromToken(.unexpected_token, "Expected expression, found [{s},\"{s}\"]", .{ @tagName(self.previous.?.tag), self.lexer.source[self.previous.?.start..self.previous.?.end] }, self.previous.?);
+                const token = self.peekToken().?;
+                try self.err_ctx.errorFromToken(.unexpected_token, "Expected expression, found [{s},\"{s}\"]", .{ @tagName(token.tag), self.lexer.source[token.start..token.end] }, token);
                 return Error.UnexpectedToken;
             },
         };
@@ -210,11 +305,11 @@ pub const Parser = struct {
             .call => |_| {
                 var args = std.ArrayListUnmanaged(*ast.Node){};
 
-                while (self.previous != null and self.previous.?.tag != .r_paren) {
+                while (self.peekNot(.r_paren)) {
                     const arg = try self.parseExpression();
                     try args.append(self.allocator, arg);
-                    if (self.previous != null and self.previous.?.tag == .comma) {
-                        _ = self.nextToken();
+                    if (self.peekTag() == .comma) {
+                        self.nextToken();
                     }
                 }
                 _ = try self.expectToken(.r_paren);
@@ -228,11 +323,18 @@ pub const Parser = struct {
                 } };
             },
             .index => |_| {
+                const index = try self.parseExpression();
+                // `m[i, j]` indexes a matrix
+                const column = if (self.peekTag() == .comma) blk: {
+                    self.nextToken();
+                    break :blk try self.parseExpression();
+                } else null;
                 node.data = .{
                     .unary_op = .{
                         .op = .{
                             .index = .{
-                                .index = try self.parseExpression(),
+                                .index = index,
+                                .column = column,
                             },
                         },
                         .expr = expr,
@@ -240,16 +342,80 @@ pub const Parser = struct {
                 };
                 _ = try self.expectToken(.r_square);
             },
+            .field => |_| {
+                const name = try self.expectToken(.identifier);
+                node.data = .{
+                    .unary_op = .{
+                        .op = .{
+                            .field = .{
+                                .name = self.lexer.nameOf(name.name),
+                                .name_id = name.name,
+                            },
+                        },
+                        .expr = expr,
+                    },
+                };
+            },
             else => unreachable,
         }
         return node;
     }
 
     fn parseParen(self: *Parser) Error!*ast.Node {
-        _ = try self.expectToken(.l_paren);
+        const start = try self.expectToken(.l_paren);
         const expr = try self.parseExpression();
+        if (self.peekTag() != .comma) {
+            _ = try self.expectToken(.r_paren);
+            return expr;
+        }
+
+        var items = std.ArrayListUnmanaged(*ast.Node){};
+        try items.append(self.allocator, expr);
+
+        while (self.peekTag() == .comma) {
+            self.nextToken();
+            try items.append(self.allocator, try self.parseExpression());
+        }
+
         _ = try self.expectToken(.r_paren);
-        return expr;
+
+        const node = try self.allocator.create(ast.Node);
+        node.* = .{
+            .index = start.start,
+            .data = .{
+                .tuple_init = .{
+                    .items = items,
+                },
+            },
+        };
+
+        return node;
+    }
+
+    /// Parses `map[K]V{}`, `set[T]{}` and `pqueue[T]{}`, containers always
+    /// start out empty. Priority queues can be passed a comparator,
+    /// `pqueue[T]{cmp}`.
+    fn parseContainerInit(self: *Parser) Error!*ast.Node {
+        const start = self.peekToken().?;
+        const container_type = try self.parseType();
+        _ = try self.expectToken(.l_curly);
+        const comparator = if (container_type == .pqueue and self.peekNot(.r_curly))
+            try self.parseExpression()
+        else
+            null;
+        _ = try self.expectToken(.r_curly);
+
+        const node = try self.allocator.create(ast.Node);
+        node.* = .{
+            .index = start.start,
+            .data = .{
+                .container_init = .{
+                    .container_type = container_type,
+                    .comparator = comparator,
+                },
+            },
+        };
+        return node;
     }
 
     fn parseArrayInit(self: *Parser) Error!*ast.Node {
@@ -257,11 +423,11 @@ pub const Parser = struct {
 
         var items = std.ArrayListUnmanaged(*ast.Node){};
 
-        while (self.previous != null and self.previous.?.tag != .r_square) {
+        while (self.peekNot(.r_square)) {
             const expr = try self.parseExpression();
             try items.append(self.allocator, expr);
-            if (self.previous != null and self.previous.?.tag == .comma) {
-                _ = self.nextToken();
+            if (self.peekTag() == .comma) {
+                self.nextToken();
             }
         }
 
@@ -320,7 +486,8 @@ pub const Parser = struct {
             .index = identifier.start,
             .data = .{
                 .var_get = .{
-                    .name = try self.allocator.dupe(u8, self.lexer.source[identifier.start..identifier.end]),
+                    .name = self.lexer.nameOf(identifier.name),
+                    .name_id = identifier.name,
                 },
             },
         };
@@ -363,12 +530,36 @@ pub const Parser = struct {
     fn parseFunctionValue(self: *Parser) Error!*ast.Node {
         const start = try self.expectToken(.keyword_fn);
 
-        const next = try self.expectToken(null);
+        var next = try self.expectToken(null);
+        const memo = next.tag == .keyword_memo;
+        if (memo) {
+            next = try self.expectToken(null);
+        }
+
+        // Type parameters are only visible inside of the function
+        const outer_params = self.type_params;
+        defer self.type_params = outer_params;
+        var type_params: []const []const u8 = &.{};
+
         const func_name = switch (next.tag) {
             .identifier => blk: {
-                const dupe = try self.allocator.dupe(u8, self.lexer.source[next.start..next.end]);
+                const name = self.lexer.nameOf(next.name);
+                if (self.peekTag() == .less_than) {
+                    // Indices of the inner parameters would clash with the
+                    // outer ones once the outer function is instantiated
+                    if (outer_params.len > 0) {
+                        try self.err_ctx.errorFromToken(.unexpected_token, "Generic function \"{s}\" can't be declared inside of another generic function", .{name}, next);
+                        return Error.UnexpectedToken;
+                    }
+                    self.type_params = try self.parseTypeParams();
+                    const names = try self.allocator.alloc([]const u8, self.type_params.len);
+                    for (self.type_params, names) |param, *param_name| {
+                        param_name.* = self.lexer.nameOf(param);
+                    }
+                    type_params = names;
+                }
                 _ = try self.expectToken(.l_paren);
-                break :blk dupe;
+                break :blk name;
             },
             .l_paren => null,
             else => {
@@ -379,13 +570,13 @@ pub const Parser = struct {
 
         var args = std.ArrayListUnmanaged(ast.SymbolDecl){};
 
-        const self_ref: bool = if (self.previous != null and self.previous.?.tag != .r_paren) blk: {
-            switch (self.previous.?.tag) {
+        const self_ref: bool = if (self.peekNot(.r_paren)) blk: {
+            switch (self.peekTag().?) {
                 .identifier => {
-                    if (std.mem.eql(u8, self.lexer.source[self.previous.?.start..self.previous.?.end], "self")) {
-                        _ = self.nextToken();
-                        if (self.previous != null and self.previous.?.tag == .comma) {
-                            _ = self.nextToken();
+                    if (self.peekToken().?.name == lexer.self_name) {
+                        self.nextToken();
+                        if (self.peekTag() == .comma) {
+                            self.nextToken();
                         }
                         break :blk true;
                     }
@@ -395,7 +586,7 @@ pub const Parser = struct {
             }
         } else false;
 
-        while (self.previous != null and self.previous.?.tag != .r_paren) {
+        while (self.peekNot(.r_paren)) {
             const name = try self.expectToken(.identifier);
 
             _ = try self.expectToken(.colon);
@@ -408,12 +599,13 @@ pub const Parser = struct {
             }
 
             try args.append(self.allocator, .{
-                .name = try self.allocator.dupe(u8, self.lexer.source[name.start..name.end]),
+                .name = self.lexer.nameOf(name.name),
+                .name_id = name.name,
                 .decl_type = arg_type,
             });
 
-            if (self.previous != null and self.previous.?.tag == .comma) {
-                _ = self.nextToken();
+            if (self.peekTag() == .comma) {
+                self.nextToken();
             }
         }
 
@@ -429,10 +621,13 @@ pub const Parser = struct {
             .data = .{
                 .function_value = .{
                     .self_arg = self_ref,
+                    .memo = memo,
                     .name = func_name,
+                    .name_id = if (func_name != null) next.name else undefined,
                     .args = args,
                     .ret_type = ret_type,
                     .body = body,
+                    .type_params = type_params,
                 },
             },
         };
@@ -440,6 +635,30 @@ pub const Parser = struct {
         return node;
     }
 
+    /// Parses the `<T, U>` after the name of a generic function
+    fn parseTypeParams(self: *Parser) Error![]const lexer.NameId {
+        const start = try self.expectToken(.less_than);
+        var params = std.ArrayListUnmanaged(lexer.NameId){};
+        while (self.peekNot(.greater_than)) {
+            const name = try self.expectToken(.identifier);
+            const raw_name = self.lexer.source[name.start..name.end];
+            if (types.builtin_lookup.has(raw_name) or self.structs.contains(name.name)) {
+                try self.err_ctx.errorFromToken(.unexpected_token, "Type parameter \"{s}\" shadows a type", .{raw_name}, name);
+                return Error.UnexpectedToken;
+            }
+            try params.append(self.allocator, name.name);
+            if (self.peekNot(.greater_than)) {
+                _ = try self.expectToken(.comma);
+            }
+        }
+        _ = try self.expectToken(.greater_than);
+        if (params.items.len == 0) {
+            try self.err_ctx.errorFromToken(.unexpected_token, "Expected at least one type parameter", .{}, start);
+            return Error.UnexpectedToken;
+        }
+        return params.items;
+    }
+
     fn parseBoolean(self: *Parser) Error!*ast.Node {
         const token = try self.expectToken(null);
 
@@ -459,13 +678,13 @@ pub const Parser = struct {
     }
 
     fn parseStatement(self: *Parser) Error!*ast.Node {
-        if (self.previous == null) {
+        if (self.peekTag() == null) {
             try self.err_ctx.newError(.unexpected_end, "Expected statement, found end", .{}, null);
             return Error.UnexpectedEnd;
         }
 
         var needs_semicolon = true;
-        const statement = switch (self.previous.?.tag) {
+        const statement = switch (self.peekTag().?) {
             .keyword_while => blk: {
                 needs_semicolon = false;
                 break :blk try self.parseWhileLoop();
@@ -474,10 +693,10 @@ pub const Parser = struct {
                 needs_semicolon = false;
                 break :blk try self.parseForLoop();
             },
-            .keyword_var => try self.parseVarDecl(),
+            .keyword_var, .keyword_const => try self.parseVarDecl(),
             .identifier => blk: {
-                if (self.current) |current| {
-                    switch (current.tag) {
+                if (self.lexer.peekTag(1)) |tag| {
+                    switch (tag) {
                         .equals => break :blk try self.parseVarAssign(),
                         else => {},
                     }
@@ -487,10 +706,15 @@ pub const Parser = struct {
                     .unary_op => |unary| {
                         switch (unary.op) {
                             .index => |_| {
-                                if (self.previous != null and self.previous.?.tag == .equals) {
+                                if (self.peekTag() == .equals) {
                                     break :blk try self.parseArraySet(expr);
                                 }
                             },
+                            .field => |_| {
+                                if (self.peekTag() == .equals) {
+                                    break :blk try self.parseFieldSet(expr);
+                                }
+                            },
                             else => {},
                         }
                     },
@@ -506,6 +730,10 @@ pub const Parser = struct {
                 needs_semicolon = false;
                 break :blk try self.parseIf();
             },
+            .keyword_match => blk: {
+                needs_semicolon = false;
+                break :blk try self.parseMatch();
+            },
             .keyword_return => try self.parseReturn(),
             else => blk: {
                 const expr = try self.parseExpression();
@@ -514,10 +742,15 @@ pub const Parser = struct {
                     .unary_op => |unary| {
                         switch (unary.op) {
                             .index => |_| {
-                                if (self.previous != null and self.previous.?.tag == .equals) {
+                                if (self.peekTag() == .equals) {
                                     break :blk try self.parseArraySet(expr);
                                 }
                             },
+                            .field => |_| {
+                                if (self.peekTag() == .equals) {
+                                    break :blk try self.parseFieldSet(expr);
+                                }
+                            },
                             else => {},
                         }
                     },
@@ -553,6 +786,9 @@ pub const Parser = struct {
 
     fn parseForLoop(self: *Parser) Error!*ast.Node {
         const start = try self.expectToken(.keyword_for);
+        if (self.peekTag() == .identifier and self.lexer.peekTag(1) == .keyword_in) {
+            return self.parseForEach(start);
+        }
         const init_stmt = try self.parseStatement();
         const condition = try self.parseStatement();
         const after = try self.parseStatement();
@@ -572,8 +808,41 @@ pub const Parser = struct {
         return node;
     }
 
+    /// Parses `for x in array { }` and `for i in start..end { }`
+    fn parseForEach(self: *Parser, start: lexer.Token) Error!*ast.Node {
+        const identifier = try self.expectToken(.identifier);
+        _ = try self.expectToken(.keyword_in);
+        const iterable = try self.parseExpression();
+        const range_end = if (self.peekTag() == .period_period) blk: {
+            self.nextToken();
+            break :blk try self.parseExpression();
+        } else null;
+        const body = try self.parseBlock();
+        const node = try self.allocator.create(ast.Node);
+        node.* = .{
+            .index = start.start,
+            .data = .{
+                .for_each = .{
+                    .symbol = .{
+                        .name = self.lexer.nameOf(identifier.name),
+                        .name_id = identifier.name,
+                    },
+                    .iterable = iterable,
+                    .range_end = range_end,
+                    .body = body,
+                },
+            },
+        };
+        return node;
+    }
+
     fn parseVarDecl(self: *Parser) Error!*ast.Node {
-        _ = try self.expectToken(.keyword_var);
+        const keyword = try self.expectToken(null);
+        const constant = keyword.tag == .keyword_const;
+
+        if (!constant and self.peekTag() == .l_paren) {
+            return self.parseTupleDecl();
+        }
 
         const identifier = try self.expectToken(.identifier);
 
@@ -602,8 +871,10 @@ pub const Parser = struct {
         statement.* = .{ .index = identifier.start, .data = .{
             .var_decl = .{
                 .symbol = .{
-                    .name = try self.allocator.dupe(u8, self.lexer.source[identifier.start..identifier.end]),
+                    .name = self.lexer.nameOf(identifier.name),
+                    .name_id = identifier.name,
                     .decl_type = maybe_type_decl,
+                    .constant = constant,
                 },
                 .expr = expression,
             },
@@ -612,6 +883,47 @@ pub const Parser = struct {
         return statement;
     }
 
+    /// Parses the rest of a `var (a, b) := expr` declaration
+    fn parseTupleDecl(self: *Parser) Error!*ast.Node {
+        const start = try self.expectToken(.l_paren);
+
+        var symbols = std.ArrayListUnmanaged(ast.SymbolDecl){};
+
+        while (self.peekNot(.r_paren)) {
+            const identifier = try self.expectToken(.identifier);
+            try symbols.append(self.allocator, .{
+                .name = self.lexer.nameOf(identifier.name),
+                .name_id = identifier.name,
+            });
+            if (self.peekNot(.r_paren)) {
+                _ = try self.expectToken(.comma);
+            }
+        }
+
+        _ = try self.expectToken(.r_paren);
+        _ = try self.expectToken(.colon_equals);
+
+        if (symbols.items.len < 2) {
+            try self.err_ctx.errorFromToken(.unexpected_token, "Expected at least two names in tuple declaration", .{}, start);
+            return Error.UnexpectedToken;
+        }
+
+        const expression = try self.parseExpression();
+        const statement = try self.allocator.create(ast.Node);
+
+        statement.* = .{
+            .index = start.start,
+            .data = .{
+                .tuple_decl = .{
+                    .symbols = symbols,
+                    .expr = expression,
+                },
+            },
+        };
+
+        return statement;
+    }
+
     fn parseVarAssign(self: *Parser) Error!*ast.Node {
         const identifier = try self.expectToken(.identifier);
 
@@ -624,7 +936,8 @@ pub const Parser = struct {
             .index = identifier.start,
             .data = .{
                 .var_assign = .{
-                    .name = try self.allocator.dupe(u8, self.lexer.source[identifier.start..identifier.end]),
+                    .name = self.lexer.nameOf(identifier.name),
+                    .name_id = identifier.name,
                     .expr = expression,
                 },
             },
@@ -639,8 +952,8 @@ pub const Parser = struct {
         var body = std.ArrayListUnmanaged(*ast.Node){};
 
         const found_end = blk: {
-            while (self.previous) |token| {
-                if (token.tag == .r_curly) {
+            while (self.peekTag()) |tag| {
+                if (tag == .r_curly) {
                     break :blk true;
                 }
                 const statement = try self.parseStatement();
@@ -674,9 +987,9 @@ pub const Parser = struct {
         const expr = try self.parseExpression();
         const true_body = try self.parseBlock();
         const false_body: ?*ast.Node =
-            if (self.previous != null and self.previous.?.tag == .keyword_else)
+            if (self.peekTag() == .keyword_else)
         blk: {
-            _ = self.nextToken();
+            self.nextToken();
             break :blk try self.parseBlock();
         } else null;
         const node = try self.allocator.create(ast.Node);
@@ -693,10 +1006,65 @@ pub const Parser = struct {
         return node;
     }
 
+    /// Parses `match expr { 1, 2 => { } "a" => { } else => { } }`, case values
+    /// are checked to be literals or int constants during type checking
+    fn parseMatch(self: *Parser) Error!*ast.Node {
+        const start = try self.expectToken(.keyword_match);
+        const expr = try self.parseExpression();
+        _ = try self.expectToken(.l_curly);
+
+        var cases = std.ArrayListUnmanaged(ast.Node.MatchCase){};
+        var else_body: ?*ast.Node = null;
+        while (self.peekNot(.r_curly)) {
+            if (self.peekTag().? == .keyword_else) {
+                const else_token = try self.expectToken(.keyword_else);
+                if (else_body != null) {
+                    try self.err_ctx.errorFromToken(.unexpected_token, "Found more than one else case in match", .{}, else_token);
+                    return Error.UnexpectedToken;
+                }
+                _ = try self.expectToken(.fat_arrow);
+                else_body = try self.parseBlock();
+                continue;
+            }
+            var values = std.ArrayListUnmanaged(*ast.Node){};
+            while (true) {
+                try values.append(self.allocator, try self.parseExpression());
+                if (self.peekTag() != .comma) {
+                    break;
+                }
+                self.nextToken();
+            }
+            _ = try self.expectToken(.fat_arrow);
+            try cases.append(self.allocator, .{
+                .values = values,
+                .body = try self.parseBlock(),
+            });
+        }
+
+        if (self.peekTag() == null) {
+            try self.err_ctx.newError(.unterminated_block, "Expected '}' at the end of match, found end", .{}, start.start);
+            return Error.UnterminatedBlock;
+        }
+        _ = try self.expectToken(.r_curly);
+
+        const node = try self.allocator.create(ast.Node);
+        node.* = .{
+            .index = start.start,
+            .data = .{
+                .match_stmt = .{
+                    .expr = expr,
+                    .cases = cases,
+                    .else_body = else_body,
+                },
+            },
+        };
+        return node;
+    }
+
     fn parseReturn(self: *Parser) Error!*ast.Node {
         const start = try self.expectToken(.keyword_return);
-        if (self.previous) |prev| {
-            const expr: ?*ast.Node = switch (prev.tag) {
+        if (self.peekTag()) |tag| {
+            const expr: ?*ast.Node = switch (tag) {
                 .semicolon => null,
                 else => try self.parseExpression(),
             };
@@ -719,6 +1087,7 @@ pub const Parser = struct {
     pub fn parseArraySet(self: *Parser, array_get: *ast.Node) Error!*ast.Node {
         const array = array_get.data.unary_op.expr;
         const index = array_get.data.unary_op.op.index.index;
+        const column = array_get.data.unary_op.op.index.column;
         _ = try self.expectToken(.equals);
         const expr = try self.parseExpression();
         const node = try self.allocator.create(ast.Node);
@@ -728,6 +1097,27 @@ pub const Parser = struct {
                 .array_set = .{
                     .array = array,
                     .index = index,
+                    .column = column,
+                    .expr = expr,
+                },
+            },
+        };
+        return node;
+    }
+
+    pub fn parseFieldSet(self: *Parser, field_get: *ast.Node) Error!*ast.Node {
+        const record = field_get.data.unary_op.expr;
+        const field = field_get.data.unary_op.op.field;
+        _ = try self.expectToken(.equals);
+        const expr = try self.parseExpression();
+        const node = try self.allocator.create(ast.Node);
+        node.* = .{
+            .index = record.index,
+            .data = .{
+                .field_set = .{
+                    .record = record,
+                    .name = field.name,
+                    .name_id = field.name_id,
                     .expr = expr,
                 },
             },
@@ -735,17 +1125,107 @@ pub const Parser = struct {
         return node;
     }
 
+    /// Parses `struct Name { field: type, ... }` and registers the type so
+    /// that it can be used by everything after it
+    fn parseStructDecl(self: *Parser) Error!void {
+        _ = try self.expectToken(.keyword_struct);
+        const name = try self.expectToken(.identifier);
+        const raw_name = self.lexer.source[name.start..name.end];
+        if (types.builtin_lookup.has(raw_name) or self.structs.contains(name.name)) {
+            try self.err_ctx.errorFromToken(.symbol_shadowing, "Found struct shadowing previous type, \"{s}\"", .{raw_name}, name);
+            return Error.UnexpectedToken;
+        }
+        _ = try self.expectToken(.l_curly);
+
+        var fields = std.ArrayListUnmanaged(types.Struct.Field){};
+
+        while (self.peekNot(.r_curly)) {
+            const field_name = try self.expectToken(.identifier);
+            const raw_field = self.lexer.source[field_name.start..field_name.end];
+            for (fields.items) |field| {
+                if (field.name_id == field_name.name) {
+                    try self.err_ctx.errorFromToken(.symbol_shadowing, "Found duplicate field \"{s}\" in struct", .{raw_field}, field_name);
+                    return Error.UnexpectedToken;
+                }
+            }
+            _ = try self.expectToken(.colon);
+            const field_type = try self.parseType();
+            if (field_type.equal(&.void)) {
+                try self.err_ctx.errorFromToken(.unexpected_token, "Void is a not a permitted field type", .{}, field_name);
+                return Error.UnexpectedToken;
+            }
+            try fields.append(self.allocator, .{
+                .name = raw_field,
+                .name_id = field_name.name,
+                .field_type = field_type,
+            });
+            if (self.peekNot(.r_curly)) {
+                _ = try self.expectToken(.comma);
+            }
+        }
+
+        _ = try self.expectToken(.r_curly);
+
+        if (fields.items.len == 0 or fields.items.len > std.math.maxInt(u8)) {
+            try self.err_ctx.errorFromToken(.unexpected_token, "Expected between 1 and 255 fields in struct \"{s}\"", .{raw_name}, name);
+            return Error.UnexpectedToken;
+        }
+
+        const structure = try self.allocator.create(types.Struct);
+        structure.* = .{
+            .name = raw_name,
+            .fields = fields.items,
+        };
+        try self.structs.put(self.allocator, name.name, structure);
+    }
+
+    /// Parses `Name { field: expr, ... }`, fields are matched up with the
+    /// declaration during type checking
+    fn parseStructInit(self: *Parser, structure: *types.Struct) Error!*ast.Node {
+        const start = try self.expectToken(.identifier);
+        _ = try self.expectToken(.l_curly);
+
+        var fields = std.ArrayListUnmanaged(ast.Node.FieldInit){};
+
+        while (self.peekNot(.r_curly)) {
+            const field_name = try self.expectToken(.identifier);
+            _ = try self.expectToken(.colon);
+            try fields.append(self.allocator, .{
+                .name = self.lexer.nameOf(field_name.name),
+                .name_id = field_name.name,
+                .expr = try self.parseExpression(),
+            });
+            if (self.peekNot(.r_curly)) {
+                _ = try self.expectToken(.comma);
+            }
+        }
+
+        _ = try self.expectToken(.r_curly);
+
+        const node = try self.allocator.create(ast.Node);
+        node.* = .{
+            .index = start.start,
+            .data = .{
+                .struct_init = .{
+                    .structure = structure,
+                    .fields = fields.items,
+                },
+            },
+        };
+        return node;
+    }
+
     /// Errors if the current token doesn't have the passed tag.
     /// If it does, it runs nextToken and returns the token that matched
     /// the tag.
     fn expectToken(self: *Parser, maybe_tag: ?lexer.TokenTag) Error!lexer.Token {
         if (maybe_tag) |tag| {
-            if (self.previous) |prev| {
-                if (prev.tag == tag) {
-                    _ = self.nextToken();
-                    return prev;
+            if (self.peekToken()) |token| {
+                if (token.tag == tag) {
+                    self.nextToken();
+                    return token;
                 } else {
-                    try self.err_ctx.errorFromToken(.unexpected_token, "Expected token of type {s}, found [{s},\"{s}\"]", .{ @tagName(tag), @tagName(prev.tag), self.lexer.source[prev.start..prev.end] }, prev);
+                    try self.err_ctx.errorFromToken(.unexpected_token, "Expected token of type {s}, found [{s},\"{s}\"]", .{ @tagName(tag), @tagName(token.tag), self.lexer.source[token.start..token.end] }, token);
                     return Error.UnexpectedToken;
                 }
             } else {
@@ -753,9 +1233,9 @@ pub const Parser = struct {
                 return Error.UnexpectedEnd;
             }
         } else {
-            if (self.previous) |prev| {
-                _ = self.nextToken();
-                return prev;
+            if (self.peekToken()) |token| {
+                self.nextToken();
+                return token;
             } else {
                 try self.err_ctx.newError(.unexpected_end, "Expected any token, found end", .{}, null);
                 return Error.UnexpectedEnd;
@@ -763,12 +1243,27 @@ pub const Parser = struct {
         }
     }
 
-    /// Puts the current token into previous, loads next token from
-    /// lexer into current and returns the new current token
-    fn nextToken(self: *Parser) ?lexer.Token {
-        self.previous = self.current;
-        self.current = self.lexer.nextToken();
-        return self.previous;
+    /// Token under the cursor, the next one to be consumed
+    fn peekToken(self: *const Parser) ?lexer.Token {
+        return self.lexer.peekToken(0);
+    }
+
+    /// Tag of the token under the cursor, used for every check that doesn't
+    /// need the rest of the token
+    fn peekTag(self: *const Parser) ?lexer.TokenTag {
+        return self.lexer.peekTag(0);
+    }
+
+    /// True if there is a token under the cursor without the passed tag,
+    /// used to loop until a closing token
+    fn peekNot(self: *const Parser, tag: lexer.TokenTag) bool {
+        const next = self.peekTag() orelse return false;
+        return next != tag;
+    }
+
+    /// Moves the cursor past the token under it
+    fn nextToken(self: *Parser) void {
+        self.lexer.position += 1;
     }
 
     fn infixPrecedence(op: ast.Operator) ?Precedence {
@@ -786,6 +1281,7 @@ pub const Parser = struct {
         return switch (op) {
             .call => .{ .lhs = 20, .rhs = 0 },
             .index => .{ .lhs = 20, .rhs = 0 },
+            .field => .{ .lhs = 20, .rhs = 0 },
             else => null,
         };
     }
@@ -1,13 +1,18 @@
 //! Code Generation Pass, converts AST into bytecode and a constant table.
 const std = @import("std");
 const ast = @import("../ast.zig");
+const builtin = @import("../builtin.zig");
 const byte = @import("../../runtime/bytecode.zig");
 const err = @import("../error.zig");
+const hash_table = @import("../../runtime/hash_table.zig");
 const value = @import("../../runtime/value.zig");
 
+const length_id = builtin.lookup.get("length").?.id;
+
 pub const Error = error{
     ConstantOverflow,
     LocalOverflow,
+    JumpOverflow,
 } || std.mem.Allocator.Error;
 
 /// Used in function stack to figure out how many local variables are in each stack frame.
@@ -16,18 +21,40 @@ const FuncFrame = struct {
     func: usize,
     local_count: u8 = 0,
     map: std.AutoHashMapUnmanaged(*anyopaque, u8) = std.AutoHashMapUnmanaged(*anyopaque, u8){},
+    cold_blocks: std.ArrayListUnmanaged(ColdBlock) = std.ArrayListUnmanaged(ColdBlock){},
+    memo_args: ?u8 = null, // argument count of a memo function, results are cached on return
+    ret_count: u8 = 1, // values left on the stack by a return with an expression
+};
+
+/// Unlikely block that is emitted after the function body instead of inline,
+/// so that the likely path falls through its branch.
+const ColdBlock = struct {
+    body: *ast.Node,
+    branch: usize, // operand of the branch that jumps to the block
 };
 
 const ByteFunc = struct {
     code: std.ArrayListUnmanaged(u8) = std.ArrayListUnmanaged(u8){},
 };
 
+/// Function constant whose final index is only known once the output of
+/// every pass is linked together
+const Relocation = struct {
+    constant: u8,
+    func: *ast.Node,
+};
+
 pub const Pass = struct {
     const FrameNode = std.DoublyLinkedList(FuncFrame).Node;
     func_stack: std.DoublyLinkedList(FuncFrame) = std.DoublyLinkedList(FuncFrame){},
     bytecode: std.ArrayListUnmanaged(ByteFunc) = std.ArrayListUnmanaged(ByteFunc){},
     constants: std.ArrayListUnmanaged(value.Value) = std.ArrayListUnmanaged(value.Value){},
     func_count: usize = 0,
+    relocate: bool = false, // output is linked with other passes, function constants are patched then
+    relocations: std.ArrayListUnmanaged(Relocation) = std.ArrayListUnmanaged(Relocation){},
+    function_slots: std.AutoHashMapUnmanaged(*ast.Node, u8) = std.AutoHashMapUnmanaged(*ast.Node, u8){}, // relocated constant of every referenced function
+    generated: std.ArrayListUnmanaged(*ast.Node) = std.ArrayListUnmanaged(*ast.Node){}, // functions numbered by this pass, only kept when relocating
+    units: ?*const ast.NodeSet = null, // functions generated by other passes, see link
     root: *ast.Node,
     err_ctx: *err.ErrorContext,
     allocator: std.mem.Allocator,
@@ -44,11 +71,77 @@ pub const Pass = struct {
         _ = try self.genFunc(self.root, null);
     }
 
+    /// Generates a single function as the first function of this pass, so
+    /// that it can be linked in after the pass that generates the root
+    pub fn runUnit(self: *Pass, func: *ast.Node) Error!void {
+        _ = try self.genFunc(func.data.function_value.body, func);
+    }
+
+    /// Appends the functions and constants of the unit passes after the ones
+    /// of this pass, in the order the units are given. Function indices are
+    /// offset by the functions before them and constant operands are
+    /// rewritten to point into the merged constant table, so the output only
+    /// depends on the order of the units.
+    pub fn link(self: *Pass, unit_passes: []const *Pass) Error!void {
+        var base = self.func_count;
+        for (unit_passes) |unit| {
+            for (unit.generated.items) |func| {
+                func.data.function_value.func_idx += base;
+            }
+            base += unit.func_count;
+        }
+
+        self.resolveRelocations();
+        for (unit_passes) |unit| {
+            unit.resolveRelocations();
+            const remap = try self.allocator.alloc(u8, unit.constants.items.len);
+            for (unit.constants.items, remap) |item, *index| {
+                index.* = try self.constantIndex(item);
+            }
+            for (unit.bytecode.items) |func| {
+                relocateConstants(func.code.items, remap);
+                try self.bytecode.append(self.allocator, func);
+            }
+            self.func_count += unit.func_count;
+        }
+    }
+
+    fn resolveRelocations(self: *Pass) void {
+        for (self.relocations.items) |relocation| {
+            self.constants.items[relocation.constant] = value.Value{ .data = .{ .func = relocation.func.data.function_value.func_idx } };
+        }
+    }
+
+    /// Points the constant operands of the code at their merged indices
+    fn relocateConstants(code: []u8, remap: []const u8) void {
+        var i: usize = 0;
+        while (i < code.len) : (i += 1 + byte.operandLength(code, i)) {
+            switch (@as(byte.Opcode, @enumFromInt(code[i]))) {
+                .CONSTANT, .CONSTANT_REF, .JUMP_TABLE, .JUMP_HASH => code[i + 1] = remap[code[i + 1]],
+                else => {},
+            }
+        }
+    }
+
     /// Wrapper over genNode but with handling local variable allocation
     fn genFunc(self: *Pass, body: *ast.Node, call_func: ?*ast.Node) Error!usize {
-        _ = try self.pushFrame();
+        const new_frame = try self.pushFrame();
+        if (call_func) |func| {
+            const decl = func.data.function_value;
+            switch (decl.ret_type) {
+                .tuple => |tuple| new_frame.ret_count = @intCast(tuple.items.len),
+                else => {},
+            }
+            if (decl.memo) {
+                // Checked before the locals are allocated so hits return early
+                const arg_count: u8 = @intCast(decl.args.items.len);
+                new_frame.memo_args = arg_count;
+                try self.pushOp(.MEMO_GET);
+                try self.pushByte(arg_count);
+            }
+        }
         _ = try self.pushOp(.STACK_ALLOC);
-        const alloc_count = self.bytecode.items[self.func_stack.first.?.data.func].code.items.len;
+        const alloc_count = self.bytecode.items[new_frame.func].code.items.len;
         _ = try self.pushByte(0); // temp
         if (call_func) |func| {
             const decl = func.data.function_value;
@@ -57,13 +150,64 @@ pub const Pass = struct {
             }
         }
         const frame = &self.func_stack.first.?.data;
+        const func_idx = frame.func;
         if (call_func) |func| {
-            func.data.function_value.func_idx = frame.func;
+            func.data.function_value.func_idx = func_idx;
+            if (self.relocate) {
+                try self.generated.append(self.allocator, func);
+            }
         }
         try self.genNode(body);
-        self.bytecode.items[frame.func].code.items[alloc_count] = frame.local_count;
+        try self.genColdBlocks();
+        self.bytecode.items[func_idx].code.items[alloc_count] = frame.local_count;
         self.popFrame();
-        return frame.func;
+        return func_idx;
+    }
+
+    /// Emits the blocks deferred by deferCold after the function body so that
+    /// unlikely paths don't sit in between the hot instructions
+    fn genColdBlocks(self: *Pass) Error!void {
+        const frame = &self.func_stack.first.?.data;
+        if (frame.cold_blocks.items.len == 0) {
+            return;
+        }
+
+        // Falling off the end of the body must not run into the cold blocks
+        try self.pushOp(.RETURN);
+        try self.pushByte(0);
+
+        // Cold blocks can defer more cold blocks while being generated
+        var i: usize = 0;
+        while (i < frame.cold_blocks.items.len) : (i += 1) {
+            const cold = frame.cold_blocks.items[i];
+            try self.patchJump(cold.branch);
+            try self.genNode(cold.body);
+        }
+    }
+
+    /// Defers a block until the end of the current function, the passed branch
+    /// is patched to point at it once it is emitted. Only blocks that end in a
+    /// return can be deferred as nothing jumps back from them.
+    fn deferCold(self: *Pass, body: *ast.Node, branch: usize) Error!void {
+        const frame = &self.func_stack.first.?.data;
+        try frame.cold_blocks.append(self.allocator, ColdBlock{ .body = body, .branch = branch });
+    }
+
+    /// Static branch heuristic, blocks that exit the function early are
+    /// assumed to be unlikely
+    fn isColdBlock(node: *ast.Node) bool {
+        switch (node.data) {
+            .block => |block| {
+                if (block.list.items.len == 0) {
+                    return false;
+                }
+                return switch (block.list.items[block.list.items.len - 1].data) {
+                    .return_stmt => true,
+                    else => false,
+                };
+            },
+            else => return false,
+        }
     }
 
     fn genNode(self: *Pass, node: *ast.Node) Error!void {
@@ -74,18 +218,24 @@ pub const Pass = struct {
             .boolean_constant => |*boolean| {
                 try self.pushConstant(value.Value{ .data = .{ .boolean = boolean.value } });
             },
-            .string_constant => |*str| {
-                const object = try self.allocator.create(value.Object);
-                object.data = .{
-                    .string = .{
-                        .raw = try self.allocator.dupe(u8, str.raw),
+            .container_init => |*container| {
+                switch (container.container_type) {
+                    .map => try self.pushOp(.MAP_INIT),
+                    .set => try self.pushOp(.SET_INIT),
+                    .pqueue => {
+                        if (container.comparator) |comparator| {
+                            try self.genNode(comparator);
+                        }
+                        try self.pushOp(.PQUEUE_INIT);
+                        try self.pushByte(@intFromBool(container.comparator != null));
                     },
-                };
-                try self.pushConstant(value.Value{ .data = .{ .object = object } });
+                    else => unreachable,
+                }
             },
+            .string_constant => |*str| try self.pushConstant(try self.stringConstant(str.raw)),
             .var_get => |_| {
                 if (node.symbol_decl.?.function_decl) |func| {
-                    try self.pushConstant(value.Value{ .data = .{ .func = func.data.function_value.func_idx } });
+                    try self.pushFunction(func);
                     return;
                 }
                 const decl = node.symbol_decl.?;
@@ -129,39 +279,94 @@ pub const Pass = struct {
                         try self.genNode(unary.expr);
                         try self.pushOp(.CALL);
                         try self.pushByte(@truncate(call.args.items.len));
+                        if (call.discarded > 0) {
+                            try self.pushOp(.POP);
+                            try self.pushByte(call.discarded);
+                        }
                     },
                     .index => |index| {
+                        if (frameArray(unary.expr)) |decl| {
+                            const base = try self.getLocal(decl);
+                            switch (index.index.data) {
+                                // Constant indices were bounds checked by the
+                                // type checker
+                                .int_constant => |constant| {
+                                    try self.pushOp(.VAR_GET);
+                                    try self.pushByte(base + @as(u8, @intCast(constant.value)));
+                                },
+                                else => {
+                                    try self.genNode(index.index);
+                                    try self.pushOp(.LOCAL_ARRAY_GET);
+                                    try self.pushByte(base);
+                                    try self.pushByte(@intCast(decl.decl_type.?.fixed_array.len));
+                                },
+                            }
+                            return;
+                        }
+                        if (index.column) |column| {
+                            try self.genNode(column);
+                            try self.genNode(index.index);
+                            try self.genNode(unary.expr);
+                            try self.pushOp(.MATRIX_GET);
+                            return;
+                        }
                         try self.genNode(index.index);
                         try self.genNode(unary.expr);
-                        try self.pushOp(.ARRAY_GET);
+                        try self.pushOp(if (index.bytes) .BYTES_GET else .ARRAY_GET);
+                    },
+                    .field => |field| {
+                        try self.genNode(unary.expr);
+                        try self.pushOp(.FIELD_GET);
+                        try self.pushByte(field.index);
                     },
                     else => unreachable,
                 }
             },
             .function_value => |*func| {
-                const func_code = try self.genFunc(func.body, node);
-                try self.pushConstant(value.Value{
-                    .data = .{
-                        .func = func_code,
-                    },
-                });
+                // Only declared by name, so nothing reads the value
+                if (func.type_params.len > 0) {
+                    for (func.instances.items) |instance| {
+                        _ = try self.genFunc(instance.node.data.function_value.body, instance.node);
+                    }
+                    return;
+                }
+                const generated_elsewhere = if (self.units) |units| units.contains(node) else false;
+                if (!generated_elsewhere) {
+                    _ = try self.genFunc(func.body, node);
+                }
+                try self.pushFunction(node);
             },
             .builtin_call => |*call| {
+                if (call.idx == length_id) {
+                    if (frameArray(call.args[0])) |decl| {
+                        try self.pushConstant(value.Value{ .data = .{ .integer = @intCast(decl.decl_type.?.fixed_array.len) } });
+                        return;
+                    }
+                }
                 for (call.args) |arg| {
                     try self.genNode(arg);
                 }
+                const data = builtin.fromId(call.idx);
+                if (data.opcode) |op| {
+                    try self.pushOp(op);
+                    if (data.move_arg) {
+                        try self.pushByte(@intFromBool(isFresh(call.args[0])));
+                    }
+                    return;
+                }
                 try self.pushOp(.CALL_BUILTIN);
                 try self.pushByte(call.idx);
             },
             .array_init => |*array| {
-                // in reverse so they're popped off in order
-                var i: usize = array.items.items.len;
-                while (i > 0) {
-                    i -= 1;
-                    try self.genNode(array.items.items[i]);
+                if (try self.constantArray(array.items.items)) |constant| {
+                    try self.pushConstant(constant);
+                    return;
+                }
+                for (array.items.items) |item| {
+                    try self.genNode(item);
                 }
                 try self.pushOp(.ARRAY_INIT);
-                try self.pushByte(@truncate(array.items.items.len));
+                try self.pushWord(@intCast(array.items.items.len));
             },
             .block => |*block| {
                 for (block.list.items) |statement| {
@@ -169,88 +374,203 @@ pub const Pass = struct {
                 }
             },
             .var_decl => |*var_decl| {
+                if (var_decl.symbol.frame_array) {
+                    const base = try self.pushLocalArray(&var_decl.symbol, var_decl.symbol.decl_type.?.fixed_array.len);
+                    try self.genFrameItems(base, var_decl.expr);
+                    return;
+                }
+                // Every read of a scalar constant was replaced with its value
+                if (var_decl.symbol.constant_value != null) {
+                    return;
+                }
                 const index = try self.pushLocal(&var_decl.symbol);
-                try self.genNode(var_decl.expr);
+                if (try self.sharedConstant(&var_decl.symbol, var_decl.expr)) |constant| {
+                    try self.pushOp(.CONSTANT_REF);
+                    try self.pushByte(try self.constantIndex(constant));
+                } else {
+                    try self.genNode(var_decl.expr);
+                }
                 try self.pushOp(.VAR_SET);
                 try self.pushByte(index);
             },
+            .struct_init => |*struct_init| {
+                for (struct_init.fields) |field| {
+                    try self.genNode(field.expr);
+                }
+                try self.pushOp(.STRUCT_INIT);
+                try self.pushByte(@intCast(struct_init.fields.len));
+            },
+            .tuple_init => |*tuple| {
+                for (tuple.items.items) |item| {
+                    try self.genNode(item);
+                }
+            },
+            .tuple_decl => |*tuple_decl| {
+                for (tuple_decl.symbols.items) |*symbol| {
+                    _ = try self.pushLocal(symbol);
+                }
+                try self.genNode(tuple_decl.expr);
+                // The last item is on top of the stack
+                var i = tuple_decl.symbols.items.len;
+                while (i > 0) {
+                    i -= 1;
+                    try self.pushOp(.VAR_SET);
+                    try self.pushByte(try self.getLocal(&tuple_decl.symbols.items[i]));
+                }
+            },
             .var_assign => |*var_assign| {
                 const decl = node.symbol_decl.?;
                 const index = try self.getLocal(decl);
+                if (decl.frame_array) {
+                    try self.genFrameItems(index, var_assign.expr);
+                    return;
+                }
                 try self.genNode(var_assign.expr);
                 try self.pushOp(.VAR_SET);
                 try self.pushByte(index);
             },
             .while_loop => |*while_loop| {
-                const frame = &self.func_stack.first.?.data;
-                const func = &self.bytecode.items[frame.func].code;
-                const before_condition = func.items.len;
-                try self.genNode(while_loop.expr);
-                try self.pushOp(.BRANCH_NEQ);
-                const branch_byte = func.items.len;
-                try self.pushByte(0); // placeholder
+                // Loops are rotated so the condition sits at the bottom, each
+                // iteration then only executes a single backwards branch
+                const entry = try self.pushJump(.JUMP);
+                const body_start = self.currentCode().items.len;
                 try self.genNode(while_loop.body);
-                const after_body = func.items.len;
-                const jump_distance: u8 = @as(u8, @truncate(after_body - before_condition)) + 2;
-                const branch_distance: u8 = @as(u8, @truncate(after_body - branch_byte)) + 1;
-                func.items[branch_byte] = branch_distance;
-                try self.pushOp(.JUMP_BACK);
-                try self.pushByte(jump_distance);
+                try self.patchJump(entry);
+                try self.genNode(while_loop.expr);
+                try self.pushLoop(.BRANCH_EQ_BACK, body_start);
             },
             .for_loop => |*for_loop| {
-                const frame = &self.func_stack.first.?.data;
-                const func = &self.bytecode.items[frame.func].code;
                 try self.genNode(for_loop.init);
-                const before_condition = func.items.len;
-                try self.genNode(for_loop.condition);
-                try self.pushOp(.BRANCH_NEQ);
-                const branch_byte = func.items.len;
-                try self.pushByte(0); // placeholder
+                const entry = try self.pushJump(.JUMP);
+                const body_start = self.currentCode().items.len;
                 try self.genNode(for_loop.body);
                 try self.genNode(for_loop.after);
-                const after_body = func.items.len;
-                const jump_distance: u8 = @as(u8, @truncate(after_body - before_condition)) + 2;
-                const branch_distance: u8 = @as(u8, @truncate(after_body - branch_byte)) + 1;
-                func.items[branch_byte] = branch_distance;
-                try self.pushOp(.JUMP_BACK);
-                try self.pushByte(jump_distance);
+                try self.patchJump(entry);
+                try self.genNode(for_loop.condition);
+                try self.pushLoop(.BRANCH_EQ_BACK, body_start);
+            },
+            .for_each => |*for_each| {
+                // Two hidden slots hold the array and next index, or the next
+                // value and end of the range. The test at the bottom is the
+                // only bounds check, the item is read without another one.
+                const state = try self.pushLocalSlots(@ptrCast(node), 2);
+                const item = try self.pushLocal(&for_each.symbol);
+                try self.genNode(for_each.iterable);
+                try self.pushOp(.VAR_SET);
+                try self.pushByte(state);
+                if (for_each.range_end) |range_end| {
+                    try self.genNode(range_end);
+                } else {
+                    try self.pushConstant(value.Value{ .data = .{ .integer = 0 } });
+                }
+                try self.pushOp(.VAR_SET);
+                try self.pushByte(state + 1);
+                const entry = try self.pushJump(.JUMP);
+                const body_start = self.currentCode().items.len;
+                try self.genNode(for_each.body);
+                try self.patchJump(entry);
+                try self.pushOp(if (for_each.range_end == null) .ITER_NEXT else .RANGE_NEXT);
+                try self.pushByte(state);
+                try self.pushByte(item);
+                try self.pushBackOffset(body_start);
             },
             .array_set => |*array_set| {
+                if (frameArray(array_set.array)) |decl| {
+                    const base = try self.getLocal(decl);
+                    try self.genNode(array_set.expr);
+                    switch (array_set.index.data) {
+                        .int_constant => |constant| {
+                            try self.pushOp(.VAR_SET);
+                            try self.pushByte(base + @as(u8, @intCast(constant.value)));
+                        },
+                        else => {
+                            try self.genNode(array_set.index);
+                            try self.pushOp(.LOCAL_ARRAY_SET);
+                            try self.pushByte(base);
+                            try self.pushByte(@intCast(decl.decl_type.?.fixed_array.len));
+                        },
+                    }
+                    return;
+                }
                 try self.genNode(array_set.expr);
+                if (array_set.column) |column| {
+                    try self.genNode(column);
+                    try self.genNode(array_set.index);
+                    try self.genNode(array_set.array);
+                    try self.pushOp(.MATRIX_SET);
+                    return;
+                }
                 try self.genNode(array_set.index);
                 try self.genNode(array_set.array);
-                try self.pushOp(.ARRAY_SET);
+                try self.pushOp(if (array_set.bytes) .BYTES_SET else .ARRAY_SET);
+            },
+            .field_set => |*field_set| {
+                try self.genNode(field_set.expr);
+                try self.genNode(field_set.record);
+                try self.pushOp(.FIELD_SET);
+                try self.pushByte(field_set.index);
             },
+            .match_stmt => |*match_stmt| try self.genMatch(match_stmt),
             .if_stmt => |*if_stmt| {
                 try self.genNode(if_stmt.expr);
-                try self.pushOp(.BRANCH_NEQ);
 
-                const func = self.func_stack.first.?.data.func;
-                const start = self.bytecode.items[func].code.items.len;
-                try self.pushByte(0); // temp
+                // Lay out the likely path so that it falls through the branch
+                const true_cold = isColdBlock(if_stmt.true_body);
+                const false_cold = if (if_stmt.false_body) |false_body| isColdBlock(false_body) else false;
+                if (true_cold and !false_cold) {
+                    const branch = try self.pushJump(.BRANCH_EQ);
+                    try self.deferCold(if_stmt.true_body, branch);
+                    if (if_stmt.false_body) |false_body| {
+                        try self.genNode(false_body);
+                    }
+                    return;
+                }
+                if (false_cold and !true_cold) {
+                    const branch = try self.pushJump(.BRANCH_NEQ);
+                    try self.deferCold(if_stmt.false_body.?, branch);
+                    try self.genNode(if_stmt.true_body);
+                    return;
+                }
 
+                const branch = try self.pushJump(.BRANCH_NEQ);
                 try self.genNode(if_stmt.true_body);
-
-                const offset = self.bytecode.items[func].code.items.len - start - 1;
-                self.bytecode.items[func].code.items[start] = @truncate(offset);
-
                 if (if_stmt.false_body) |false_body| {
-                    self.bytecode.items[func].code.items[start] += 2;
-                    try self.pushOp(.JUMP);
-                    const false_start = self.bytecode.items[func].code.items.len;
-                    try self.pushByte(0); // temp
+                    const skip = try self.pushJump(.JUMP);
+                    try self.patchJump(branch);
                     try self.genNode(false_body);
-                    const false_offset = self.bytecode.items[func].code.items.len - false_start - 1;
-                    self.bytecode.items[func].code.items[false_start] = @truncate(false_offset);
+                    try self.patchJump(skip);
+                } else {
+                    try self.patchJump(branch);
                 }
             },
             .return_stmt => |*ret| {
-                const is_value: u8 = if (ret.expr) |expr| blk: {
+                const frame = &self.func_stack.first.?.data;
+                const count: u8 = if (ret.expr) |expr| blk: {
                     try self.genNode(expr);
-                    break :blk 1;
+                    if (frame.memo_args) |arg_count| {
+                        try self.pushOp(.MEMO_PUT);
+                        try self.pushByte(arg_count);
+                    }
+                    break :blk frame.ret_count;
                 } else 0;
                 try self.pushOp(.RETURN);
-                try self.pushByte(is_value);
+                try self.pushByte(count);
+            },
+            .loop_kernel => |*kernel| {
+                for (kernel.operands) |operand| {
+                    try self.genNode(operand);
+                }
+                try self.pushOp(.ARRAY_KERNEL);
+                try self.pushByte(@intFromEnum(kernel.kind));
+                switch (kernel.kind) {
+                    .map, .map_scalar_lhs, .map_scalar_rhs => try self.pushByte(@intFromEnum(kernel.op)),
+                    else => {},
+                }
+                if (kernel.result) |result| {
+                    const index = try self.getLocal(result);
+                    try self.pushOp(.VAR_SET);
+                    try self.pushByte(index);
+                }
             },
         }
     }
@@ -261,6 +581,68 @@ pub const Pass = struct {
         try self.bytecode.items[func].code.append(self.allocator, item);
     }
 
+    /// Pushes a little-endian u16 into the bytecode
+    fn pushShort(self: *Pass, item: u16) Error!void {
+        try self.pushByte(@truncate(item));
+        try self.pushByte(@truncate(item >> 8));
+    }
+
+    /// Pushes a little-endian u32 into the bytecode
+    fn pushWord(self: *Pass, item: u32) Error!void {
+        try self.pushShort(@truncate(item));
+        try self.pushShort(@truncate(item >> 16));
+    }
+
+    /// Pushes a forward jump with a placeholder offset and returns the position
+    /// of the offset so that it can be filled in with patchJump
+    fn pushJump(self: *Pass, op: byte.Opcode) Error!usize {
+        try self.pushOp(op);
+        const operand = self.currentCode().items.len;
+        try self.pushShort(0); // placeholder
+        return operand;
+    }
+
+    /// Points a jump pushed with pushJump at the current end of the bytecode
+    fn patchJump(self: *Pass, operand: usize) Error!void {
+        const distance = self.currentCode().items.len - (operand + 2);
+        try self.patchOffset(operand, distance);
+    }
+
+    /// Writes a forward jump distance into a placeholder operand
+    fn patchOffset(self: *Pass, operand: usize, distance: usize) Error!void {
+        if (distance > 0xFFFF) {
+            try self.err_ctx.newError(.jump_overflow, "Jump distance exceeds 0xFFFF", .{}, null);
+            return Error.JumpOverflow;
+        }
+        const code = self.currentCode();
+        code.items[operand] = @truncate(distance);
+        code.items[operand + 1] = @truncate(distance >> 8);
+    }
+
+    /// Pushes a backwards jump to the passed position in the bytecode
+    fn pushLoop(self: *Pass, op: byte.Opcode, target: usize) Error!void {
+        try self.pushOp(op);
+        try self.pushBackOffset(target);
+    }
+
+    /// Pushes the offset of a backwards jump to the passed position, the
+    /// offset has to be the last operand of the instruction
+    fn pushBackOffset(self: *Pass, target: usize) Error!void {
+        const distance = self.currentCode().items.len + 2 - target;
+        if (distance > 0xFFFF) {
+            try self.err_ctx.newError(.jump_overflow, "Jump distance exceeds 0xFFFF", .{}, null);
+            return Error.JumpOverflow;
+        }
+        try self.pushShort(@truncate(distance));
+    }
+
+    /// Bytecode of the function currently being generated. Don't hold on to
+    /// this across genNode, nested functions can reallocate the list.
+    fn currentCode(self: *Pass) *std.ArrayListUnmanaged(u8) {
+        const func = self.func_stack.first.?.data.func;
+        return &self.bytecode.items[func].code;
+    }
+
     /// Pushes an opcode into the bytecode as a byte
     fn pushOp(self: *Pass, op: byte.Opcode) Error!void {
         const func = self.func_stack.first.?.data.func;
@@ -269,19 +651,116 @@ pub const Pass = struct {
 
     /// Pushes a constant onto the constant table
     fn pushConstant(self: *Pass, item: value.Value) Error!void {
+        const index = try self.constantIndex(item);
+        try self.pushOp(.CONSTANT);
+        try self.pushByte(index);
+    }
+
+    /// Index of the item in the constant table, adding it if needed
+    fn constantIndex(self: *Pass, item: value.Value) Error!u8 {
+        // Scalars are shared, unrolled loops would exhaust the table otherwise
+        if (self.findConstant(item)) |index| {
+            return @truncate(index);
+        }
+        return self.appendConstant(item);
+    }
+
+    fn appendConstant(self: *Pass, item: value.Value) Error!u8 {
         if (self.constants.items.len >= 0xFF) {
             try self.err_ctx.newError(.constant_overflow, "Number of constants exceeds 0xFF", .{}, null);
             return Error.ConstantOverflow;
         }
-        const index = self.constants.items.len;
         try self.constants.append(self.allocator, item);
+        return @truncate(self.constants.items.len - 1);
+    }
+
+    /// Pushes a function value. When relocating the index isn't final yet, so
+    /// every function gets one constant slot that link patches and that all
+    /// references to it share.
+    fn pushFunction(self: *Pass, func: *ast.Node) Error!void {
+        if (!self.relocate) {
+            return self.pushConstant(value.Value{ .data = .{ .func = func.data.function_value.func_idx } });
+        }
+        const slot = try self.function_slots.getOrPut(self.allocator, func);
+        if (!slot.found_existing) {
+            slot.value_ptr.* = try self.appendConstant(value.Value{ .data = .{ .func = 0 } });
+            try self.relocations.append(self.allocator, .{ .constant = slot.value_ptr.*, .func = func });
+        }
         try self.pushOp(.CONSTANT);
-        try self.pushByte(@truncate(index));
+        try self.pushByte(slot.value_ptr.*);
+    }
+
+    /// Folds array literals made up of only scalar constants into a single
+    /// constant, which the VM materializes with one allocation and copy
+    fn constantArray(self: *Pass, items: []*ast.Node) Error!?value.Value {
+        if (items.len == 0) {
+            return null;
+        }
+        for (items) |item| {
+            switch (item.data) {
+                .int_constant, .boolean_constant => {},
+                else => return null,
+            }
+        }
+
+        var array = try std.ArrayListUnmanaged(value.Value).initCapacity(self.allocator, items.len);
+        for (items) |item| {
+            array.appendAssumeCapacity(switch (item.data) {
+                .int_constant => |int| value.Value{ .data = .{ .integer = int.value } },
+                .boolean_constant => |boolean| value.Value{ .data = .{ .boolean = boolean.value } },
+                else => unreachable,
+            });
+        }
+
+        const object = try self.allocator.create(value.Object);
+        object.* = .{ .data = .{ .array = .{ .items = array } } };
+        return value.Value{ .data = .{ .object = object } };
+    }
+
+    fn stringConstant(self: *Pass, raw: []const u8) Error!value.Value {
+        const object = try self.allocator.create(value.Object);
+        object.data = .{
+            .string = .{
+                .raw = try self.allocator.dupe(u8, raw),
+            },
+        };
+        return value.Value{ .data = .{ .object = object } };
+    }
+
+    /// Literal bound to a const that nothing can change, so every evaluation
+    /// of the declaration can push the same object instead of a copy
+    fn sharedConstant(self: *Pass, decl: *ast.SymbolDecl, expr: *ast.Node) Error!?value.Value {
+        if (!decl.constant) {
+            return null;
+        }
+        return switch (expr.data) {
+            .string_constant => |*str| try self.stringConstant(str.raw),
+            .array_init => |*array| try self.constantArray(array.items.items),
+            else => null,
+        };
+    }
+
+    /// Looks for an identical scalar constant in the constant table
+    fn findConstant(self: *Pass, item: value.Value) ?usize {
+        switch (item.data) {
+            .object => return null,
+            else => {},
+        }
+        for (self.constants.items, 0..) |constant, i| {
+            if (std.meta.eql(constant.data, item.data)) {
+                return i;
+            }
+        }
+        return null;
     }
 
     /// Pushes a local variable onto the current function frame
     fn pushLocal(self: *Pass, decl: *ast.SymbolDecl) Error!u8 {
         const head = self.func_stack.first.?;
+        // Unrolled loops generate the same declaration more than once
+        if (head.data.map.get(@ptrCast(decl))) |existing| {
+            return existing;
+        }
         const index = head.data.local_count;
         try head.data.map.put(self.allocator, @ptrCast(decl), index);
         if (head.data.local_count +% 1 < head.data.local_count) {
@@ -292,6 +771,161 @@ pub const Pass = struct {
         return index;
     }
 
+    /// Reserves consecutive local slots for a fixed array kept in the frame and
+    /// returns the slot of the first item
+    fn pushLocalArray(self: *Pass, decl: *ast.SymbolDecl, len: usize) Error!u8 {
+        return self.pushLocalSlots(@ptrCast(decl), len);
+    }
+
+    /// Reserves consecutive local slots keyed by the passed pointer, used for
+    /// frame arrays and for hidden loop state that has no declaration
+    fn pushLocalSlots(self: *Pass, key: *anyopaque, len: usize) Error!u8 {
+        const head = self.func_stack.first.?;
+        if (head.data.map.get(key)) |existing| {
+            return existing;
+        }
+        const index = head.data.local_count;
+        if (@as(usize, index) + len > 0xFF) {
+            try self.err_ctx.newError(.local_overflow, "Number of locals exceeds 0xFF", .{}, null);
+            return Error.LocalOverflow;
+        }
+        try head.data.map.put(self.allocator, key, index);
+        head.data.local_count += @intCast(len);
+        return index;
+    }
+
+    /// Match statements jump straight to the matching case, through a table
+    /// indexed by the value when the int cases are dense and through a
+    /// constant hash table otherwise, so dispatch doesn't get slower with
+    /// more cases
+    fn genMatch(self: *Pass, match_stmt: *ast.Node.MatchStatement) Error!void {
+        try self.genNode(match_stmt.expr);
+
+        const cases = match_stmt.cases.items;
+        var low: i64 = std.math.maxInt(i64);
+        var high: i64 = std.math.minInt(i64);
+        var value_count: usize = 0;
+        var all_ints = true;
+        for (cases) |*case| {
+            for (case.values.items) |case_value| {
+                switch (case_value.data) {
+                    .int_constant => |constant| {
+                        low = @min(low, constant.value);
+                        high = @max(high, constant.value);
+                    },
+                    else => all_ints = false,
+                }
+                value_count += 1;
+            }
+        }
+        // Tables are allowed to be half empty before hashing is preferred
+        const dense = all_ints and value_count > 0 and
+            @as(u64, @bitCast(high -% low)) < @min(value_count * 2, 0xFFFF);
+
+        // Operands of the dispatch instruction are filled in once the case
+        // bodies have been generated
+        var table: usize = undefined;
+        var filled: []bool = &.{}; // table entries that belong to a case
+        defer self.allocator.free(filled);
+        var jump_map: *value.Object = undefined;
+        if (dense) {
+            filled = try self.allocator.alloc(bool, @intCast(high - low + 1));
+            @memset(filled, false);
+            try self.pushOp(.JUMP_TABLE);
+            try self.pushByte(try self.constantIndex(value.Value{ .data = .{ .integer = low } }));
+            try self.pushShort(@intCast(filled.len));
+            table = self.currentCode().items.len;
+        } else {
+            jump_map = try self.allocator.create(value.Object);
+            jump_map.* = .{ .data = .{ .map = hash_table.HashTable{ .has_values = true } } };
+            try self.pushOp(.JUMP_HASH);
+            try self.pushByte(try self.constantIndex(value.Value{ .data = .{ .object = jump_map } }));
+            table = self.currentCode().items.len;
+        }
+        // Case offsets followed by the default offset for tables, only the
+        // default offset for hashing
+        for (0..filled.len + 1) |_| {
+            try self.pushShort(0); // placeholder
+        }
+        const default_operand = table + filled.len * 2;
+        const dispatch_end = self.currentCode().items.len;
+
+        var exits = std.ArrayListUnmanaged(usize){};
+        defer exits.deinit(self.allocator);
+        for (cases, 0..) |*case, i| {
+            const target = self.currentCode().items.len - dispatch_end;
+            for (case.values.items) |case_value| {
+                if (dense) {
+                    const slot: usize = @intCast(case_value.data.int_constant.value - low);
+                    filled[slot] = true;
+                    try self.patchOffset(table + slot * 2, target);
+                    continue;
+                }
+                const key = switch (case_value.data) {
+                    .int_constant => |constant| value.Value{ .data = .{ .integer = constant.value } },
+                    .string_constant => |constant| try self.stringConstant(constant.raw),
+                    else => unreachable,
+                };
+                jump_map.data.map.put(self.allocator, key, value.Value{ .data = .{ .integer = @intCast(target) } });
+            }
+            try self.genNode(case.body);
+            if (i + 1 < cases.len or match_stmt.else_body != null) {
+                try exits.append(self.allocator, try self.pushJump(.JUMP));
+            }
+        }
+
+        const default_target = self.currentCode().items.len - dispatch_end;
+        try self.patchOffset(default_operand, default_target);
+        // Values in the range of the table without a case take the default
+        for (filled, 0..) |is_case, slot| {
+            if (!is_case) {
+                try self.patchOffset(table + slot * 2, default_target);
+            }
+        }
+        if (match_stmt.else_body) |else_body| {
+            try self.genNode(else_body);
+        }
+        for (exits.items) |exit| {
+            try self.patchJump(exit);
+        }
+    }
+
+    /// Writes the items of an array literal into the slots of a frame array.
+    /// Every item is evaluated before any slot is written, items may read the
+    /// array they are assigned to.
+    fn genFrameItems(self: *Pass, base: u8, literal: *ast.Node) Error!void {
+        const items = literal.data.array_init.items.items;
+        for (items) |item| {
+            try self.genNode(item);
+        }
+        var i = items.len;
+        while (i > 0) {
+            i -= 1;
+            try self.pushOp(.VAR_SET);
+            try self.pushByte(base + @as(u8, @intCast(i)));
+        }
+    }
+
+    /// Expressions that always evaluate to a new object that nothing else
+    /// references, constants are copied every time they are pushed
+    fn isFresh(node: *ast.Node) bool {
+        return switch (node.data) {
+            .string_constant => true,
+            .builtin_call => |*call| builtin.fromId(call.idx).fresh,
+            else => false,
+        };
+    }
+
+    /// Declaration of the variable if it is a fixed array kept in the frame
+    fn frameArray(node: *ast.Node) ?*ast.SymbolDecl {
+        switch (node.data) {
+            .var_get => {},
+            else => return null,
+        }
+        const decl = node.symbol_decl.?;
+        return if (decl.frame_array) decl else null;
+    }
+
     /// Checks the current function frame for a local variable based on its
     /// declaration
     fn getLocal(self: *Pass, decl: *ast.SymbolDecl) Error!u8 {
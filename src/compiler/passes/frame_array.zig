@@ -0,0 +1,137 @@
+//! Frame array pass, assumes types have been checked. Small fixed arrays that
+//! are declared with a literal and only ever indexed can't escape their
+//! function, so they are kept in consecutive local slots of the frame instead
+//! of in a heap object.
+
+const std = @import("std");
+const ast = @import("../ast.zig");
+const builtin = @import("../builtin.zig");
+const err = @import("../error.zig");
+
+pub const Error = std.mem.Allocator.Error;
+
+/// Longest fixed array that is kept in the frame
+const max_frame_len: usize = 16;
+
+const length_id = builtin.lookup.get("length").?.id;
+
+const DeclSet = std.AutoHashMapUnmanaged(*ast.SymbolDecl, void);
+
+pub const Pass = struct {
+    root: *ast.Node,
+    candidates: DeclSet = DeclSet{},
+    escaped: DeclSet = DeclSet{},
+    failure: ?Error = null,
+    err_ctx: *err.ErrorContext,
+    allocator: std.mem.Allocator,
+
+    pub fn init(allocator: std.mem.Allocator, err_ctx: *err.ErrorContext, root: *ast.Node) Pass {
+        return Pass{
+            .root = root,
+            .err_ctx = err_ctx,
+            .allocator = allocator,
+        };
+    }
+
+    pub fn run(self: *Pass) Error!void {
+        try self.findNode(self.root);
+        var iter = self.candidates.keyIterator();
+        while (iter.next()) |decl| {
+            if (!self.escaped.contains(decl.*)) {
+                decl.*.frame_array = true;
+            }
+        }
+    }
+
+    /// Collects candidate declarations and every variable that is used as a
+    /// whole array, those have to be heap objects
+    fn findNode(self: *Pass, node: *ast.Node) Error!void {
+        switch (node.data) {
+            .var_decl => |*var_decl| {
+                if (isCandidate(&var_decl.symbol, var_decl.expr)) {
+                    try self.candidates.put(self.allocator, &var_decl.symbol, {});
+                    try self.findItems(var_decl.expr);
+                    return;
+                }
+            },
+            .var_assign => {
+                // Literals are written item by item, anything else replaces
+                // the whole array
+                if (node.data.var_assign.expr.data == .array_init) {
+                    try self.findItems(node.data.var_assign.expr);
+                    return;
+                }
+                try self.markEscaped(node.symbol_decl.?);
+            },
+            .var_get => {
+                try self.markEscaped(node.symbol_decl.?);
+                return;
+            },
+            .unary_op => |*unary| {
+                switch (unary.op) {
+                    .index => |index| {
+                        if (isVariable(unary.expr)) {
+                            try self.findNode(index.index);
+                            if (index.column) |column| {
+                                try self.findNode(column);
+                            }
+                            return;
+                        }
+                    },
+                    else => {},
+                }
+            },
+            .array_set => |*array_set| {
+                if (isVariable(array_set.array)) {
+                    try self.findNode(array_set.index);
+                    if (array_set.column) |column| {
+                        try self.findNode(column);
+                    }
+                    try self.findNode(array_set.expr);
+                    return;
+                }
+            },
+            .builtin_call => |*call| {
+                if (call.idx == length_id and isVariable(call.args[0])) {
+                    return;
+                }
+            },
+            else => {},
+        }
+        if (!node.visitChildren(self, visitNode)) {
+            return self.failure.?;
+        }
+    }
+
+    fn visitNode(self: *Pass, node: *ast.Node) bool {
+        self.findNode(node) catch |find_err| {
+            self.failure = find_err;
+            return false;
+        };
+        return true;
+    }
+
+    fn markEscaped(self: *Pass, decl: *ast.SymbolDecl) Error!void {
+        if (decl.decl_type != null and decl.decl_type.? == .fixed_array) {
+            try self.escaped.put(self.allocator, decl, {});
+        }
+    }
+
+    fn findItems(self: *Pass, literal: *ast.Node) Error!void {
+        for (literal.data.array_init.items.items) |item| {
+            try self.findNode(item);
+        }
+    }
+
+    fn isCandidate(decl: *ast.SymbolDecl, expr: *ast.Node) bool {
+        const fixed = switch (decl.decl_type.?) {
+            .fixed_array => |fixed| fixed,
+            else => return false,
+        };
+        return fixed.len <= max_frame_len and expr.data == .array_init;
+    }
+
+    fn isVariable(node: *ast.Node) bool {
+        return node.data == .var_get and node.symbol_decl.?.function_decl == null;
+    }
+};
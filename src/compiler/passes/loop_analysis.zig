@@ -0,0 +1,235 @@
+//! Loop analysis helpers shared by the loop transformation passes, recognizes
+//! counting loops and builds the nodes that the transformations splice in.
+//! Assumes symbols have been populated and types have been checked.
+
+const std = @import("std");
+const ast = @import("../ast.zig");
+
+/// A for loop with a single integer induction variable that moves by a
+/// constant step towards a loop invariant bound
+pub const CountingLoop = struct {
+    induction: *ast.SymbolDecl,
+    start: *ast.Node,
+    bound: *ast.Node,
+    compare: ast.Operator,
+    step: i64,
+
+    /// Amount of iterations for a constant start and bound, null if it
+    /// exceeds limit
+    pub fn tripCount(self: CountingLoop, start: i64, bound: i64, limit: usize) ?usize {
+        var count: usize = 0;
+        var i = start;
+        while (compareInts(self.compare, i, bound)) {
+            count += 1;
+            if (count > limit) {
+                return null;
+            }
+            i = std.math.add(i64, i, self.step) catch return null;
+        }
+        return count;
+    }
+};
+
+/// Recognizes `for var i := start; i < bound; i = i + step; {}` style loops,
+/// returns null if the loop isn't a simple counting loop
+pub fn countingLoop(node: *ast.Node) ?CountingLoop {
+    const for_loop = &node.data.for_loop;
+
+    const induction = switch (for_loop.init.data) {
+        .var_decl => |*var_decl| &var_decl.symbol,
+        else => return null,
+    };
+    if (induction.decl_type == null or induction.decl_type.? != .int) {
+        return null;
+    }
+
+    const condition = switch (for_loop.condition.data) {
+        .binary_op => |*binary| binary,
+        else => return null,
+    };
+    const ascending = switch (condition.op) {
+        .less_than, .less_than_equals => true,
+        .greater_than, .greater_than_equals => false,
+        else => return null,
+    };
+    if (!isVariable(condition.lhs, induction)) {
+        return null;
+    }
+
+    const step = stepOf(for_loop.after, induction) orelse return null;
+    if (ascending != (step > 0)) {
+        return null;
+    }
+
+    if (assigns(for_loop.body, induction)) {
+        return null;
+    }
+    if (!isInvariant(condition.rhs, for_loop.body) or !isInvariant(condition.rhs, for_loop.after)) {
+        return null;
+    }
+
+    return CountingLoop{
+        .induction = induction,
+        .start = for_loop.init.data.var_decl.expr,
+        .bound = condition.rhs,
+        .compare = condition.op,
+        .step = step,
+    };
+}
+
+/// Checks if the expression yields the same value every time it is evaluated
+/// within the passed body
+pub fn isInvariant(expr: *ast.Node, body: *ast.Node) bool {
+    switch (expr.data) {
+        .int_constant, .boolean_constant => return true,
+        .var_get => {
+            const decl = expr.symbol_decl.?;
+            if (decl.function_decl != null) {
+                return false;
+            }
+            if (decl.constant) {
+                return true;
+            }
+            return !assigns(body, decl);
+        },
+        else => return false,
+    }
+}
+
+/// Checks if the node is a read of the passed variable
+pub fn isVariable(node: *ast.Node, decl: *ast.SymbolDecl) bool {
+    switch (node.data) {
+        .var_get => {
+            if (node.symbol_decl) |target| {
+                return target == decl;
+            }
+            return false;
+        },
+        else => return false,
+    }
+}
+
+/// Value of an integer constant node
+pub fn constantValue(node: *ast.Node) ?i64 {
+    return switch (node.data) {
+        .int_constant => |int| int.value,
+        else => null,
+    };
+}
+
+/// Checks if the node or any of its children assign to the passed variable
+pub fn assigns(node: *ast.Node, decl: *ast.SymbolDecl) bool {
+    switch (node.data) {
+        .var_assign => {
+            if (node.symbol_decl) |target| {
+                if (target == decl) {
+                    return true;
+                }
+            }
+        },
+        else => {},
+    }
+    return !node.visitChildren(decl, assignsVisit);
+}
+
+fn assignsVisit(decl: *ast.SymbolDecl, node: *ast.Node) bool {
+    return !assigns(node, decl);
+}
+
+/// Checks if the node or any of its children are function values, these
+/// can't be duplicated without duplicating the whole function
+pub fn containsFunction(node: *ast.Node) bool {
+    switch (node.data) {
+        .function_value => return true,
+        else => {},
+    }
+    return !node.visitChildren({}, containsFunctionVisit);
+}
+
+fn containsFunctionVisit(_: void, node: *ast.Node) bool {
+    return !containsFunction(node);
+}
+
+/// Amount of nodes in the tree, used as an estimate of code size
+pub fn nodeCount(node: *ast.Node) usize {
+    var count: usize = 1;
+    _ = node.visitChildren(&count, nodeCountVisit);
+    return count;
+}
+
+fn nodeCountVisit(count: *usize, node: *ast.Node) bool {
+    count.* += nodeCount(node);
+    return true;
+}
+
+pub fn compareInts(op: ast.Operator, lhs: i64, rhs: i64) bool {
+    return switch (op) {
+        .less_than => lhs < rhs,
+        .less_than_equals => lhs <= rhs,
+        .greater_than => lhs > rhs,
+        .greater_than_equals => lhs >= rhs,
+        else => unreachable,
+    };
+}
+
+/// Constant step of an `i = i + step` or `i = i - step` statement
+fn stepOf(after: *ast.Node, induction: *ast.SymbolDecl) ?i64 {
+    switch (after.data) {
+        .var_assign => |*var_assign| {
+            if (after.symbol_decl == null or after.symbol_decl.? != induction) {
+                return null;
+            }
+            const binary = switch (var_assign.expr.data) {
+                .binary_op => |*binary| binary,
+                else => return null,
+            };
+            const step: i64 = switch (binary.op) {
+                .add => blk: {
+                    if (isVariable(binary.lhs, induction)) {
+                        break :blk constantValue(binary.rhs) orelse return null;
+                    } else if (isVariable(binary.rhs, induction)) {
+                        break :blk constantValue(binary.lhs) orelse return null;
+                    }
+                    return null;
+                },
+                .sub => blk: {
+                    if (!isVariable(binary.lhs, induction)) {
+                        return null;
+                    }
+                    const value = constantValue(binary.rhs) orelse return null;
+                    break :blk std.math.negate(value) catch return null;
+                },
+                else => return null,
+            };
+            if (step == 0) {
+                return null;
+            }
+            return step;
+        },
+        else => return null,
+    }
+}
+
+pub fn intConstant(allocator: std.mem.Allocator, index: usize, int: i64) std.mem.Allocator.Error!*ast.Node {
+    const node = try allocator.create(ast.Node);
+    node.* = .{ .index = index, .data = .{ .int_constant = .{ .value = int } } };
+    return node;
+}
+
+pub fn varGet(allocator: std.mem.Allocator, index: usize, decl: *ast.SymbolDecl) std.mem.Allocator.Error!*ast.Node {
+    const node = try allocator.create(ast.Node);
+    node.* = .{ .symbol_decl = decl, .index = index, .data = .{ .var_get = .{ .name = decl.name, .name_id = decl.name_id } } };
+    return node;
+}
+
+pub fn binaryOp(allocator: std.mem.Allocator, index: usize, op: ast.Operator, lhs: *ast.Node, rhs: *ast.Node) std.mem.Allocator.Error!*ast.Node {
+    const node = try allocator.create(ast.Node);
+    node.* = .{ .index = index, .data = .{ .binary_op = .{ .op = op, .lhs = lhs, .rhs = rhs } } };
+    return node;
+}
+
+pub fn block(allocator: std.mem.Allocator, index: usize, list: std.ArrayListUnmanaged(*ast.Node)) std.mem.Allocator.Error!*ast.Node {
+    const node = try allocator.create(ast.Node);
+    node.* = .{ .index = index, .data = .{ .block = .{ .list = list } } };
+    return node;
+}
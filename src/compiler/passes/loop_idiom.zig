@@ -0,0 +1,360 @@
+//! Loop idiom recognition pass, assumes types have been checked. Counting
+//! loops whose body is a single copy, fill, sum or elementwise arithmetic
+//! statement over arrays are replaced with a native array kernel. Anything
+//! that doesn't match exactly is left to the interpreter.
+
+const std = @import("std");
+const ast = @import("../ast.zig");
+const builtin = @import("../builtin.zig");
+const byte = @import("../../runtime/bytecode.zig");
+const err = @import("../error.zig");
+const loop = @import("loop_analysis.zig");
+
+pub const Error = std.mem.Allocator.Error;
+
+const append_id = builtin.lookup.get("append").?.id;
+
+/// The loop that is being matched
+const Context = struct {
+    counting: loop.CountingLoop,
+    body: *ast.Node,
+    index: usize,
+};
+
+/// Array read of the form `array[i + offset]`
+const ArrayRead = struct {
+    array: *ast.Node,
+    offset: ?*ast.Node, // loop invariant, null if zero
+};
+
+/// Index expression split into a multiple of the induction variable and a
+/// loop invariant offset
+const LinearIndex = struct {
+    coefficient: i64,
+    offset: ?*ast.Node, // loop invariant, null if zero
+};
+
+pub const Pass = struct {
+    root: *ast.Node,
+    failure: ?Error = null,
+    err_ctx: *err.ErrorContext,
+    allocator: std.mem.Allocator,
+
+    pub fn init(allocator: std.mem.Allocator, err_ctx: *err.ErrorContext, root: *ast.Node) Pass {
+        return Pass{
+            .root = root,
+            .err_ctx = err_ctx,
+            .allocator = allocator,
+        };
+    }
+
+    pub fn run(self: *Pass) Error!void {
+        try self.replaceNode(self.root);
+    }
+
+    fn replaceNode(self: *Pass, node: *ast.Node) Error!void {
+        if (!node.visitChildren(self, visitNode)) {
+            return self.failure.?;
+        }
+
+        switch (node.data) {
+            .for_loop => try self.replaceLoop(node),
+            else => {},
+        }
+    }
+
+    fn visitNode(self: *Pass, node: *ast.Node) bool {
+        self.replaceNode(node) catch |replace_err| {
+            self.failure = replace_err;
+            return false;
+        };
+        return true;
+    }
+
+    fn replaceLoop(self: *Pass, node: *ast.Node) Error!void {
+        const counting = loop.countingLoop(node) orelse return;
+        const body = node.data.for_loop.body;
+
+        // The start is used for both the trip count and the kernel indices so
+        // it has to be safe to evaluate more than once
+        if (counting.step != 1 or !loop.isInvariant(counting.start, body)) {
+            return;
+        }
+
+        const statement = switch (body.data) {
+            .block => |*block| if (block.list.items.len == 1) block.list.items[0] else return,
+            else => return,
+        };
+
+        const ctx = Context{
+            .counting = counting,
+            .body = body,
+            .index = node.index,
+        };
+
+        switch (statement.data) {
+            .builtin_call => |*call| {
+                if (call.idx == append_id) {
+                    try self.matchAppend(node, ctx, call.args);
+                }
+            },
+            .array_set => |*array_set| try self.matchArraySet(node, ctx, array_set.array, array_set.index, array_set.expr),
+            .var_assign => |*var_assign| try self.matchSum(node, ctx, statement.symbol_decl.?, var_assign.expr),
+            else => {},
+        }
+    }
+
+    /// `append(dst, src[i + offset])`
+    fn matchAppend(self: *Pass, node: *ast.Node, ctx: Context, args: []*ast.Node) Error!void {
+        if (!isArrayVariable(args[0], ctx)) {
+            return;
+        }
+        const read = (try self.arrayRead(args[1], ctx)) orelse return;
+        try self.replaceWithKernel(node, ctx, .append_copy, .add, &.{
+            args[0],
+            read.array,
+            try self.startOf(ctx, read.offset),
+        }, null);
+    }
+
+    /// `dst[i + offset] = src[i + offset]`, `dst[i + offset] = scalar` and
+    /// `dst[i + offset] = lhs op rhs`
+    fn matchArraySet(self: *Pass, node: *ast.Node, ctx: Context, array: *ast.Node, index: *ast.Node, expr: *ast.Node) Error!void {
+        if (!isArrayVariable(array, ctx)) {
+            return;
+        }
+        const linear = (try self.linearIndex(index, ctx)) orelse return;
+        if (linear.coefficient != 1) {
+            return;
+        }
+        const dst_start = try self.startOf(ctx, linear.offset);
+
+        if (try self.arrayRead(expr, ctx)) |read| {
+            return self.replaceWithKernel(node, ctx, .copy, .add, &.{
+                array,
+                dst_start,
+                read.array,
+                try self.startOf(ctx, read.offset),
+            }, null);
+        }
+
+        if (isScalar(expr, ctx)) {
+            return self.replaceWithKernel(node, ctx, .fill, .add, &.{ array, dst_start, expr }, null);
+        }
+
+        const binary = switch (expr.data) {
+            .binary_op => |*binary| binary,
+            else => return,
+        };
+        const op: byte.KernelOp = switch (binary.op) {
+            .add => .add,
+            .sub => .sub,
+            .mul => .mul,
+            else => return,
+        };
+        if (!isIntArray(array)) {
+            return;
+        }
+
+        const lhs = try self.arrayRead(binary.lhs, ctx);
+        const rhs = try self.arrayRead(binary.rhs, ctx);
+        if (lhs != null and rhs != null) {
+            if (!isIntArray(lhs.?.array) or !isIntArray(rhs.?.array)) {
+                return;
+            }
+            try self.replaceWithKernel(node, ctx, .map, op, &.{
+                array,
+                dst_start,
+                lhs.?.array,
+                try self.startOf(ctx, lhs.?.offset),
+                rhs.?.array,
+                try self.startOf(ctx, rhs.?.offset),
+            }, null);
+        } else if (lhs != null and isScalar(binary.rhs, ctx)) {
+            if (!isIntArray(lhs.?.array)) {
+                return;
+            }
+            try self.replaceWithKernel(node, ctx, .map_scalar_rhs, op, &.{
+                array,
+                dst_start,
+                lhs.?.array,
+                try self.startOf(ctx, lhs.?.offset),
+                binary.rhs,
+            }, null);
+        } else if (rhs != null and isScalar(binary.lhs, ctx)) {
+            if (!isIntArray(rhs.?.array)) {
+                return;
+            }
+            try self.replaceWithKernel(node, ctx, .map_scalar_lhs, op, &.{
+                array,
+                dst_start,
+                binary.lhs,
+                rhs.?.array,
+                try self.startOf(ctx, rhs.?.offset),
+            }, null);
+        }
+    }
+
+    /// `acc = acc + src[i + offset]`
+    fn matchSum(self: *Pass, node: *ast.Node, ctx: Context, acc: *ast.SymbolDecl, expr: *ast.Node) Error!void {
+        if (acc == ctx.counting.induction or acc.decl_type == null or acc.decl_type.? != .int) {
+            return;
+        }
+        const binary = switch (expr.data) {
+            .binary_op => |*binary| binary,
+            else => return,
+        };
+        switch (binary.op) {
+            .add => {},
+            else => return,
+        }
+
+        const read_node = if (loop.isVariable(binary.lhs, acc))
+            binary.rhs
+        else if (loop.isVariable(binary.rhs, acc))
+            binary.lhs
+        else
+            return;
+        const read = (try self.arrayRead(read_node, ctx)) orelse return;
+        if (!isIntArray(read.array)) {
+            return;
+        }
+
+        try self.replaceWithKernel(node, ctx, .sum, .add, &.{
+            try loop.varGet(self.allocator, ctx.index, acc),
+            read.array,
+            try self.startOf(ctx, read.offset),
+        }, acc);
+    }
+
+    /// Replaces the loop with a kernel that takes the passed operands followed
+    /// by the trip count
+    fn replaceWithKernel(self: *Pass, node: *ast.Node, ctx: Context, kind: byte.Kernel, op: byte.KernelOp, operands: []const *ast.Node, result: ?*ast.SymbolDecl) Error!void {
+        const all = try self.allocator.alloc(*ast.Node, operands.len + 1);
+        @memcpy(all[0..operands.len], operands);
+        all[operands.len] = try self.tripCount(ctx);
+        node.data = .{
+            .loop_kernel = .{
+                .kind = kind,
+                .op = op,
+                .operands = all,
+                .result = result,
+            },
+        };
+    }
+
+    /// Matches `array[i + offset]` where the array is a loop invariant variable
+    fn arrayRead(self: *Pass, expr: *ast.Node, ctx: Context) Error!?ArrayRead {
+        const unary = switch (expr.data) {
+            .unary_op => |*unary| unary,
+            else => return null,
+        };
+        const index = switch (unary.op) {
+            .index => |index| index.index,
+            else => return null,
+        };
+        if (!isArrayVariable(unary.expr, ctx)) {
+            return null;
+        }
+        const linear = (try self.linearIndex(index, ctx)) orelse return null;
+        if (linear.coefficient != 1) {
+            return null;
+        }
+        return ArrayRead{ .array = unary.expr, .offset = linear.offset };
+    }
+
+    /// Splits sums and differences of the induction variable and loop
+    /// invariants, null if anything else is involved
+    fn linearIndex(self: *Pass, expr: *ast.Node, ctx: Context) Error!?LinearIndex {
+        switch (expr.data) {
+            .int_constant => return LinearIndex{ .coefficient = 0, .offset = expr },
+            .var_get => {
+                if (loop.isVariable(expr, ctx.counting.induction)) {
+                    return LinearIndex{ .coefficient = 1, .offset = null };
+                }
+                if (loop.isInvariant(expr, ctx.body)) {
+                    return LinearIndex{ .coefficient = 0, .offset = expr };
+                }
+                return null;
+            },
+            .binary_op => |*binary| {
+                const lhs = (try self.linearIndex(binary.lhs, ctx)) orelse return null;
+                const rhs = (try self.linearIndex(binary.rhs, ctx)) orelse return null;
+                return switch (binary.op) {
+                    .add => LinearIndex{
+                        .coefficient = lhs.coefficient + rhs.coefficient,
+                        .offset = try self.combineOffsets(.add, lhs.offset, rhs.offset, expr.index),
+                    },
+                    .sub => LinearIndex{
+                        .coefficient = lhs.coefficient - rhs.coefficient,
+                        .offset = try self.combineOffsets(.sub, lhs.offset, rhs.offset, expr.index),
+                    },
+                    else => null,
+                };
+            },
+            else => return null,
+        }
+    }
+
+    fn combineOffsets(self: *Pass, op: ast.Operator, lhs: ?*ast.Node, rhs: ?*ast.Node, index: usize) Error!?*ast.Node {
+        if (rhs == null) {
+            return lhs;
+        }
+        if (lhs == null) {
+            return switch (op) {
+                .add => rhs,
+                else => try loop.binaryOp(self.allocator, index, op, try loop.intConstant(self.allocator, index, 0), rhs.?),
+            };
+        }
+        return try loop.binaryOp(self.allocator, index, op, lhs.?, rhs.?);
+    }
+
+    /// Index of the first iteration
+    fn startOf(self: *Pass, ctx: Context, offset: ?*ast.Node) Error!*ast.Node {
+        if (offset) |some| {
+            return loop.binaryOp(self.allocator, ctx.index, .add, ctx.counting.start, some);
+        }
+        return ctx.counting.start;
+    }
+
+    /// Amount of iterations, may be negative if the loop doesn't run at all
+    fn tripCount(self: *Pass, ctx: Context) Error!*ast.Node {
+        const count = try loop.binaryOp(self.allocator, ctx.index, .sub, ctx.counting.bound, ctx.counting.start);
+        return switch (ctx.counting.compare) {
+            .less_than_equals => try loop.binaryOp(self.allocator, ctx.index, .add, count, try loop.intConstant(self.allocator, ctx.index, 1)),
+            else => count,
+        };
+    }
+
+    /// Loop invariant array variable
+    fn isArrayVariable(node: *ast.Node, ctx: Context) bool {
+        switch (node.data) {
+            .var_get => {},
+            else => return false,
+        }
+        const decl = node.symbol_decl.?;
+        if (decl == ctx.counting.induction or !loop.isInvariant(node, ctx.body)) {
+            return false;
+        }
+        return decl.decl_type != null and decl.decl_type.? == .array;
+    }
+
+    fn isIntArray(node: *ast.Node) bool {
+        return node.symbol_decl.?.decl_type.?.array.base.* == .int;
+    }
+
+    /// Loop invariant scalar, objects are excluded as constants create a new
+    /// object each time they are evaluated
+    fn isScalar(node: *ast.Node, ctx: Context) bool {
+        switch (node.data) {
+            .int_constant, .boolean_constant => return true,
+            .var_get => {
+                if (node.symbol_decl.? == ctx.counting.induction) {
+                    return false;
+                }
+                return loop.isInvariant(node, ctx.body);
+            },
+            else => return false,
+        }
+    }
+};
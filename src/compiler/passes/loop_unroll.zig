@@ -0,0 +1,202 @@
+//! Loop unrolling pass, assumes types have been checked. Counting loops with a
+//! small constant trip count are fully unrolled, other counting loops are
+//! unrolled by a fixed factor and followed by a remainder loop.
+
+const std = @import("std");
+const ast = @import("../ast.zig");
+const err = @import("../error.zig");
+const loop = @import("loop_analysis.zig");
+
+pub const Error = std.mem.Allocator.Error;
+
+/// Most iterations a loop can have to be fully unrolled
+const max_full_trip: usize = 16;
+/// Amount of body copies in a partially unrolled loop
+const unroll_factor: usize = 4;
+/// Most nodes that unrolling a single loop may add
+const loop_budget: usize = 128;
+/// Most nodes that unrolling may add to a single function
+const function_budget: usize = 512;
+
+pub const Pass = struct {
+    root: *ast.Node,
+    budget: usize = function_budget,
+    failure: ?Error = null,
+    err_ctx: *err.ErrorContext,
+    allocator: std.mem.Allocator,
+
+    pub fn init(allocator: std.mem.Allocator, err_ctx: *err.ErrorContext, root: *ast.Node) Pass {
+        return Pass{
+            .root = root,
+            .err_ctx = err_ctx,
+            .allocator = allocator,
+        };
+    }
+
+    pub fn run(self: *Pass) Error!void {
+        try self.unrollNode(self.root);
+    }
+
+    /// Unrolls innermost loops first as those are the hottest
+    fn unrollNode(self: *Pass, node: *ast.Node) Error!void {
+        switch (node.data) {
+            // Generic functions are visited through their instances
+            .function_value => |*func| if (func.type_params.len == 0) {
+                const outer_budget = self.budget;
+                self.budget = function_budget;
+                defer self.budget = outer_budget;
+                try self.unrollNode(func.body);
+                return;
+            },
+            else => {},
+        }
+
+        if (!node.visitChildren(self, visitNode)) {
+            return self.failure.?;
+        }
+
+        switch (node.data) {
+            .for_loop => try self.unrollLoop(node),
+            else => {},
+        }
+    }
+
+    fn visitNode(self: *Pass, node: *ast.Node) bool {
+        self.unrollNode(node) catch |unroll_err| {
+            self.failure = unroll_err;
+            return false;
+        };
+        return true;
+    }
+
+    fn unrollLoop(self: *Pass, node: *ast.Node) Error!void {
+        const for_loop = node.data.for_loop;
+        const counting = loop.countingLoop(node) orelse return;
+        if (loop.containsFunction(for_loop.body)) {
+            return;
+        }
+
+        const copy_size = loop.nodeCount(for_loop.body) + loop.nodeCount(for_loop.after);
+
+        const start = loop.constantValue(counting.start);
+        const bound = loop.constantValue(counting.bound);
+        if (start != null and bound != null) {
+            if (counting.tripCount(start.?, bound.?, max_full_trip)) |trip| {
+                const size = trip * copy_size;
+                if (size <= loop_budget and size <= self.budget) {
+                    self.budget -= size;
+                    try self.unrollFully(node, trip);
+                    return;
+                }
+            }
+        }
+
+        const size = (unroll_factor - 1) * copy_size;
+        if (size > loop_budget or size > self.budget) {
+            return;
+        }
+        const condition = try self.partialCondition(node.index, counting) orelse return;
+        self.budget -= size;
+        try self.unrollPartially(node, condition);
+    }
+
+    /// Replaces the loop with its init statement followed by a copy of the
+    /// body and after statement for every iteration
+    fn unrollFully(self: *Pass, node: *ast.Node, trip: usize) Error!void {
+        const for_loop = node.data.for_loop;
+
+        var list = try std.ArrayListUnmanaged(*ast.Node).initCapacity(self.allocator, 1 + trip * 2);
+        list.appendAssumeCapacity(for_loop.init);
+        for (0..trip) |_| {
+            list.appendAssumeCapacity(for_loop.body);
+            list.appendAssumeCapacity(for_loop.after);
+        }
+
+        node.data = .{ .block = .{ .list = list } };
+    }
+
+    /// Replaces the loop with one running unroll_factor iterations per pass,
+    /// followed by a remainder loop for the iterations that are left over
+    fn unrollPartially(self: *Pass, node: *ast.Node, condition: *ast.Node) Error!void {
+        const for_loop = node.data.for_loop;
+        const index = node.index;
+
+        var body = try std.ArrayListUnmanaged(*ast.Node).initCapacity(self.allocator, unroll_factor * 2 - 1);
+        for (0..unroll_factor - 1) |_| {
+            body.appendAssumeCapacity(for_loop.body);
+            body.appendAssumeCapacity(for_loop.after);
+        }
+        body.appendAssumeCapacity(for_loop.body);
+
+        const unrolled = try self.allocator.create(ast.Node);
+        unrolled.* = .{
+            .index = index,
+            .data = .{
+                .for_loop = .{
+                    .init = for_loop.init,
+                    .condition = condition,
+                    .after = for_loop.after,
+                    .body = try loop.block(self.allocator, index, body),
+                },
+            },
+        };
+
+        var remainder_body = try std.ArrayListUnmanaged(*ast.Node).initCapacity(self.allocator, 2);
+        remainder_body.appendAssumeCapacity(for_loop.body);
+        remainder_body.appendAssumeCapacity(for_loop.after);
+
+        const remainder = try self.allocator.create(ast.Node);
+        remainder.* = .{
+            .index = index,
+            .data = .{
+                .while_loop = .{
+                    .expr = for_loop.condition,
+                    .body = try loop.block(self.allocator, index, remainder_body),
+                },
+            },
+        };
+
+        var list = try std.ArrayListUnmanaged(*ast.Node).initCapacity(self.allocator, 2);
+        list.appendAssumeCapacity(unrolled);
+        list.appendAssumeCapacity(remainder);
+
+        node.data = .{ .block = .{ .list = list } };
+    }
+
+    /// Condition of a partially unrolled loop, null if it can't be checked
+    /// without overflowing. The bound is invariant and the step constant, so
+    /// the whole pass can run if the iteration of the last copy would.
+    fn partialCondition(self: *Pass, index: usize, counting: loop.CountingLoop) Error!?*ast.Node {
+        const last_offset = counting.step * @as(i64, @intCast(unroll_factor - 1));
+        const induction = try loop.varGet(self.allocator, index, counting.induction);
+
+        // `i + offset < bound` is checked as `i < bound - offset`, folded here
+        if (loop.constantValue(counting.bound)) |bound| {
+            const folded = std.math.sub(i64, bound, last_offset) catch return null;
+            const folded_bound = try loop.intConstant(self.allocator, index, folded);
+            return try loop.binaryOp(self.allocator, index, counting.compare, induction, folded_bound);
+        }
+
+        // Otherwise it is checked as `bound - i > offset`, which only stays in
+        // range if the loop starts at zero. The first check subtracts zero,
+        // after that the bound and every value of i have the same sign.
+        const start = loop.constantValue(counting.start) orelse return null;
+        if (start != 0) {
+            return null;
+        }
+        const offset = try loop.intConstant(self.allocator, index, last_offset);
+        const remaining = try loop.binaryOp(self.allocator, index, .sub, counting.bound, induction);
+        return try loop.binaryOp(self.allocator, index, mirrored(counting.compare), remaining, offset);
+    }
+};
+
+/// Comparison with swapped operands, `a < b` is `b > a`
+fn mirrored(compare: ast.Operator) ast.Operator {
+    return switch (compare) {
+        .less_than => .greater_than,
+        .less_than_equals => .greater_than_equals,
+        .greater_than => .less_than,
+        .greater_than_equals => .less_than_equals,
+        else => unreachable,
+    };
+}
@@ -3,6 +3,7 @@
 const std = @import("std");
 const ast = @import("../ast.zig");
 const err = @import("../error.zig");
+const lexer = @import("../lexer.zig");
 const types = @import("../types.zig");
 
 pub const Error = error{
@@ -12,68 +13,57 @@ pub const Error = error{
 } || std.mem.Allocator.Error;
 
 /// Helper to assist in scoping, allows user to obtain a "frame" and then later
-/// pop everything in the stack that is after the frame.
+/// pop everything declared after the frame. Name ids map straight to their
+/// innermost declaration so lookups don't depend on how many symbols are in
+/// scope, and an undo log restores whatever a declaration hid when it goes
+/// out of scope.
 const SymbolStack = struct {
-    const Node = struct {
-        next: ?*Node = null,
-        prev: ?*Node = null,
-        symbol: *ast.SymbolDecl,
+    const Shadowed = struct {
+        name: lexer.NameId,
+        previous: ?*ast.SymbolDecl,
     };
     self_arg: bool = false,
     allocator: std.mem.Allocator,
-    front: ?*Node = null,
+    names: std.AutoHashMapUnmanaged(lexer.NameId, *ast.SymbolDecl) = std.AutoHashMapUnmanaged(lexer.NameId, *ast.SymbolDecl){},
+    undo: std.ArrayListUnmanaged(Shadowed) = std.ArrayListUnmanaged(Shadowed){},
 
     pub fn deinit(self: *SymbolStack) void {
-        while (self.front) |_| {
-            _ = self.pop();
-        }
+        self.names.deinit(self.allocator);
+        self.undo.deinit(self.allocator);
     }
 
-    pub fn getFrame(self: *SymbolStack) ?*Node {
-        return self.front;
+    pub fn getFrame(self: *SymbolStack) usize {
+        return self.undo.items.len;
     }
 
-    pub fn popFrame(self: *SymbolStack, maybe_frame: ?*Node) void {
-        if (maybe_frame) |frame| {
-            while (self.front != null and self.front.? != frame) {
-                _ = self.pop();
-            }
-        } else {
-            while (self.front != null) {
-                _ = self.pop();
-            }
+    pub fn popFrame(self: *SymbolStack, frame: usize) void {
+        while (self.undo.items.len > frame) {
+            _ = self.pop();
         }
     }
 
     pub fn push(self: *SymbolStack, symbol: *ast.SymbolDecl) Error!void {
-        const node = try self.allocator.create(Node);
-        node.symbol = symbol;
-        node.next = self.front;
-        if (self.front) |front| {
-            front.prev = node;
-        }
-        self.front = node;
+        const entry = try self.names.getOrPut(self.allocator, symbol.name_id);
+        try self.undo.append(self.allocator, .{
+            .name = symbol.name_id,
+            .previous = if (entry.found_existing) entry.value_ptr.* else null,
+        });
+        entry.value_ptr.* = symbol;
     }
 
     pub fn pop(self: *SymbolStack) ?*ast.SymbolDecl {
-        if (self.front) |front| {
-            const node = front.symbol;
-            self.front = front.next;
-            return node;
+        const shadowed = self.undo.popOrNull() orelse return null;
+        if (shadowed.previous) |previous| {
+            const entry = self.names.getEntry(shadowed.name).?;
+            const popped = entry.value_ptr.*;
+            entry.value_ptr.* = previous;
+            return popped;
         }
-        return null;
+        return self.names.fetchRemove(shadowed.name).?.value;
     }
 
-    /// Looks for a symbol in the stack. Fairly inefficient
-    pub fn find(self: *SymbolStack, name: []const u8) ?*ast.SymbolDecl {
-        var iter = self.front;
-        while (iter) |node| {
-            iter = node.next;
-            if (std.mem.eql(u8, name, node.symbol.name)) {
-                return node.symbol;
-            }
-        }
-        return null;
+    pub fn find(self: *SymbolStack, name: lexer.NameId) ?*ast.SymbolDecl {
+        return self.names.get(name);
     }
 };
 
@@ -112,7 +102,7 @@ const Stack = struct {
 
 pub const Pass = struct {
     stack_stack: Stack = Stack{}, // stack of stacks lol
-    global_symbols: std.StringHashMapUnmanaged(*ast.SymbolDecl) = std.StringHashMapUnmanaged(*ast.SymbolDecl){},
+    global_symbols: std.AutoHashMapUnmanaged(lexer.NameId, *ast.SymbolDecl) = std.AutoHashMapUnmanaged(lexer.NameId, *ast.SymbolDecl){},
     err_ctx: *err.ErrorContext,
     allocator: std.mem.Allocator,
     root: *ast.Node,
@@ -133,18 +123,18 @@ pub const Pass = struct {
 
     fn populateNode(self: *Pass, node: *ast.Node) Error!void {
         // Checking AST nodes that need a valid symbol
-        const get_symbol: ?[]const u8 = switch (node.data) {
-            .var_get => |var_get| var_get.name,
-            .var_assign => |var_assign| var_assign.name,
+        const get_symbol: ?struct { name: []const u8, id: lexer.NameId } = switch (node.data) {
+            .var_get => |var_get| .{ .name = var_get.name, .id = var_get.name_id },
+            .var_assign => |var_assign| .{ .name = var_assign.name, .id = var_assign.name_id },
             else => null,
         };
         if (get_symbol) |symbol| {
-            if (self.global_symbols.get(symbol)) |found| {
+            if (self.global_symbols.get(symbol.id)) |found| {
                 node.symbol_decl = found;
-            } else if (self.stack_stack.peek().?.find(symbol)) |found| {
+            } else if (self.stack_stack.peek().?.find(symbol.id)) |found| {
                 node.symbol_decl = found;
             } else {
-                try self.err_ctx.newError(.symbol_not_found, "Failed to locate symbol \"{s}\"", .{symbol}, node.index);
+                try self.err_ctx.newError(.symbol_not_found, "Failed to locate symbol \"{s}\"", .{symbol.name}, node.index);
                 return Error.SymbolNotFound;
             }
         }
@@ -153,6 +143,11 @@ pub const Pass = struct {
             .int_constant => {},
             .boolean_constant => {},
             .string_constant => {},
+            .container_init => |*container| {
+                if (container.comparator) |comparator| {
+                    try self.populateNode(comparator);
+                }
+            },
             .var_get => |_| {},
             .block => |*block| {
                 var stack = self.stack_stack.peek().?;
@@ -176,8 +171,12 @@ pub const Pass = struct {
                     },
                     .index => |*index| {
                         try self.populateNode(index.index);
+                        if (index.column) |column| {
+                            try self.populateNode(column);
+                        }
                         try self.populateNode(unary.expr);
                     },
+                    .field => {},
                     else => unreachable,
                 }
             },
@@ -188,12 +187,12 @@ pub const Pass = struct {
                 }
                 if (func.name) |name| {
                     const symbol = try self.allocator.create(ast.SymbolDecl);
-                    symbol.* = ast.SymbolDecl{ .name = name, .function_decl = node };
-                    try self.global_symbols.put(self.allocator, name, symbol);
+                    symbol.* = ast.SymbolDecl{ .name = name, .name_id = func.name_id, .function_decl = node };
+                    try self.global_symbols.put(self.allocator, func.name_id, symbol);
                 }
                 if (func.self_arg) {
                     const symbol = try self.allocator.create(ast.SymbolDecl);
-                    symbol.* = ast.SymbolDecl{ .name = try self.allocator.dupe(u8, "self"), .function_decl = node };
+                    symbol.* = ast.SymbolDecl{ .name = "self", .name_id = lexer.self_name, .function_decl = node };
                     try stack.push(symbol);
                 }
                 try self.populateNode(func.body);
@@ -210,15 +209,36 @@ pub const Pass = struct {
                     try self.populateNode(item);
                 }
             },
+            .tuple_init => |*tuple| {
+                for (tuple.items.items) |item| {
+                    try self.populateNode(item);
+                }
+            },
+            .struct_init => |*struct_init| {
+                for (struct_init.fields) |field| {
+                    try self.populateNode(field.expr);
+                }
+            },
             .var_decl => |*var_decl| {
                 var stack = self.stack_stack.peek().?;
-                if (stack.find(var_decl.symbol.name)) |_| {
+                if (stack.find(var_decl.symbol.name_id)) |_| {
                     try self.err_ctx.newError(.symbol_shadowing, "Found symbol shadowing previous declaration, \"{s}\"", .{var_decl.symbol.name}, node.index);
                     return Error.SymbolShadowing;
                 }
                 try stack.push(&var_decl.symbol);
                 try self.populateNode(var_decl.expr);
             },
+            .tuple_decl => |*tuple_decl| {
+                try self.populateNode(tuple_decl.expr);
+                var stack = self.stack_stack.peek().?;
+                for (tuple_decl.symbols.items) |*symbol| {
+                    if (stack.find(symbol.name_id)) |_| {
+                        try self.err_ctx.newError(.symbol_shadowing, "Found symbol shadowing previous declaration, \"{s}\"", .{symbol.name}, node.index);
+                        return Error.SymbolShadowing;
+                    }
+                    try stack.push(symbol);
+                }
+            },
             .var_assign => |*var_assign| try self.populateNode(var_assign.expr),
             .while_loop => |*while_loop| {
                 try self.populateNode(while_loop.expr);
@@ -233,11 +253,46 @@ pub const Pass = struct {
                 try self.populateNode(for_loop.body);
                 stack.popFrame(frame);
             },
+            .for_each => |*for_each| {
+                // The iterable is evaluated before the loop variable exists
+                try self.populateNode(for_each.iterable);
+                if (for_each.range_end) |range_end| {
+                    try self.populateNode(range_end);
+                }
+                var stack = self.stack_stack.peek().?;
+                const frame = stack.getFrame();
+                if (stack.find(for_each.symbol.name_id)) |_| {
+                    try self.err_ctx.newError(.symbol_shadowing, "Found symbol shadowing previous declaration, \"{s}\"", .{for_each.symbol.name}, node.index);
+                    return Error.SymbolShadowing;
+                }
+                try stack.push(&for_each.symbol);
+                try self.populateNode(for_each.body);
+                stack.popFrame(frame);
+            },
             .array_set => |*array_set| {
                 try self.populateNode(array_set.index);
+                if (array_set.column) |column| {
+                    try self.populateNode(column);
+                }
                 try self.populateNode(array_set.expr);
                 try self.populateNode(array_set.array);
             },
+            .field_set => |*field_set| {
+                try self.populateNode(field_set.expr);
+                try self.populateNode(field_set.record);
+            },
+            .match_stmt => |*match_stmt| {
+                try self.populateNode(match_stmt.expr);
+                for (match_stmt.cases.items) |*case| {
+                    for (case.values.items) |case_value| {
+                        try self.populateNode(case_value);
+                    }
+                    try self.populateNode(case.body);
+                }
+                if (match_stmt.else_body) |else_body| {
+                    try self.populateNode(else_body);
+                }
+            },
             .if_stmt => |*if_stmt| {
                 try self.populateNode(if_stmt.expr);
                 try self.populateNode(if_stmt.true_body);
@@ -250,6 +305,7 @@ pub const Pass = struct {
                     try self.populateNode(expr);
                 }
             },
+            .loop_kernel => unreachable, // created after this pass
         }
     }
 };
@@ -0,0 +1,103 @@
+//! Tree shaking pass, assumes symbols have been populated. Named functions
+//! that can't be reached from the top level are removed, so no bytecode or
+//! constants are generated for them. Function indices are assigned during
+//! code generation so the remaining functions stay densely numbered.
+
+const std = @import("std");
+const ast = @import("../ast.zig");
+const err = @import("../error.zig");
+
+pub const Error = std.mem.Allocator.Error;
+
+pub const Pass = struct {
+    root: *ast.Node,
+    reachable: std.AutoHashMapUnmanaged(*ast.Node, void) = std.AutoHashMapUnmanaged(*ast.Node, void){},
+    failure: ?Error = null,
+    err_ctx: *err.ErrorContext,
+    allocator: std.mem.Allocator,
+
+    pub fn init(allocator: std.mem.Allocator, err_ctx: *err.ErrorContext, root: *ast.Node) Pass {
+        return Pass{
+            .root = root,
+            .err_ctx = err_ctx,
+            .allocator = allocator,
+        };
+    }
+
+    pub fn run(self: *Pass) Error!void {
+        try self.markNode(self.root);
+        _ = self.shakeNode(self.root);
+    }
+
+    /// Marks every function referenced by the node, declarations are only
+    /// walked once something references them
+    fn markNode(self: *Pass, node: *ast.Node) Error!void {
+        switch (node.data) {
+            .var_get => {
+                if (node.symbol_decl.?.function_decl) |func| {
+                    const entry = try self.reachable.getOrPut(self.allocator, func);
+                    if (!entry.found_existing) {
+                        try self.markChildren(func);
+                    }
+                    // The declaration in the tree is the generic function
+                    if (func.data.function_value.origin) |origin| {
+                        try self.reachable.put(self.allocator, origin, {});
+                    }
+                }
+                return;
+            },
+            .block => |*block| {
+                for (block.list.items) |statement| {
+                    if (!isDeclaration(statement)) {
+                        try self.markNode(statement);
+                    }
+                }
+                return;
+            },
+            else => {},
+        }
+        try self.markChildren(node);
+    }
+
+    fn markChildren(self: *Pass, node: *ast.Node) Error!void {
+        if (!node.visitChildren(self, visitMark)) {
+            return self.failure.?;
+        }
+    }
+
+    fn visitMark(self: *Pass, node: *ast.Node) bool {
+        self.markNode(node) catch |mark_err| {
+            self.failure = mark_err;
+            return false;
+        };
+        return true;
+    }
+
+    /// Removes unreachable declarations from every block
+    fn shakeNode(self: *Pass, node: *ast.Node) bool {
+        switch (node.data) {
+            .block => |*block| {
+                var kept: usize = 0;
+                for (block.list.items) |statement| {
+                    if (isDeclaration(statement) and !self.reachable.contains(statement)) {
+                        continue;
+                    }
+                    block.list.items[kept] = statement;
+                    kept += 1;
+                }
+                block.list.shrinkRetainingCapacity(kept);
+            },
+            else => {},
+        }
+        return node.visitChildren(self, shakeNode);
+    }
+
+    /// Named functions declared as statements, these don't do anything
+    /// unless they are referenced
+    fn isDeclaration(node: *ast.Node) bool {
+        return switch (node.data) {
+            .function_value => |*func| func.name != null,
+            else => false,
+        };
+    }
+};
@@ -8,10 +8,16 @@ const std = @import("std");
 const ast = @import("../ast.zig");
 const builtin = @import("../builtin.zig");
 const err = @import("../error.zig");
+const lexer = @import("../lexer.zig");
 const types = @import("../types.zig");
+const loop = @import("loop_analysis.zig");
 
 pub const Error = error{
     MismatchedTypes,
+    ImpureFunction,
+    IndexOutOfBounds,
+    DuplicateCase,
+    ConstantAssignment,
 } || std.mem.Allocator.Error;
 
 const Stack = struct {
@@ -47,40 +53,263 @@ const Stack = struct {
     }
 };
 
+/// Looks for impure builtin calls in a function, following every function
+/// that it references as those may end up being called
+const PurityCheck = struct {
+    visited: std.AutoHashMapUnmanaged(*ast.Node, void) = std.AutoHashMapUnmanaged(*ast.Node, void){},
+    impure: ?*ast.Node = null,
+    failure: ?std.mem.Allocator.Error = null,
+    allocator: std.mem.Allocator,
+
+    fn visit(self: *PurityCheck, node: *ast.Node) bool {
+        switch (node.data) {
+            .builtin_call => |*call| {
+                if (!builtin.fromId(call.idx).pure) {
+                    self.impure = node;
+                    return false;
+                }
+            },
+            .var_get => {
+                if (node.symbol_decl.?.function_decl) |func| {
+                    const entry = self.visited.getOrPut(self.allocator, func) catch |alloc_err| {
+                        self.failure = alloc_err;
+                        return false;
+                    };
+                    if (!entry.found_existing and !self.visit(func)) {
+                        return false;
+                    }
+                }
+            },
+            else => {},
+        }
+        return node.visitChildren(self, visit);
+    }
+};
+
+/// Finds writes through const bindings, and places where an object reachable
+/// through one could end up somewhere that can write to it. Indexing and
+/// field access keep an object constant, so the check is deep.
+const ConstCheck = struct {
+    found: ?*ast.Node = null, // offending node
+    decl: *ast.SymbolDecl = undefined, // constant it writes to or leaks
+    escape: bool = false, // leaked instead of written to
+
+    fn visit(self: *ConstCheck, node: *ast.Node) bool {
+        const written: ?*ast.Node = switch (node.data) {
+            .var_assign => blk: {
+                const decl = node.symbol_decl.?;
+                if (decl.constant) {
+                    self.found = node;
+                    self.decl = decl;
+                    return false;
+                }
+                break :blk null;
+            },
+            .array_set => |*array_set| array_set.array,
+            .field_set => |*field_set| field_set.record,
+            .builtin_call => |*call| if (builtin.fromId(call.idx).mutates) call.args[0] else null,
+            else => null,
+        };
+        if (written) |place| {
+            if (constantRoot(place)) |decl| {
+                self.found = node;
+                self.decl = decl;
+                return false;
+            }
+        }
+        switch (node.data) {
+            .for_each => |*for_each| {
+                // Items of a constant array are constant as well
+                if (constantRoot(for_each.iterable) != null and isMutable(for_each.symbol.decl_type.?)) {
+                    for_each.symbol.constant = true;
+                }
+            },
+            else => {},
+        }
+        if (!node.visitChildren(self, visit)) {
+            return false;
+        }
+        const context = EscapeContext{ .check = self, .parent = node };
+        return node.visitChildren(context, EscapeContext.visit);
+    }
+
+    const EscapeContext = struct {
+        check: *ConstCheck,
+        parent: *ast.Node,
+
+        fn visit(self: EscapeContext, child: *ast.Node) bool {
+            const decl = constantRoot(child) orelse return true;
+            const child_type = placeType(child) orelse return true;
+            if (!isMutable(child_type) or readsOnly(self.parent, child)) {
+                return true;
+            }
+            self.check.found = child;
+            self.check.decl = decl;
+            self.check.escape = true;
+            return false;
+        }
+    };
+
+    /// Uses of a constant object that can't write to it or keep it
+    fn readsOnly(parent: *ast.Node, child: *ast.Node) bool {
+        return switch (parent.data) {
+            .unary_op => |*unary| switch (unary.op) {
+                .call => unary.expr == child,
+                else => true,
+            },
+            .binary_op, .match_stmt => true,
+            .builtin_call => |*call| !builtin.fromId(call.idx).mutates,
+            .var_decl => |*var_decl| var_decl.symbol.constant,
+            .for_each => |*for_each| for_each.iterable == child,
+            else => false,
+        };
+    }
+
+    /// Constant variable a place expression reads or writes through
+    fn constantRoot(node: *ast.Node) ?*ast.SymbolDecl {
+        switch (node.data) {
+            .var_get => {
+                const decl = node.symbol_decl.?;
+                return if (decl.constant) decl else null;
+            },
+            .unary_op => |*unary| switch (unary.op) {
+                .index, .field => return constantRoot(unary.expr),
+                else => return null,
+            },
+            else => return null,
+        }
+    }
+
+    /// Type of a place expression, following the types of the indexed arrays
+    /// and accessed fields
+    fn placeType(node: *ast.Node) ?types.Type {
+        switch (node.data) {
+            .var_get => return node.symbol_decl.?.decl_type,
+            .unary_op => |*unary| {
+                const base = placeType(unary.expr) orelse return null;
+                switch (unary.op) {
+                    .index => {
+                        const element = base.elementType() orelse return null;
+                        return element.*;
+                    },
+                    .field => |field| switch (base) {
+                        .structure => |structure| return structure.fields[field.index].field_type,
+                        else => return null,
+                    },
+                    else => return null,
+                }
+            },
+            else => return null,
+        }
+    }
+
+    /// Types that can be changed through any reference to them
+    fn isMutable(node_type: types.Type) bool {
+        return switch (node_type) {
+            .array, .fixed_array, .structure, .map, .set, .pqueue, .matrix, .bytes => true,
+            else => false,
+        };
+    }
+};
+
 pub const Pass = struct {
     root: *ast.Node,
     func_stack: Stack = Stack{},
+    type_table: *types.TypeTable, // shared with the parser
+    signed: ?*const ast.NodeSet = null, // functions whose signatures were checked before this pass ran
+    units: ?*const ast.NodeSet = null, // functions whose bodies are checked by other passes
     err_ctx: *err.ErrorContext,
     allocator: std.mem.Allocator,
 
-    pub fn init(allocator: std.mem.Allocator, err_ctx: *err.ErrorContext, root: *ast.Node) Pass {
+    pub fn init(allocator: std.mem.Allocator, err_ctx: *err.ErrorContext, root: *ast.Node, type_table: *types.TypeTable) Pass {
         return Pass{
             .root = root,
+            .type_table = type_table,
             .err_ctx = err_ctx,
             .allocator = allocator,
         };
     }
 
     pub fn run(self: *Pass) Error!void {
-        var void_type: types.Type = .void;
-        _ = try self.func_stack.push(self.allocator, types.Type{ .function = .{ .ret = &void_type } });
+        const void_type = try self.type_table.intern(.void);
+        _ = try self.func_stack.push(self.allocator, types.Type{ .function = .{ .ret = void_type } });
         _ = try self.typeCheck(self.root);
+        try self.checkConstants();
+    }
+
+    /// Constants are checked once every type is known, so that reads of
+    /// scalars out of constant containers are still allowed everywhere
+    fn checkConstants(self: *Pass) Error!void {
+        var check = ConstCheck{};
+        if (check.visit(self.root)) {
+            return;
+        }
+        const found = check.found.?;
+        if (check.escape) {
+            try self.err_ctx.newError(.constant_assignment, "Constant \"{s}\" can't be used where it could be changed, clone it first", .{check.decl.name}, found.index);
+        } else {
+            try self.err_ctx.newError(.constant_assignment, "Cannot change constant \"{s}\"", .{check.decl.name}, found.index);
+        }
+        return Error.ConstantAssignment;
     }
 
+    /// Checks a node whose value is used as a single value, tuples can only be
+    /// returned, destructured or discarded as they never exist outside of the
+    /// stack
     fn typeCheck(self: *Pass, node: *ast.Node) Error!types.Type {
+        const node_type = try self.checkNode(node);
+        switch (node_type) {
+            .tuple => {
+                try self.err_ctx.newError(.mismatched_types, "Expected tuple of type \"{any}\" to be returned or destructured", .{node_type}, node.index);
+                return Error.MismatchedTypes;
+            },
+            else => return node_type,
+        }
+    }
+
+    /// Checks a statement of a block. The result of a bare call is unused,
+    /// so a returned tuple is allowed there and popped after the call
+    fn checkStatement(self: *Pass, node: *ast.Node) Error!void {
+        switch (node.data) {
+            .unary_op => |*unary| switch (unary.op) {
+                .call => |*call| {
+                    switch (try self.checkNode(node)) {
+                        .tuple => |tuple| call.discarded = @intCast(tuple.items.len),
+                        else => {},
+                    }
+                    return;
+                },
+                else => {},
+            },
+            else => {},
+        }
+        _ = try self.typeCheck(node);
+    }
+
+    fn checkNode(self: *Pass, node: *ast.Node) Error!types.Type {
         switch (node.data) {
             .int_constant => return .int,
             .boolean_constant => return .boolean,
             .string_constant => return .string,
+            .container_init => |_| return try self.checkContainerInit(node),
             .var_get => |_| return {
                 if (node.symbol_decl.?.function_decl) |func| {
+                    if (func.data.function_value.type_params.len > 0) {
+                        try self.err_ctx.newError(.mismatched_types, "Generic function \"{s}\" can only be called", .{node.symbol_decl.?.name}, node.index);
+                        return Error.MismatchedTypes;
+                    }
                     return func.data.function_value.func_type;
                 }
+                // Scalar constants are propagated into every read
+                if (node.symbol_decl.?.constant_value) |constant| {
+                    node.data = constant.data;
+                    return self.checkNode(node);
+                }
                 return node.symbol_decl.?.decl_type.?;
             },
             .block => |*block| {
                 for (block.list.items) |statement| {
-                    _ = try self.typeCheck(statement);
+                    try self.checkStatement(statement);
                 }
                 return .void;
             },
@@ -130,41 +359,23 @@ pub const Pass = struct {
             },
             .unary_op => |_| return try self.checkUnary(node),
             .function_value => |*func| {
-                var arg_types = std.ArrayListUnmanaged(types.Type){};
-
-                for (func.args.items) |arg| {
-                    try arg_types.append(self.allocator, arg.decl_type.?);
+                // Checked once per instance as calls to it are found
+                if (func.type_params.len > 0) {
+                    return .void;
                 }
-
-                const ret = try self.allocator.create(types.Type);
-                ret.* = func.ret_type;
-
-                const func_type = types.Type{
-                    .function = .{
-                        .args = arg_types,
-                        .ret = ret,
-                    },
-                };
-
-                func.func_type = func_type;
-
-                _ = try self.func_stack.push(self.allocator, func_type);
-
-                _ = try self.typeCheck(func.body);
-
-                _ = self.func_stack.pop();
-
-                return func_type;
+                if (!contains(self.signed, node)) {
+                    try self.checkSignature(node);
+                }
+                if (!contains(self.units, node)) {
+                    try self.checkBody(node);
+                }
+                return func.func_type;
             },
             .builtin_call => |*call| {
-                const data: builtin.Data = blk: {
-                    for (builtin.lookup.kvs) |pairs| {
-                        if (pairs.value.id == call.idx) {
-                            break :blk pairs.value;
-                        }
-                    }
-                    unreachable;
-                };
+                const data = builtin.fromId(call.idx);
+                if (data.container) |signature| {
+                    return self.checkContainerCall(node, signature);
+                }
 
                 // if ret type is null, then assume it is the same as a null
                 // argument
@@ -222,9 +433,7 @@ pub const Pass = struct {
             },
             .array_init => |*array| {
                 if (array.items.items.len <= 0) {
-                    const void_type = try self.allocator.create(types.Type);
-                    void_type.* = .void;
-                    return types.Type{ .array = .{ .base = void_type } };
+                    return types.Type{ .array = .{ .base = try self.type_table.intern(.void) } };
                 }
 
                 const array_type = try self.typeCheck(array.items.items[0]);
@@ -236,15 +445,86 @@ pub const Pass = struct {
                     }
                 }
 
-                const heap_type = try self.allocator.create(types.Type);
-                heap_type.* = array_type;
+                return types.Type{ .array = .{ .base = try self.type_table.intern(array_type) } };
+            },
+            .tuple_init => |*tuple| {
+                var item_types = try std.ArrayListUnmanaged(*types.Type).initCapacity(self.allocator, tuple.items.items.len);
+                for (tuple.items.items) |item| {
+                    const item_type = try self.typeCheck(item);
+                    if (item_type.equal(&.void)) {
+                        try self.err_ctx.newError(.mismatched_types, "Void is not a valid tuple item type", .{}, item.index);
+                        return Error.MismatchedTypes;
+                    }
+                    item_types.appendAssumeCapacity(try self.type_table.intern(item_type));
+                }
+                return types.Type{ .tuple = .{ .items = item_types.items } };
+            },
+            .struct_init => |*struct_init| {
+                const structure = struct_init.structure;
+                if (struct_init.fields.len != structure.fields.len) {
+                    try self.err_ctx.newError(.mismatched_types, "Expected {d} fields in struct \"{s}\" initialization, found {d}", .{ structure.fields.len, structure.name, struct_init.fields.len }, node.index);
+                    return Error.MismatchedTypes;
+                }
 
-                return types.Type{ .array = .{ .base = heap_type } };
+                // Put the fields in declaration order so they can be pushed
+                // straight into their offsets
+                const ordered = try self.allocator.alloc(?ast.Node.FieldInit, structure.fields.len);
+                @memset(ordered, null);
+                for (struct_init.fields) |field| {
+                    const index = structure.fieldIndex(field.name_id) orelse {
+                        try self.err_ctx.newError(.mismatched_types, "Struct \"{s}\" has no field \"{s}\"", .{ structure.name, field.name }, field.expr.index);
+                        return Error.MismatchedTypes;
+                    };
+                    if (ordered[index] != null) {
+                        try self.err_ctx.newError(.mismatched_types, "Found field \"{s}\" initialized more than once", .{field.name}, field.expr.index);
+                        return Error.MismatchedTypes;
+                    }
+                    const field_type = &structure.fields[index].field_type;
+                    const expr_type = try self.typeCheck(field.expr);
+                    if (!expr_type.equal(field_type)) {
+                        try self.err_ctx.newError(.mismatched_types, "Expected type \"{any}\" for field \"{s}\", found type \"{any}\"", .{ field_type, field.name, expr_type }, field.expr.index);
+                        return Error.MismatchedTypes;
+                    }
+                    ordered[index] = field;
+                }
+                for (struct_init.fields, ordered) |*field, maybe_field| {
+                    field.* = maybe_field.?;
+                }
+                return types.Type{ .structure = structure };
+            },
+            .tuple_decl => |*tuple_decl| {
+                const expr_type = try self.checkNode(tuple_decl.expr);
+                switch (expr_type) {
+                    .tuple => |tuple| {
+                        if (tuple.items.len != tuple_decl.symbols.items.len) {
+                            try self.err_ctx.newError(.mismatched_types, "Expected tuple with {d} items in tuple declaration, found type \"{any}\"", .{ tuple_decl.symbols.items.len, expr_type }, tuple_decl.expr.index);
+                            return Error.MismatchedTypes;
+                        }
+                        for (tuple_decl.symbols.items, tuple.items) |*symbol, item_type| {
+                            symbol.decl_type = item_type.*;
+                        }
+                    },
+                    else => {
+                        try self.err_ctx.newError(.mismatched_types, "Expected tuple in tuple declaration, found type \"{any}\"", .{expr_type}, tuple_decl.expr.index);
+                        return Error.MismatchedTypes;
+                    },
+                }
+                return .void;
             },
             .var_decl => |*var_decl| {
+                if (var_decl.symbol.constant) {
+                    switch (var_decl.expr.data) {
+                        .int_constant, .boolean_constant => var_decl.symbol.constant_value = var_decl.expr,
+                        else => {},
+                    }
+                }
                 const void_type: types.Type = .void;
                 const void_array: types.Type = .{ .array = .{ .base = @constCast(&void_type) } };
                 if (var_decl.symbol.decl_type) |*decl_type| {
+                    if (isFixedLiteral(decl_type, var_decl.expr)) {
+                        try self.checkFixedLiteral(decl_type, var_decl.expr);
+                        return .void;
+                    }
                     var expr_type = try self.typeCheck(var_decl.expr);
                     if (expr_type.equal(&void_array)) {
                         return .void;
@@ -263,8 +543,12 @@ pub const Pass = struct {
                 return .void;
             },
             .var_assign => |*var_assign| {
-                var expr_type = try self.typeCheck(var_assign.expr);
                 const ident_type = &node.symbol_decl.?.decl_type.?;
+                if (isFixedLiteral(ident_type, var_assign.expr)) {
+                    try self.checkFixedLiteral(ident_type, var_assign.expr);
+                    return .void;
+                }
+                var expr_type = try self.typeCheck(var_assign.expr);
                 if (!expr_type.equal(ident_type)) {
                     try self.err_ctx.newError(.mismatched_types, "Expected type \"{any}\" in variable declaration expression, found type \"{any}\"", .{ ident_type, expr_type }, var_assign.expr.index);
                     return Error.MismatchedTypes;
@@ -293,26 +577,81 @@ pub const Pass = struct {
                 _ = try self.typeCheck(for_loop.body);
                 return .void;
             },
+            .for_each => |*for_each| {
+                const int_type: types.Type = .int;
+                const iterable_type = try self.typeCheck(for_each.iterable);
+                if (for_each.range_end) |range_end| {
+                    const end_type = try self.typeCheck(range_end);
+                    if (!iterable_type.equal(&int_type) or !end_type.equal(&int_type)) {
+                        try self.err_ctx.newError(.mismatched_types, "Expected integer bounds in range, found types {any} and {any}", .{ iterable_type, end_type }, for_each.iterable.index);
+                        return Error.MismatchedTypes;
+                    }
+                    for_each.symbol.decl_type = .int;
+                } else {
+                    const base = iterable_type.elementType() orelse {
+                        try self.err_ctx.newError(.mismatched_types, "Expected array or range in for loop, found type {any}", .{iterable_type}, for_each.iterable.index);
+                        return Error.MismatchedTypes;
+                    };
+                    for_each.symbol.decl_type = base.*;
+                }
+                _ = try self.typeCheck(for_each.body);
+                return .void;
+            },
             .array_set => |*array_set| {
-                const const_array_type: types.Type = .{ .array = undefined };
                 const const_int_type: types.Type = .int;
                 const array_type = try self.typeCheck(array_set.array);
                 const index_type = try self.typeCheck(array_set.index);
                 const expr_type = try self.typeCheck(array_set.expr);
-                if (@intFromEnum(array_type) != @intFromEnum(const_array_type)) { // don't want deep check
-                    try self.err_ctx.newError(.mismatched_types, "Expected array type on left of array set, found type {any}", .{array_type}, array_set.expr.index);
+                if (array_type == .matrix) {
+                    try self.checkMatrixIndex(array_set.index, array_set.column, node.index);
+                    if (!expr_type.equal(&const_int_type)) {
+                        try self.err_ctx.newError(.mismatched_types, "Expected type \"int\" on right side of matrix set, found type {any}", .{expr_type}, array_set.expr.index);
+                        return Error.MismatchedTypes;
+                    }
+                    return .void;
+                }
+                if (array_set.column != null) {
+                    try self.err_ctx.newError(.mismatched_types, "Expected matrix type on left of two dimensional array set, found type {any}", .{array_type}, array_set.expr.index);
                     return Error.MismatchedTypes;
                 }
+                if (array_type == .bytes) {
+                    if (!index_type.equal(&const_int_type) or !expr_type.equal(&const_int_type)) {
+                        try self.err_ctx.newError(.mismatched_types, "Expected integer index and value in bytes set, found types {any} and {any}", .{ index_type, expr_type }, array_set.expr.index);
+                        return Error.MismatchedTypes;
+                    }
+                    array_set.bytes = true;
+                    return .void;
+                }
+                const base = array_type.elementType() orelse {
+                    try self.err_ctx.newError(.mismatched_types, "Expected array type on left of array set, found type {any}", .{array_type}, array_set.expr.index);
+                    return Error.MismatchedTypes;
+                };
                 if (!index_type.equal(&const_int_type)) {
                     try self.err_ctx.newError(.mismatched_types, "Expected integer type as index, found type {any}", .{index_type}, array_set.index.index);
                     return Error.MismatchedTypes;
                 }
-                if (!array_type.array.base.equal(&expr_type)) {
-                    try self.err_ctx.newError(.mismatched_types, "Expected type \"{any}\" on right side of array set, found type {any}", .{ array_type.array.base, expr_type }, array_set.expr.index);
+                try self.checkConstantIndex(array_type, array_set.index);
+                if (!base.equal(&expr_type)) {
+                    try self.err_ctx.newError(.mismatched_types, "Expected type \"{any}\" on right side of array set, found type {any}", .{ base.*, expr_type }, array_set.expr.index);
+                    return Error.MismatchedTypes;
+                }
+                return .void;
+            },
+            .field_set => |*field_set| {
+                const record_type = try self.typeCheck(field_set.record);
+                const field = try self.findField(record_type, field_set.name, field_set.name_id, node.index);
+                field_set.index = @intCast(field.index);
+                const expr_type = try self.typeCheck(field_set.expr);
+                if (!expr_type.equal(field.field_type)) {
+                    try self.err_ctx.newError(.mismatched_types, "Expected type \"{any}\" on right side of field set, found type {any}", .{ field.field_type.*, expr_type }, field_set.expr.index);
                     return Error.MismatchedTypes;
                 }
                 return .void;
             },
+            .match_stmt => |*match_stmt| {
+                try self.checkMatch(match_stmt);
+                return .void;
+            },
             .if_stmt => |*if_stmt| {
                 const expr_type = try self.typeCheck(if_stmt.expr);
                 const bool_type: types.Type = .boolean;
@@ -327,7 +666,7 @@ pub const Pass = struct {
                 return .void;
             },
             .return_stmt => |*ret| {
-                const ret_type: types.Type = if (ret.expr) |expr| try self.typeCheck(expr) else .void;
+                const ret_type: types.Type = if (ret.expr) |expr| try self.checkNode(expr) else .void;
                 const func_ret_type = self.func_stack.head.?.data.function.ret;
                 if (!ret_type.equal(func_ret_type)) {
                     try self.err_ctx.newError(.mismatched_types, "Expected type \"{any}\" in function return statement, found type \"{any}\"", .{ func_ret_type, ret_type }, node.index);
@@ -335,13 +674,87 @@ pub const Pass = struct {
                 }
                 return .void;
             },
+            .loop_kernel => unreachable, // created after this pass
+        }
+    }
+
+    /// Memoized functions are only called once per set of arguments, so they
+    /// have to be pure and their arguments and result hashable
+    fn checkMemo(self: *Pass, node: *ast.Node) Error!void {
+        const func = &node.data.function_value;
+        for (func.args.items) |*arg| {
+            if (!arg.decl_type.?.isHashable()) {
+                try self.err_ctx.newError(.mismatched_types, "Expected int, bool or string arguments in memo function, found type \"{any}\"", .{arg.decl_type.?}, node.index);
+                return Error.MismatchedTypes;
+            }
+            // The arguments are read again as the key once the result is known
+            if (loop.assigns(func.body, arg)) {
+                try self.err_ctx.newError(.impure_function, "Memo function arguments can't be assigned, found assignment to \"{s}\"", .{arg.name}, node.index);
+                return Error.ImpureFunction;
+            }
+        }
+        if (!func.ret_type.isHashable()) {
+            try self.err_ctx.newError(.mismatched_types, "Expected int, bool or string return type in memo function, found type \"{any}\"", .{func.ret_type}, node.index);
+            return Error.MismatchedTypes;
+        }
+
+        var check = PurityCheck{ .allocator = self.allocator };
+        try check.visited.put(self.allocator, node, {});
+        if (!check.visit(node)) {
+            if (check.failure) |failure| {
+                return failure;
+            }
+            const call = check.impure.?;
+            const name = for (builtin.lookup.kvs) |pair| {
+                if (pair.value.id == call.data.builtin_call.idx) {
+                    break pair.key;
+                }
+            } else unreachable;
+            try self.err_ctx.newError(.impure_function, "Memo functions must be pure, found call to \"{s}\"", .{name}, call.index);
+            return Error.ImpureFunction;
+        }
+    }
+
+    /// Sets the type of the function from its declaration, the body doesn't
+    /// have to be checked for calls to it to be checked
+    pub fn checkSignature(self: *Pass, node: *ast.Node) Error!void {
+        const func = &node.data.function_value;
+        const arg_types = try self.allocator.alloc(*types.Type, func.args.items.len);
+        for (func.args.items, arg_types) |arg, *arg_type| {
+            arg_type.* = try self.type_table.intern(arg.decl_type.?);
+        }
+
+        const ret = try self.type_table.intern(func.ret_type);
+
+        func.func_type = types.Type{
+            .function = .{
+                .args = arg_types,
+                .ret = ret,
+            },
+        };
+
+        if (func.memo) {
+            try self.checkMemo(node);
         }
     }
 
+    pub fn checkBody(self: *Pass, node: *ast.Node) Error!void {
+        const func = &node.data.function_value;
+        _ = try self.func_stack.push(self.allocator, func.func_type);
+
+        _ = try self.typeCheck(func.body);
+
+        _ = self.func_stack.pop();
+    }
+
+    fn contains(maybe_set: ?*const ast.NodeSet, node: *ast.Node) bool {
+        const set = maybe_set orelse return false;
+        return set.contains(node);
+    }
+
     /// Made this its own function because it's long
     pub fn checkUnary(self: *Pass, node: *ast.Node) Error!types.Type {
         const unary = &node.data.unary_op;
-        const expr_type = try self.typeCheck(unary.expr);
         switch (unary.op) {
             .call => |call| {
                 var arg_types = std.ArrayListUnmanaged(types.Type){};
@@ -350,15 +763,22 @@ pub const Pass = struct {
                     try arg_types.append(self.allocator, try self.typeCheck(expr));
                 }
 
+                // Arguments pick the instance of a generic function, so they
+                // are checked before the function
+                if (genericCallee(unary.expr)) |generic| {
+                    unary.expr.symbol_decl = try self.instantiate(node, generic, arg_types.items);
+                }
+
+                const expr_type = try self.typeCheck(unary.expr);
                 switch (expr_type) {
                     .function => |func| {
-                        if (func.args.items.len != arg_types.items.len) {
-                            try self.err_ctx.newError(.mismatched_types, "Expected {d} arguments to function call, found {d}", .{ func.args.items.len, arg_types.items.len }, node.index);
+                        if (func.args.len != arg_types.items.len) {
+                            try self.err_ctx.newError(.mismatched_types, "Expected {d} arguments to function call, found {d}", .{ func.args.len, arg_types.items.len }, node.index);
                             return Error.MismatchedTypes;
                         }
-                        for (0..func.args.items.len) |i| {
-                            if (!func.args.items[i].equal(&arg_types.items[i])) {
-                                try self.err_ctx.newError(.mismatched_types, "Expected type \"{any}\" in function call argument number {d}, found {any}", .{ func.args.items[i], i, arg_types.items[i] }, node.index);
+                        for (0..func.args.len) |i| {
+                            if (!func.args[i].equal(&arg_types.items[i])) {
+                                try self.err_ctx.newError(.mismatched_types, "Expected type \"{any}\" in function call argument number {d}, found {any}", .{ func.args[i].*, i, arg_types.items[i] }, node.index);
                                 return Error.MismatchedTypes;
                             }
                         }
@@ -371,20 +791,336 @@ pub const Pass = struct {
                 }
             },
             .index => |*index| {
-                const array_type: types.Type = .{ .array = undefined };
+                const expr_type = try self.typeCheck(unary.expr);
                 const int_type: types.Type = .int;
-                if (@intFromEnum(expr_type) != @intFromEnum(array_type)) { // don't want deep check
-                    try self.err_ctx.newError(.mismatched_types, "Expected array type on left of indexing, found type {any}", .{expr_type}, node.index);
+                if (expr_type == .matrix) {
+                    try self.checkMatrixIndex(index.index, index.column, node.index);
+                    return .int;
+                }
+                if (index.column != null) {
+                    try self.err_ctx.newError(.mismatched_types, "Expected matrix type on left of two dimensional indexing, found type {any}", .{expr_type}, node.index);
                     return Error.MismatchedTypes;
                 }
+                if (expr_type == .bytes) {
+                    const index_type = try self.typeCheck(index.index);
+                    if (!index_type.equal(&int_type)) {
+                        try self.err_ctx.newError(.mismatched_types, "Expected integer type as index, found type {any}", .{index_type}, node.index);
+                        return Error.MismatchedTypes;
+                    }
+                    index.bytes = true;
+                    return .int;
+                }
+                const base = expr_type.elementType() orelse {
+                    try self.err_ctx.newError(.mismatched_types, "Expected array type on left of indexing, found type {any}", .{expr_type}, node.index);
+                    return Error.MismatchedTypes;
+                };
                 const index_type = try self.typeCheck(index.index);
                 if (!index_type.equal(&int_type)) {
                     try self.err_ctx.newError(.mismatched_types, "Expected integer type as index, found type {any}", .{index_type}, node.index);
                     return Error.MismatchedTypes;
                 }
-                return expr_type.array.base.*;
+                try self.checkConstantIndex(expr_type, index.index);
+                return base.*;
+            },
+            .field => |*field_op| {
+                const expr_type = try self.typeCheck(unary.expr);
+                const field = try self.findField(expr_type, field_op.name, field_op.name_id, node.index);
+                field_op.index = @intCast(field.index);
+                return field.field_type.*;
             },
             else => unreachable,
         }
     }
+
+    /// Generic function a call goes to, null for every other callee
+    fn genericCallee(callee: *ast.Node) ?*ast.Node {
+        switch (callee.data) {
+            .var_get => {},
+            else => return null,
+        }
+        const func = callee.symbol_decl.?.function_decl orelse return null;
+        return if (func.data.function_value.type_params.len > 0) func else null;
+    }
+
+    /// Binds the type parameters of a generic function from the argument
+    /// types of a call, then returns the declaration of the instance for
+    /// those bindings. Instances are created and checked on first use, each
+    /// is generated as its own fully typed function.
+    fn instantiate(self: *Pass, call: *ast.Node, generic: *ast.Node, arg_types: []const types.Type) Error!*ast.SymbolDecl {
+        const func = &generic.data.function_value;
+        if (func.args.items.len != arg_types.len) {
+            try self.err_ctx.newError(.mismatched_types, "Expected {d} arguments to function call, found {d}", .{ func.args.items.len, arg_types.len }, call.index);
+            return Error.MismatchedTypes;
+        }
+
+        const bound = try self.allocator.alloc(?types.Type, func.type_params.len);
+        @memset(bound, null);
+        for (func.args.items, arg_types, 0..) |arg, arg_type, i| {
+            if (!bindParams(arg.decl_type.?, arg_type, bound)) {
+                try self.err_ctx.newError(.mismatched_types, "Expected type \"{any}\" in function call argument number {d}, found {any}", .{ arg.decl_type.?, i, arg_type }, call.index);
+                return Error.MismatchedTypes;
+            }
+        }
+        const bindings = try self.allocator.alloc(types.Type, bound.len);
+        for (bound, bindings, func.type_params) |maybe_type, *binding, name| {
+            binding.* = maybe_type orelse {
+                try self.err_ctx.newError(.mismatched_types, "Failed to infer type parameter \"{s}\" from the arguments", .{name}, call.index);
+                return Error.MismatchedTypes;
+            };
+        }
+
+        for (func.instances.items) |instance| {
+            for (instance.bindings, bindings) |lhs, rhs| {
+                if (!lhs.equal(&rhs)) {
+                    break;
+                }
+            } else return instance.decl;
+        }
+
+        const node = try ast.instantiate(self.allocator, self.type_table, generic, bindings);
+        const decl = try self.allocator.create(ast.SymbolDecl);
+        decl.* = ast.SymbolDecl{ .name = func.name.?, .name_id = func.name_id, .function_decl = node };
+        // Added before checking so recursive calls find the instance
+        try func.instances.append(self.allocator, .{ .bindings = bindings, .node = node, .decl = decl });
+        _ = try self.typeCheck(node);
+        return decl;
+    }
+
+    /// Matches a parameter type against an argument type, binding the type
+    /// parameters it contains. False if a parameter would have to be bound
+    /// to two different types or the shapes don't match.
+    fn bindParams(param_type: types.Type, arg_type: types.Type, bound: []?types.Type) bool {
+        switch (param_type) {
+            .param => |param| {
+                if (bound[param.index]) |existing| {
+                    return existing.equal(&arg_type);
+                }
+                bound[param.index] = arg_type;
+                return true;
+            },
+            .array => |array| return arg_type == .array and bindParams(array.base.*, arg_type.array.base.*, bound),
+            .fixed_array => |fixed| return arg_type == .fixed_array and fixed.len == arg_type.fixed_array.len and bindParams(fixed.base.*, arg_type.fixed_array.base.*, bound),
+            .map => |map| return arg_type == .map and bindParams(map.key.*, arg_type.map.key.*, bound) and bindParams(map.value.*, arg_type.map.value.*, bound),
+            .set => |set| return arg_type == .set and bindParams(set.item.*, arg_type.set.item.*, bound),
+            .pqueue => |queue| return arg_type == .pqueue and bindParams(queue.item.*, arg_type.pqueue.item.*, bound),
+            .function => |param_func| {
+                if (arg_type != .function) {
+                    return false;
+                }
+                const arg_func = arg_type.function;
+                if (param_func.args.len != arg_func.args.len) {
+                    return false;
+                }
+                for (param_func.args, arg_func.args) |param_arg, arg| {
+                    if (!bindParams(param_arg.*, arg.*, bound)) {
+                        return false;
+                    }
+                }
+                return bindParams(param_func.ret.*, arg_func.ret.*, bound);
+            },
+            // Everything else has to match exactly, which the call checks
+            // once the parameters are replaced
+            else => return true,
+        }
+    }
+
+    /// Array literals assigned to fixed arrays take on the fixed type, as long
+    /// as they have the right amount of items
+    fn isFixedLiteral(target_type: *const types.Type, expr: *ast.Node) bool {
+        return target_type.* == .fixed_array and expr.data == .array_init;
+    }
+
+    fn checkFixedLiteral(self: *Pass, fixed_type: *const types.Type, expr: *ast.Node) Error!void {
+        const fixed = fixed_type.fixed_array;
+        const items = expr.data.array_init.items.items;
+        if (items.len != fixed.len) {
+            try self.err_ctx.newError(.mismatched_types, "Expected {d} items in initialization of \"{any}\", found {d}", .{ fixed.len, fixed_type.*, items.len }, expr.index);
+            return Error.MismatchedTypes;
+        }
+        for (items) |item| {
+            const item_type = try self.typeCheck(item);
+            if (!item_type.equal(fixed.base)) {
+                try self.err_ctx.newError(.mismatched_types, "Expected type \"{any}\" in array initialization, found type \"{any}\"", .{ fixed.base.*, item_type }, item.index);
+                return Error.MismatchedTypes;
+            }
+        }
+    }
+
+    /// Constant indices into fixed arrays are bounds checked here instead of
+    /// at runtime
+    fn checkConstantIndex(self: *Pass, array_type: types.Type, index: *ast.Node) Error!void {
+        const fixed = switch (array_type) {
+            .fixed_array => |fixed| fixed,
+            else => return,
+        };
+        const constant = switch (index.data) {
+            .int_constant => |constant| constant.value,
+            else => return,
+        };
+        if (constant < 0 or constant >= fixed.len) {
+            try self.err_ctx.newError(.index_out_of_bounds, "Index {d} is out of bounds for type \"{any}\"", .{ constant, array_type }, index.index);
+            return Error.IndexOutOfBounds;
+        }
+    }
+
+    /// Match statements dispatch on int or string constants, every value can
+    /// only appear in a single case
+    fn checkMatch(self: *Pass, match_stmt: *ast.Node.MatchStatement) Error!void {
+        const expr_type = try self.typeCheck(match_stmt.expr);
+        switch (expr_type) {
+            .int, .string => {},
+            else => {
+                try self.err_ctx.newError(.mismatched_types, "Expected int or string in match expression, found type \"{any}\"", .{expr_type}, match_stmt.expr.index);
+                return Error.MismatchedTypes;
+            },
+        }
+
+        var ints = std.AutoHashMapUnmanaged(i64, void){};
+        defer ints.deinit(self.allocator);
+        var strings = std.StringHashMapUnmanaged(void){};
+        defer strings.deinit(self.allocator);
+
+        for (match_stmt.cases.items) |*case| {
+            for (case.values.items) |case_value| {
+                // Checked first so that reads of int constants are already
+                // replaced with their value
+                const value_type = try self.typeCheck(case_value);
+                const duplicate = switch (case_value.data) {
+                    .int_constant => |constant| expr_type == .int and (try ints.fetchPut(self.allocator, constant.value, {})) != null,
+                    .string_constant => |constant| expr_type == .string and (try strings.fetchPut(self.allocator, constant.raw, {})) != null,
+                    else => {
+                        try self.err_ctx.newError(.mismatched_types, "Expected constant of type \"{any}\" in match case", .{expr_type}, case_value.index);
+                        return Error.MismatchedTypes;
+                    },
+                };
+                if (!value_type.equal(&expr_type)) {
+                    try self.err_ctx.newError(.mismatched_types, "Expected constant of type \"{any}\" in match case, found type \"{any}\"", .{ expr_type, value_type }, case_value.index);
+                    return Error.MismatchedTypes;
+                }
+                if (duplicate) {
+                    try self.err_ctx.newError(.duplicate_case, "Found value matched by more than one case", .{}, case_value.index);
+                    return Error.DuplicateCase;
+                }
+            }
+            _ = try self.typeCheck(case.body);
+        }
+        if (match_stmt.else_body) |else_body| {
+            _ = try self.typeCheck(else_body);
+        }
+    }
+
+    /// Matrices are always indexed by both a row and a column
+    fn checkMatrixIndex(self: *Pass, row: *ast.Node, column: ?*ast.Node, index: usize) Error!void {
+        const int_type: types.Type = .int;
+        const col = column orelse {
+            try self.err_ctx.newError(.mismatched_types, "Expected row and column to index matrix", .{}, index);
+            return Error.MismatchedTypes;
+        };
+        for ([_]*ast.Node{ row, col }) |item| {
+            const item_type = try self.typeCheck(item);
+            if (!item_type.equal(&int_type)) {
+                try self.err_ctx.newError(.mismatched_types, "Expected integer type as index, found type {any}", .{item_type}, item.index);
+                return Error.MismatchedTypes;
+            }
+        }
+    }
+
+    /// Priority queues are ordered by their comparator, which can only be
+    /// left out for integers
+    fn checkContainerInit(self: *Pass, node: *ast.Node) Error!types.Type {
+        const container = &node.data.container_init;
+        const queue = switch (container.container_type) {
+            .pqueue => |queue| queue,
+            else => return container.container_type,
+        };
+        const comparator = container.comparator orelse {
+            if (queue.item.* != .int) {
+                try self.err_ctx.newError(.mismatched_types, "Expected comparator for priority queue of type \"{any}\"", .{container.container_type}, node.index);
+                return Error.MismatchedTypes;
+            }
+            return container.container_type;
+        };
+
+        const bool_type = try self.type_table.intern(.boolean);
+        const arg_types = try self.allocator.alloc(*types.Type, 2);
+        @memset(arg_types, queue.item);
+        const expected = types.Type{ .function = .{ .args = arg_types, .ret = bool_type } };
+        const comparator_type = try self.typeCheck(comparator);
+        if (!comparator_type.equal(&expected)) {
+            try self.err_ctx.newError(.mismatched_types, "Expected comparator of type \"{any}\", found type \"{any}\"", .{ expected, comparator_type }, comparator.index);
+            return Error.MismatchedTypes;
+        }
+        return container.container_type;
+    }
+
+    /// Map and set builtins, the argument and return types follow from the
+    /// container passed first
+    fn checkContainerCall(self: *Pass, node: *ast.Node, signature: builtin.ContainerSignature) Error!types.Type {
+        const call = &node.data.builtin_call;
+        const container_type = try self.typeCheck(call.args[0]);
+        var maybe_key: ?*types.Type = null;
+        var value_type: ?*types.Type = null;
+        switch (container_type) {
+            .map => |map| {
+                if (signature.map) {
+                    maybe_key = map.key;
+                    value_type = map.value;
+                }
+            },
+            .set => |set| {
+                if (signature.set) {
+                    maybe_key = set.item;
+                }
+            },
+            .pqueue => |queue| {
+                if (signature.pqueue) {
+                    maybe_key = queue.item;
+                }
+            },
+            else => {},
+        }
+        const key_type = maybe_key orelse {
+            const expected = if (signature.pqueue) "priority queue" else if (!signature.map) "set" else if (!signature.set) "map" else "map or set";
+            try self.err_ctx.newError(.mismatched_types, "Expected {s} in builtin function call, found type \"{any}\"", .{ expected, container_type }, call.args[0].index);
+            return Error.MismatchedTypes;
+        };
+
+        for (signature.args, call.args[1..]) |expected, arg| {
+            const expected_type = switch (expected) {
+                .key => key_type,
+                .value => value_type.?,
+                else => unreachable,
+            };
+            const arg_type = try self.typeCheck(arg);
+            if (!arg_type.equal(expected_type)) {
+                try self.err_ctx.newError(.mismatched_types, "Expected type \"{any}\" in builtin function call, found type \"{any}\"", .{ expected_type.*, arg_type }, arg.index);
+                return Error.MismatchedTypes;
+            }
+        }
+
+        return switch (signature.ret) {
+            .key => key_type.*,
+            .value => value_type.?.*,
+            .key_array => types.Type{ .array = .{ .base = key_type } },
+            .boolean => .boolean,
+            .void => .void,
+        };
+    }
+
+    /// Resolves a field of a struct type to its offset
+    fn findField(self: *Pass, record_type: types.Type, name: []const u8, name_id: lexer.NameId, index: usize) Error!struct { index: usize, field_type: *const types.Type } {
+        switch (record_type) {
+            .structure => |structure| {
+                const field_index = structure.fieldIndex(name_id) orelse {
+                    try self.err_ctx.newError(.mismatched_types, "Struct \"{s}\" has no field \"{s}\"", .{ structure.name, name }, index);
+                    return Error.MismatchedTypes;
+                };
+                return .{ .index = field_index, .field_type = &structure.fields[field_index].field_type };
+            },
+            else => {
+                try self.err_ctx.newError(.mismatched_types, "Expected struct type on left of field access, found type {any}", .{record_type}, index);
+                return Error.MismatchedTypes;
+            },
+        }
+    }
 };
@@ -1,4 +1,5 @@
 const std = @import("std");
+const lexer = @import("lexer.zig");
 
 pub const Type = union(enum) {
     void,
@@ -6,9 +7,22 @@ pub const Type = union(enum) {
     boolean,
     string,
     array: struct { base: *Type },
-    function: struct { args: std.ArrayListUnmanaged(Type) = std.ArrayListUnmanaged(Type){}, ret: *Type },
+    fixed_array: struct { base: *Type, len: usize }, // same runtime array, but the length can't change
+    function: struct { args: []const *Type = &.{}, ret: *Type }, // argument and return types are interned
+    tuple: struct { items: []const *Type }, // interned items, only returned, destructured or discarded, never stored
+    structure: *Struct,
+    map: struct { key: *Type, value: *Type },
+    set: struct { item: *Type },
+    pqueue: struct { item: *Type },
+    matrix, // dense int matrix
+    bytes, // mutable byte buffer
+    param: struct { index: usize, name: []const u8 }, // type parameter of a generic function, replaced in every instance
 
     pub fn equal(self: *const Type, other: *const Type) bool {
+        // Interned types are only stored once
+        if (self == other) {
+            return true;
+        }
         if (@intFromEnum(self.*) != @intFromEnum(other.*)) {
             return false;
         }
@@ -20,25 +34,101 @@ pub const Type = union(enum) {
                     else => return false,
                 }
             },
+            .fixed_array => |fixed| return fixed.len == other.fixed_array.len and fixed.base.equal(other.fixed_array.base),
+            // Interned inner types are equal only if they are the same pointer
             .function => |self_func| {
                 const other_func = other.function;
-                if (self_func.args.items.len != other_func.args.items.len) {
-                    return false;
-                }
-                if (!self_func.ret.equal(other_func.ret)) {
-                    return false;
-                }
-                for (0..self_func.args.items.len) |i| {
-                    if (!self_func.args.items[i].equal(&other_func.args.items[i])) {
-                        return false;
-                    }
-                }
-                return true;
+                return self_func.ret == other_func.ret and std.mem.eql(*Type, self_func.args, other_func.args);
             },
+            .tuple => |self_tuple| return std.mem.eql(*Type, self_tuple.items, other.tuple.items),
+            .structure => |structure| return structure == other.structure,
+            .map => |map| return map.key.equal(other.map.key) and map.value.equal(other.map.value),
+            .set => |set| return set.item.equal(other.set.item),
+            .pqueue => |queue| return queue.item.equal(other.pqueue.item),
+            .param => |param| return param.index == other.param.index,
             else => return true,
         }
     }
 
+    /// Structural hash, consistent with equal. Interned inner types are
+    /// hashed by address.
+    pub fn hash(self: *const Type, hasher: *std.hash.Wyhash) void {
+        const tag = @intFromEnum(self.*);
+        hasher.update(std.mem.asBytes(&tag));
+        switch (self.*) {
+            .array => |array| array.base.hash(hasher),
+            .fixed_array => |fixed| {
+                hasher.update(std.mem.asBytes(&fixed.len));
+                fixed.base.hash(hasher);
+            },
+            .function => |func| {
+                hasher.update(std.mem.sliceAsBytes(func.args));
+                hasher.update(std.mem.asBytes(&func.ret));
+            },
+            .tuple => |tuple| hasher.update(std.mem.sliceAsBytes(tuple.items)),
+            .structure => |structure| hasher.update(std.mem.asBytes(&structure)),
+            .map => |map| {
+                map.key.hash(hasher);
+                map.value.hash(hasher);
+            },
+            .set => |set| set.item.hash(hasher),
+            .pqueue => |queue| queue.item.hash(hasher),
+            .param => |param| hasher.update(std.mem.asBytes(&param.index)),
+            else => {},
+        }
+    }
+
+    /// Item type of growable and fixed arrays
+    pub fn elementType(self: *const Type) ?*Type {
+        return switch (self.*) {
+            .array => |array| array.base,
+            .fixed_array => |fixed| fixed.base,
+            else => null,
+        };
+    }
+
+    /// Replaces the type parameters of a generic function with the types they
+    /// are bound to in an instance, inner types are stored in the table
+    pub fn substitute(self: Type, table: *TypeTable, allocator: std.mem.Allocator, bindings: []const Type) std.mem.Allocator.Error!Type {
+        switch (self) {
+            .param => |param| return bindings[param.index],
+            .array => |array| return Type{ .array = .{ .base = try substitutePtr(array.base, table, allocator, bindings) } },
+            .fixed_array => |fixed| return Type{ .fixed_array = .{ .base = try substitutePtr(fixed.base, table, allocator, bindings), .len = fixed.len } },
+            .function => |func| return Type{ .function = .{
+                .args = try substituteList(func.args, table, allocator, bindings),
+                .ret = try substitutePtr(func.ret, table, allocator, bindings),
+            } },
+            .tuple => |tuple| return Type{ .tuple = .{ .items = try substituteList(tuple.items, table, allocator, bindings) } },
+            .map => |map| return Type{ .map = .{
+                .key = try substitutePtr(map.key, table, allocator, bindings),
+                .value = try substitutePtr(map.value, table, allocator, bindings),
+            } },
+            .set => |set| return Type{ .set = .{ .item = try substitutePtr(set.item, table, allocator, bindings) } },
+            .pqueue => |queue| return Type{ .pqueue = .{ .item = try substitutePtr(queue.item, table, allocator, bindings) } },
+            else => return self,
+        }
+    }
+
+    fn substitutePtr(inner: *const Type, table: *TypeTable, allocator: std.mem.Allocator, bindings: []const Type) std.mem.Allocator.Error!*Type {
+        return table.intern(try inner.substitute(table, allocator, bindings));
+    }
+
+    fn substituteList(list: []const *Type, table: *TypeTable, allocator: std.mem.Allocator, bindings: []const Type) std.mem.Allocator.Error![]const *Type {
+        const substituted = try allocator.alloc(*Type, list.len);
+        for (list, substituted) |inner, *item| {
+            item.* = try substitutePtr(inner, table, allocator, bindings);
+        }
+        return substituted;
+    }
+
+    /// Types that can be used as memoization keys and cached results
+    pub fn isHashable(self: *const Type) bool {
+        return switch (self.*) {
+            .int, .boolean, .string => true,
+            else => false,
+        };
+    }
+
     pub fn format(self: Type, comptime fmt: []const u8, options: std.fmt.FormatOptions, writer: anytype) !void {
         _ = fmt;
         _ = options;
@@ -48,17 +138,123 @@ pub const Type = union(enum) {
             .int => try writer.writeAll("int"),
             .string => try writer.writeAll("string"),
             .array => |base| try writer.print("[{any}]", base),
+            .fixed_array => |fixed| try writer.print("[{any}; {d}]", .{ fixed.base.*, fixed.len }),
             .function => |func| {
                 try writer.writeAll("fn (");
-                for (0..func.args.items.len) |i| {
-                    try writer.print("{any}", .{func.args.items[i]});
-                    if (i < func.args.items.len - 1) {
+                for (0..func.args.len) |i| {
+                    try writer.print("{any}", .{func.args[i].*});
+                    if (i < func.args.len - 1) {
                         try writer.writeAll(", ");
                     }
                 }
-                try writer.print(") -> {any}", .{func.ret});
+                try writer.print(") -> {any}", .{func.ret.*});
             },
+            .tuple => |tuple| {
+                try writer.writeByte('(');
+                for (0..tuple.items.len) |i| {
+                    try writer.print("{any}", .{tuple.items[i].*});
+                    if (i < tuple.items.len - 1) {
+                        try writer.writeAll(", ");
+                    }
+                }
+                try writer.writeByte(')');
+            },
+            .structure => |structure| try writer.writeAll(structure.name),
+            .map => |map| try writer.print("map[{any}]{any}", .{ map.key.*, map.value.* }),
+            .set => |set| try writer.print("set[{any}]", .{set.item.*}),
+            .pqueue => |queue| try writer.print("pqueue[{any}]", .{queue.item.*}),
+            .matrix => try writer.writeAll("matrix"),
+            .bytes => try writer.writeAll("bytes"),
+            .param => |param| try writer.writeAll(param.name),
+        }
+    }
+};
+
+/// Storage for the inner types of composite types, every distinct type is
+/// stored once. Composite types built from the table share their inner
+/// pointers, so comparing them stops at a pointer compare instead of
+/// recursing through both types.
+pub const TypeTable = struct {
+    interned: std.HashMapUnmanaged(*Type, void, Context, std.hash_map.default_max_load_percentage) = .{},
+    arena: std.heap.ArenaAllocator, // owns the map and the stored types, only used while holding the mutex
+    mutex: std.Thread.Mutex = .{}, // function bodies can be type checked in parallel
+
+    pub fn init(allocator: std.mem.Allocator) TypeTable {
+        return TypeTable{ .arena = std.heap.ArenaAllocator.init(allocator) };
+    }
+
+    pub fn deinit(self: *TypeTable) void {
+        self.arena.deinit();
+    }
+
+    const Context = struct {
+        pub fn hash(_: Context, key: *Type) u64 {
+            return hashType(key);
+        }
+
+        pub fn eql(_: Context, lhs: *Type, rhs: *Type) bool {
+            return lhs.equal(rhs);
+        }
+    };
+
+    /// Looks up types by value so nothing is allocated when they are found
+    const Adapter = struct {
+        pub fn hash(_: Adapter, key: Type) u64 {
+            return hashType(&key);
+        }
+
+        pub fn eql(_: Adapter, lhs: Type, rhs: *Type) bool {
+            return lhs.equal(rhs);
+        }
+    };
+
+    fn hashType(key: *const Type) u64 {
+        var hasher = std.hash.Wyhash.init(0);
+        key.hash(&hasher);
+        return hasher.final();
+    }
+
+    /// The single stored copy of the type, the returned type must not be
+    /// changed as it is shared. Inner types of the key are expected to be
+    /// interned already, its argument and item lists are copied.
+    pub fn intern(self: *TypeTable, key: Type) std.mem.Allocator.Error!*Type {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+        const allocator = self.arena.allocator();
+        const entry = try self.interned.getOrPutAdapted(allocator, key, Adapter{});
+        if (!entry.found_existing) {
+            errdefer self.interned.removeByPtr(entry.key_ptr);
+            const stored = try allocator.create(Type);
+            stored.* = switch (key) {
+                .function => |func| Type{ .function = .{ .args = try allocator.dupe(*Type, func.args), .ret = func.ret } },
+                .tuple => |tuple| Type{ .tuple = .{ .items = try allocator.dupe(*Type, tuple.items) } },
+                else => key,
+            };
+            entry.key_ptr.* = stored;
+        }
+        return entry.key_ptr.*;
+    }
+};
+
+/// Declared record type, two struct types are only equal if they are the
+/// same declaration
+pub const Struct = struct {
+    name: []const u8,
+    fields: []Field,
+
+    pub const Field = struct {
+        name: []const u8,
+        name_id: lexer.NameId, // fields are looked up by id, the name is kept for errors
+        field_type: Type,
+    };
+
+    pub fn fieldIndex(self: *const Struct, name_id: lexer.NameId) ?usize {
+        for (self.fields, 0..) |field, i| {
+            if (field.name_id == name_id) {
+                return i;
+            }
         }
+        return null;
     }
 };
 
@@ -68,4 +264,6 @@ pub const builtin_lookup = std.ComptimeStringMap(Type, .{
     .{ "bool", Type.boolean },
     .{ "string", Type.string },
     .{ "void", Type.void },
+    .{ "matrix", Type.matrix },
+    .{ "bytes", Type.bytes },
 });
@@ -3,8 +3,12 @@ const byte = @import("runtime/bytecode.zig");
 const compiler = @import("compiler/compiler.zig");
 const runtime = @import("runtime/runtime.zig");
 
+/// Largest source file that is loaded
+const max_source_size = 1 << 30;
+
 test {
     std.testing.refAllDeclsRecursive(@This());
+    _ = @import("tests.zig");
 }
 
 pub fn main() !void {
@@ -18,6 +22,12 @@ pub fn main() !void {
     }
 
     const filepath: []const u8 = std.mem.span(std.os.argv[1]);
+    var options = compiler.Options{};
+    for (std.os.argv[2..]) |arg| {
+        if (std.mem.eql(u8, std.mem.span(arg), "--parallel")) {
+            options.parallel = true;
+        }
+    }
 
     const file = std.fs.cwd().openFile(filepath, .{}) catch |err| {
         std.debug.print("Failed to load file \"{s}\": {}\n", .{ filepath, err });
@@ -26,10 +36,10 @@ pub fn main() !void {
     defer file.close();
 
     const reader = file.reader();
-    const str = try reader.readAllAlloc(allocator, 0xFFFF);
+    const str = try reader.readAllAlloc(allocator, max_source_size);
     defer allocator.free(str);
 
-    var compile_result = compiler.compile(allocator, str) catch {
+    var compile_result = compiler.compile(allocator, str, options) catch {
         return;
     };
     defer compile_result.deinit(allocator);
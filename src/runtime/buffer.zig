@@ -0,0 +1,71 @@
+//! Mutable byte buffer for binary data. Bytes are stored untagged so the bulk
+//! operations can work on a whole vector of bytes at a time.
+
+const std = @import("std");
+const vm = @import("vm.zig");
+
+/// Bytes compared per step when searching
+const lanes = 16;
+const Lane = @Vector(lanes, u8);
+const LaneMask = std.meta.Int(.unsigned, lanes);
+
+pub const Bytes = struct {
+    items: []u8,
+
+    /// Zeroed buffer
+    pub fn init(allocator: std.mem.Allocator, len: usize) Bytes {
+        const items = allocator.alloc(u8, len) catch |err| {
+            vm.errorHandle(err);
+            unreachable;
+        };
+        @memset(items, 0);
+        return Bytes{ .items = items };
+    }
+
+    pub fn deinit(self: *Bytes, allocator: std.mem.Allocator) void {
+        allocator.free(self.items);
+    }
+
+    pub fn dupe(self: *const Bytes, allocator: std.mem.Allocator) Bytes {
+        return Bytes{
+            .items = allocator.dupe(u8, self.items) catch |err| {
+                vm.errorHandle(err);
+                unreachable;
+            },
+        };
+    }
+
+    pub fn equals(self: *const Bytes, rhs: *const Bytes) bool {
+        return std.mem.eql(u8, self.items, rhs.items);
+    }
+
+    /// First index at or after start holding the byte, null if there is none
+    pub fn find(self: *const Bytes, byte: u8, start: usize) ?usize {
+        const needle: Lane = @splat(byte);
+        var i = start;
+        while (i + lanes <= self.items.len) : (i += lanes) {
+            const chunk: Lane = self.items[i..][0..lanes].*;
+            const matches: LaneMask = @bitCast(chunk == needle);
+            if (matches != 0) {
+                return i + @ctz(matches);
+            }
+        }
+        while (i < self.items.len) : (i += 1) {
+            if (self.items[i] == byte) {
+                return i;
+            }
+        }
+        return null;
+    }
+
+    /// Copies src to the offset, src may be part of this buffer. The caller
+    /// has to check that it fits.
+    pub fn copyFrom(self: *Bytes, offset: usize, src: []const u8) void {
+        const dst = self.items[offset..][0..src.len];
+        if (@intFromPtr(dst.ptr) > @intFromPtr(src.ptr)) {
+            std.mem.copyBackwards(u8, dst, src);
+        } else {
+            std.mem.copyForwards(u8, dst, src);
+        }
+    }
+};
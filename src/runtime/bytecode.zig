@@ -13,7 +13,7 @@ pub const Opcode = enum(u8) {
     DIV, // pops 2 values off of stack, pushes result after dividing them
     MOD, // pops 2 values off of stack, pushes result after modulus
     CALL, // u8 arg count
-    RETURN, // u8 1 if there is a return value, 0 if not
+    RETURN, // u8 amount of return values, moved down to where the call frame started
     CALL_BUILTIN, // u8 builtin function number
     NEGATE, // pops 1 value off of stack, assumes boolean, negates and pushes result
     EQUAL, // pops 2 values off of stack, pushes boolean result after comparing
@@ -23,15 +23,91 @@ pub const Opcode = enum(u8) {
     LESS_EQ, // pops 2 values off of stack, pushes boolean result after comparing
     AND, // pops 2 values off of stack, assumes boolean, pushes boolean after comparing
     OR, // pops 2 values off of stack, assumes boolean, pushes boolean after comparing
-    BRANCH_NEQ, // u8 offset, pops value off of stack, if false then jump to offset, otherwise nothing
-    JUMP, // u8 offset
-    JUMP_BACK, // u8 offset
-    ARRAY_INIT, // u8 item count, pops item count number of items off of stack and pushes initialized array
-    ARRAY_PUSH, // pops two values off of stack, first is array second is item, pushes item to end of array
+    BRANCH_NEQ, // u16 offset, pops value off of stack, if false then jump to offset, otherwise nothing
+    BRANCH_EQ, // u16 offset, pops value off of stack, if true then jump to offset, otherwise nothing
+    BRANCH_EQ_BACK, // u16 offset, pops value off of stack, if true then jump back by offset, otherwise nothing
+    JUMP, // u16 offset
+    JUMP_BACK, // u16 offset
+    ARRAY_INIT, // u32 item count, pops item count number of items off of stack and pushes initialized array, first item is deepest
+    ARRAY_PUSH, // pops two values off of stack, first is item second is array, pushes item to end of array
     ARRAY_GET, // pops two values off of stack, first is array, second is index, pushes indexed value or errors if out of bounds
     ARRAY_SET, // pops three values off of stack, first is array, second is index, third is value, sets index in array to value
+    LENGTH, // pops array or string off of stack, pushes its length
+    RANDOM, // pops two values off of stack, first is max second is min, pushes random integer in the inclusive range
+    ARRAY_KERNEL, // u8 kernel, u8 kernel op for map kernels, pops the kernel operands and trip count, see Kernel
+    MEMO_GET, // u8 arg count, returns the cached result if the function was called with the same arguments before
+    MEMO_PUT, // u8 arg count, caches the value on top of stack as the result for the current arguments
+    STRUCT_INIT, // u8 field count, pops field count number of values off of stack and pushes a struct, first field is deepest
+    FIELD_GET, // u8 field index, pops struct off of stack, pushes the field
+    FIELD_SET, // u8 field index, pops two values off of stack, first is struct second is value, sets the field to value
+    MAP_INIT, // pushes a new empty map
+    SET_INIT, // pushes a new empty set
+    LOCAL_ARRAY_GET, // u8 frame offset, u8 length, pops index off of stack, pushes the item of the fixed array stored at the offset
+    LOCAL_ARRAY_SET, // u8 frame offset, u8 length, pops two values off of stack, first is index second is value, sets the item of the fixed array stored at the offset
+    MATRIX_GET, // pops three values off of stack, first is matrix, second is row, third is column, pushes the item or errors if out of bounds
+    MATRIX_SET, // pops four values off of stack, first is matrix, second is row, third is column, fourth is value, sets the item to value
+    BYTES_GET, // pops two values off of stack, first is bytes, second is index, pushes the byte or errors if out of bounds
+    BYTES_SET, // pops three values off of stack, first is bytes, second is index, third is value, sets the byte to value
+    TO_BYTES, // u8 move, pops string off of stack, pushes bytes with its contents, takes over the buffer of the string if move is 1
+    FROM_BYTES, // u8 move, pops bytes off of stack, pushes string with its contents, takes over the buffer of the bytes if move is 1
+    PQUEUE_INIT, // u8 has comparator, pops the comparator function off of stack if there is one, pushes a new empty priority queue
+    ITER_NEXT, // u8 frame offset of array and index, u8 frame offset of item, u16 offset, if the index is in bounds then sets the item, advances the index and jumps back by offset
+    RANGE_NEXT, // u8 frame offset of current value and end, u8 frame offset of item, u16 offset, if current is below end then sets the item, increments current and jumps back by offset
+    JUMP_TABLE, // u8 constant index of the lowest value, u16 entry count, u16 offset per entry, u16 default offset, pops int off of stack and jumps by the offset of its entry, offsets are from the end of the instruction
+    JUMP_HASH, // u8 constant index of a map from values to offsets, u16 default offset, pops value off of stack and jumps by its offset, offsets are from the end of the instruction
+    CONSTANT_REF, // u8 constant index, pushes the constant itself instead of a copy, only used for constants that can't be changed
+    POP, // u8 count, pops count values off of stack
 };
 
+/// Native loop replacements, operands are listed in the order they are pushed
+/// and are always followed by the trip count
+pub const Kernel = enum(u8) {
+    append_copy, // dst array, src array, src start, appends the items to dst
+    copy, // dst array, dst start, src array, src start
+    fill, // dst array, dst start, value
+    sum, // accumulator, src array, src start, pushes accumulator plus the sum of the items
+    map, // dst array, dst start, lhs array, lhs start, rhs array, rhs start
+    map_scalar_lhs, // dst array, dst start, lhs value, rhs array, rhs start
+    map_scalar_rhs, // dst array, dst start, lhs array, lhs start, rhs value
+};
+
+/// Arithmetic applied by the map kernels
+pub const KernelOp = enum(u8) {
+    add,
+    sub,
+    mul,
+};
+
+/// Reads a little-endian u16 operand
+pub fn readShort(bytes: []const u8, index: usize) u16 {
+    return @as(u16, bytes[index]) | (@as(u16, bytes[index + 1]) << 8);
+}
+
+/// Reads a little-endian u32 operand
+pub fn readWord(bytes: []const u8, index: usize) u32 {
+    return @as(u32, readShort(bytes, index)) | (@as(u32, readShort(bytes, index + 2)) << 16);
+}
+
+/// Number of operand bytes after the opcode at the index
+pub fn operandLength(bytes: []const u8, index: usize) usize {
+    const op: Opcode = @enumFromInt(bytes[index]);
+    return switch (op) {
+        .ADD, .SUB, .MUL, .DIV, .MOD, .NEGATE, .EQUAL, .GREATER, .GREATER_EQ, .LESS, .LESS_EQ, .AND, .OR => 0,
+        .ARRAY_PUSH, .ARRAY_GET, .ARRAY_SET, .LENGTH, .RANDOM, .MAP_INIT, .SET_INIT => 0,
+        .MATRIX_GET, .MATRIX_SET, .BYTES_GET, .BYTES_SET => 0,
+        .CONSTANT, .VAR_SET, .VAR_GET, .STACK_ALLOC, .CALL, .RETURN, .CALL_BUILTIN => 1,
+        .MEMO_GET, .MEMO_PUT, .STRUCT_INIT, .FIELD_GET, .FIELD_SET, .TO_BYTES, .FROM_BYTES, .PQUEUE_INIT, .CONSTANT_REF, .POP => 1,
+        .BRANCH_NEQ, .BRANCH_EQ, .BRANCH_EQ_BACK, .JUMP, .JUMP_BACK, .LOCAL_ARRAY_GET, .LOCAL_ARRAY_SET => 2,
+        .ARRAY_INIT, .ITER_NEXT, .RANGE_NEXT => 4,
+        .ARRAY_KERNEL => switch (@as(Kernel, @enumFromInt(bytes[index + 1]))) {
+            .map, .map_scalar_lhs, .map_scalar_rhs => 2,
+            else => 1,
+        },
+        .JUMP_TABLE => 3 + (@as(usize, readShort(bytes, index + 2)) + 1) * 2,
+        .JUMP_HASH => 3,
+    };
+}
+
 pub fn dumpBytecode(funcs: [][]const u8) void {
     std.debug.print("--------------- DUMP ---------------\n", .{});
     for (0..funcs.len) |func_num| {
@@ -111,30 +187,139 @@ pub fn dumpBytecode(funcs: [][]const u8) void {
                     std.debug.print("\n", .{});
                 },
                 .BRANCH_NEQ => {
+                    std.debug.print("0x{X:0>4}\n", .{readShort(bytes, i)});
+                    i += 2;
+                },
+                .BRANCH_EQ => {
+                    std.debug.print("0x{X:0>4}\n", .{readShort(bytes, i)});
+                    i += 2;
+                },
+                .BRANCH_EQ_BACK => {
+                    std.debug.print("0x{X:0>4}\n", .{readShort(bytes, i)});
+                    i += 2;
+                },
+                .JUMP => {
+                    std.debug.print("0x{X:0>4}\n", .{readShort(bytes, i)});
+                    i += 2;
+                },
+                .JUMP_BACK => {
+                    std.debug.print("0x{X:0>4}\n", .{readShort(bytes, i)});
+                    i += 2;
+                },
+                .ARRAY_INIT => {
+                    std.debug.print("0x{X:0>8}\n", .{readWord(bytes, i)});
+                    i += 4;
+                },
+                .ARRAY_PUSH => {
+                    std.debug.print("\n", .{});
+                },
+                .ARRAY_GET => {
+                    std.debug.print("\n", .{});
+                },
+                .ARRAY_SET => {
+                    std.debug.print("\n", .{});
+                },
+                .LENGTH => {
+                    std.debug.print("\n", .{});
+                },
+                .RANDOM => {
+                    std.debug.print("\n", .{});
+                },
+                .ARRAY_KERNEL => {
+                    const kernel: Kernel = @enumFromInt(bytes[i]);
+                    i += 1;
+                    switch (kernel) {
+                        .map, .map_scalar_lhs, .map_scalar_rhs => {
+                            const kernel_op: KernelOp = @enumFromInt(bytes[i]);
+                            std.debug.print("{s} {s}\n", .{ @tagName(kernel), @tagName(kernel_op) });
+                            i += 1;
+                        },
+                        else => std.debug.print("{s}\n", .{@tagName(kernel)}),
+                    }
+                },
+                .MEMO_GET => {
                     std.debug.print("0x{X:0>2}\n", .{bytes[i]});
                     i += 1;
                 },
-                .JUMP => {
+                .MEMO_PUT => {
                     std.debug.print("0x{X:0>2}\n", .{bytes[i]});
                     i += 1;
                 },
-                .JUMP_BACK => {
+                .STRUCT_INIT => {
                     std.debug.print("0x{X:0>2}\n", .{bytes[i]});
                     i += 1;
                 },
-                .ARRAY_INIT => {
+                .FIELD_GET => {
                     std.debug.print("0x{X:0>2}\n", .{bytes[i]});
                     i += 1;
                 },
-                .ARRAY_PUSH => {
+                .FIELD_SET => {
+                    std.debug.print("0x{X:0>2}\n", .{bytes[i]});
+                    i += 1;
+                },
+                .MAP_INIT => {
                     std.debug.print("\n", .{});
                 },
-                .ARRAY_GET => {
+                .SET_INIT => {
                     std.debug.print("\n", .{});
                 },
-                .ARRAY_SET => {
+                .LOCAL_ARRAY_GET => {
+                    std.debug.print("0x{X:0>2} 0x{X:0>2}\n", .{ bytes[i], bytes[i + 1] });
+                    i += 2;
+                },
+                .LOCAL_ARRAY_SET => {
+                    std.debug.print("0x{X:0>2} 0x{X:0>2}\n", .{ bytes[i], bytes[i + 1] });
+                    i += 2;
+                },
+                .MATRIX_GET => {
+                    std.debug.print("\n", .{});
+                },
+                .MATRIX_SET => {
+                    std.debug.print("\n", .{});
+                },
+                .BYTES_GET => {
                     std.debug.print("\n", .{});
                 },
+                .BYTES_SET => {
+                    std.debug.print("\n", .{});
+                },
+                .TO_BYTES => {
+                    std.debug.print("0x{X:0>2}\n", .{bytes[i]});
+                    i += 1;
+                },
+                .FROM_BYTES => {
+                    std.debug.print("0x{X:0>2}\n", .{bytes[i]});
+                    i += 1;
+                },
+                .PQUEUE_INIT => {
+                    std.debug.print("0x{X:0>2}\n", .{bytes[i]});
+                    i += 1;
+                },
+                .ITER_NEXT => {
+                    std.debug.print("0x{X:0>2} 0x{X:0>2} 0x{X:0>4}\n", .{ bytes[i], bytes[i + 1], readShort(bytes, i + 2) });
+                    i += 4;
+                },
+                .RANGE_NEXT => {
+                    std.debug.print("0x{X:0>2} 0x{X:0>2} 0x{X:0>4}\n", .{ bytes[i], bytes[i + 1], readShort(bytes, i + 2) });
+                    i += 4;
+                },
+                .JUMP_TABLE => {
+                    const count = readShort(bytes, i + 1);
+                    std.debug.print("0x{X:0>2} 0x{X:0>4}\n", .{ bytes[i], count });
+                    i += 3 + (@as(usize, count) + 1) * 2;
+                },
+                .JUMP_HASH => {
+                    std.debug.print("0x{X:0>2} 0x{X:0>4}\n", .{ bytes[i], readShort(bytes, i + 1) });
+                    i += 3;
+                },
+                .CONSTANT_REF => {
+                    std.debug.print("0x{X:0>2}\n", .{bytes[i]});
+                    i += 1;
+                },
+                .POP => {
+                    std.debug.print("0x{X:0>2}\n", .{bytes[i]});
+                    i += 1;
+                },
             }
         }
     }
@@ -78,6 +78,25 @@ pub const GC = struct {
                             self.markValue(arr_item);
                         }
                     },
+                    .record => |*record| {
+                        for (record.fields) |*field| {
+                            self.markValue(field);
+                        }
+                    },
+                    .pqueue => |*queue| {
+                        for (queue.items.items) |*queue_item| {
+                            self.markValue(queue_item);
+                        }
+                    },
+                    .map, .set => |*table| {
+                        var iter = table.iterator();
+                        while (iter.next()) |slot| {
+                            self.markValue(&table.keys[slot]);
+                            if (table.has_values) {
+                                self.markValue(&table.values[slot]);
+                            }
+                        }
+                    },
                     else => {},
                 }
             },
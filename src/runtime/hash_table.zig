@@ -0,0 +1,268 @@
+//! Open addressing hash table over runtime values, laid out like a
+//! SwissTable. Every slot has a control byte holding 7 bits of its key's
+//! hash, so a whole group of slots is matched against a key with a single
+//! vector compare before any key has to be looked at. Backs both maps and
+//! sets, sets just don't store values.
+
+const std = @import("std");
+const value = @import("value.zig");
+const vm = @import("vm.zig");
+
+const group_width = 16;
+const Group = @Vector(group_width, u8);
+const GroupMask = std.meta.Int(.unsigned, group_width);
+
+/// Control bytes of free slots have the high bit set, full slots hold 7
+/// bits of the hash
+const ctrl_empty: u8 = 0x80;
+const ctrl_deleted: u8 = 0xFE;
+
+/// Slot count of the first allocation, always a power of two multiple of
+/// the group width
+const min_capacity: usize = group_width;
+
+/// Hash of a key, strings cache theirs as they are immutable
+pub fn hashKey(key: value.Value) u64 {
+    return switch (key.data) {
+        .integer => |int| std.hash.Wyhash.hash(0, std.mem.asBytes(&int)),
+        .boolean => |boolean| std.hash.Wyhash.hash(0, &[_]u8{@intFromBool(boolean)}),
+        .func => |func| std.hash.Wyhash.hash(0, std.mem.asBytes(&func)),
+        .object => |obj| switch (obj.data) {
+            .string => |*str| str.hash(),
+            else => unreachable,
+        },
+    };
+}
+
+/// Control byte of a full slot
+inline fn tagOf(hash: u64) u8 {
+    return @truncate(hash >> 57);
+}
+
+inline fn matchByte(group: Group, byte: u8) GroupMask {
+    return @bitCast(group == @as(Group, @splat(byte)));
+}
+
+/// Slots that are empty or deleted
+inline fn matchFree(group: Group) GroupMask {
+    return @bitCast(group >= @as(Group, @splat(ctrl_empty)));
+}
+
+pub const HashTable = struct {
+    ctrl: []u8 = &.{},
+    keys: []value.Value = &.{},
+    values: []value.Value = &.{}, // stays empty in sets
+    count: usize = 0,
+    deleted: usize = 0,
+    has_values: bool,
+
+    /// Iterates over the full slots
+    pub const Iterator = struct {
+        table: *const HashTable,
+        index: usize = 0,
+
+        pub fn next(self: *Iterator) ?usize {
+            while (self.index < self.table.ctrl.len) {
+                const slot = self.index;
+                self.index += 1;
+                if (self.table.ctrl[slot] < ctrl_empty) {
+                    return slot;
+                }
+            }
+            return null;
+        }
+    };
+
+    pub fn iterator(self: *const HashTable) Iterator {
+        return Iterator{ .table = self };
+    }
+
+    /// Frees the table and every object held in it, only use this for
+    /// tables that aren't tracked by the garbage collector
+    pub fn deinit(self: *HashTable, allocator: std.mem.Allocator) void {
+        var iter = self.iterator();
+        while (iter.next()) |slot| {
+            self.keys[slot].deinit(allocator);
+            if (self.has_values) {
+                self.values[slot].deinit(allocator);
+            }
+        }
+        self.deinitShallow(allocator);
+    }
+
+    /// Frees the table but not the objects held in it
+    pub fn deinitShallow(self: *HashTable, allocator: std.mem.Allocator) void {
+        allocator.free(self.ctrl);
+        allocator.free(self.keys);
+        allocator.free(self.values);
+    }
+
+    pub fn dupe(self: *const HashTable, allocator: std.mem.Allocator) HashTable {
+        var new = HashTable{
+            .count = self.count,
+            .deleted = self.deleted,
+            .has_values = self.has_values,
+        };
+        new.allocate(allocator, self.ctrl.len);
+        @memcpy(new.ctrl, self.ctrl);
+        var iter = self.iterator();
+        while (iter.next()) |slot| {
+            new.keys[slot] = self.keys[slot].dupe(allocator);
+            if (self.has_values) {
+                new.values[slot] = self.values[slot].dupe(allocator);
+            }
+        }
+        return new;
+    }
+
+    /// Same keys with equal values, assumes both have the same types
+    pub fn equals(self: *const HashTable, rhs: *const HashTable) bool {
+        if (self.count != rhs.count) {
+            return false;
+        }
+        var iter = self.iterator();
+        while (iter.next()) |slot| {
+            const key = self.keys[slot];
+            const rhs_slot = rhs.find(key, hashKey(key)) orelse return false;
+            if (self.has_values and !self.values[slot].equals(rhs.values[rhs_slot])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    pub fn get(self: *const HashTable, key: value.Value) ?value.Value {
+        const slot = self.find(key, hashKey(key)) orelse return null;
+        return self.values[slot];
+    }
+
+    pub fn contains(self: *const HashTable, key: value.Value) bool {
+        return self.find(key, hashKey(key)) != null;
+    }
+
+    /// Inserts the key or replaces the value of an existing one, the value
+    /// is ignored in sets
+    pub fn put(self: *HashTable, allocator: std.mem.Allocator, key: value.Value, val: value.Value) void {
+        const hash = hashKey(key);
+        const slot = self.find(key, hash) orelse blk: {
+            if ((self.count + self.deleted + 1) * 8 > self.ctrl.len * 7) {
+                self.grow(allocator);
+            }
+            const free = self.findFree(hash);
+            if (self.ctrl[free] == ctrl_deleted) {
+                self.deleted -= 1;
+            }
+            self.ctrl[free] = tagOf(hash);
+            self.keys[free] = key;
+            self.count += 1;
+            break :blk free;
+        };
+        if (self.has_values) {
+            self.values[slot] = val;
+        }
+    }
+
+    /// Removes the key, returns false if it wasn't in the table
+    pub fn remove(self: *HashTable, key: value.Value) bool {
+        const slot = self.find(key, hashKey(key)) orelse return false;
+        // Probing continues past deleted slots, so the key can't just be
+        // marked as empty
+        self.ctrl[slot] = ctrl_deleted;
+        self.deleted += 1;
+        self.count -= 1;
+        return true;
+    }
+
+    /// Slot holding the key, null if the key isn't in the table
+    fn find(self: *const HashTable, key: value.Value, hash: u64) ?usize {
+        if (self.ctrl.len == 0) {
+            return null;
+        }
+        const tag = tagOf(hash);
+        const group_mask = self.ctrl.len / group_width - 1;
+        var group = @as(usize, @truncate(hash)) & group_mask;
+        var stride: usize = 0;
+        while (true) {
+            const base = group * group_width;
+            const ctrl: Group = self.ctrl[base..][0..group_width].*;
+            var matches = matchByte(ctrl, tag);
+            while (matches != 0) {
+                const slot = base + @ctz(matches);
+                if (self.keys[slot].equals(key)) {
+                    return slot;
+                }
+                matches &= matches - 1;
+            }
+            // The key would have been placed in the first free slot
+            if (matchByte(ctrl, ctrl_empty) != 0) {
+                return null;
+            }
+            // Triangular probing visits every group when the group count is
+            // a power of two
+            stride += 1;
+            group = (group + stride) & group_mask;
+        }
+    }
+
+    /// First empty or deleted slot in the probe sequence of the hash
+    fn findFree(self: *const HashTable, hash: u64) usize {
+        const group_mask = self.ctrl.len / group_width - 1;
+        var group = @as(usize, @truncate(hash)) & group_mask;
+        var stride: usize = 0;
+        while (true) {
+            const base = group * group_width;
+            const ctrl: Group = self.ctrl[base..][0..group_width].*;
+            const free = matchFree(ctrl);
+            if (free != 0) {
+                return base + @ctz(free);
+            }
+            stride += 1;
+            group = (group + stride) & group_mask;
+        }
+    }
+
+    /// Rehashes into a bigger table, or into one of the same size if most of
+    /// the used slots are deleted
+    fn grow(self: *HashTable, allocator: std.mem.Allocator) void {
+        const capacity = if (self.ctrl.len == 0)
+            min_capacity
+        else if (self.count * 2 < self.ctrl.len)
+            self.ctrl.len
+        else
+            self.ctrl.len * 2;
+
+        var old = self.*;
+        self.allocate(allocator, capacity);
+        self.deleted = 0;
+
+        var iter = old.iterator();
+        while (iter.next()) |slot| {
+            const key = old.keys[slot];
+            const hash = hashKey(key);
+            const free = self.findFree(hash);
+            self.ctrl[free] = tagOf(hash);
+            self.keys[free] = key;
+            if (self.has_values) {
+                self.values[free] = old.values[slot];
+            }
+        }
+        old.deinitShallow(allocator);
+    }
+
+    /// Allocates empty slots, the old slots aren't freed
+    fn allocate(self: *HashTable, allocator: std.mem.Allocator, capacity: usize) void {
+        self.ctrl = allocator.alloc(u8, capacity) catch |err| {
+            vm.errorHandle(err);
+            unreachable;
+        };
+        @memset(self.ctrl, ctrl_empty);
+        self.keys = allocator.alloc(value.Value, capacity) catch |err| {
+            vm.errorHandle(err);
+            unreachable;
+        };
+        self.values = allocator.alloc(value.Value, if (self.has_values) capacity else 0) catch |err| {
+            vm.errorHandle(err);
+            unreachable;
+        };
+    }
+};
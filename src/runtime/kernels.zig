@@ -0,0 +1,62 @@
+//! Native array kernels that replace simple interpreted loops. All kernels
+//! process items in ascending order so aliasing arrays behave exactly like
+//! the loops they replace.
+
+const std = @import("std");
+const byte = @import("bytecode.zig");
+const value = @import("value.zig");
+
+/// Integers processed per step when summing
+const sum_lanes = 4;
+
+/// Either side of a map kernel
+pub const Operand = union(enum) {
+    array: []const value.Value,
+    scalar: i64,
+
+    inline fn at(self: Operand, index: usize) i64 {
+        return switch (self) {
+            .array => |array| array[index].data.integer,
+            .scalar => |scalar| scalar,
+        };
+    }
+};
+
+/// Sums integer items
+pub fn sum(items: []const value.Value) i64 {
+    // Values are tagged so the integers have to be gathered into lanes first
+    var lanes: @Vector(sum_lanes, i64) = @splat(0);
+    var i: usize = 0;
+    while (i + sum_lanes <= items.len) : (i += sum_lanes) {
+        var chunk: @Vector(sum_lanes, i64) = undefined;
+        inline for (0..sum_lanes) |lane| {
+            chunk[lane] = items[i + lane].data.integer;
+        }
+        lanes += chunk;
+    }
+
+    var total = @reduce(.Add, lanes);
+    while (i < items.len) : (i += 1) {
+        total += items[i].data.integer;
+    }
+    return total;
+}
+
+/// Sets every item of dst to lhs op rhs
+pub fn map(op: byte.KernelOp, dst: []value.Value, lhs: Operand, rhs: Operand) void {
+    switch (op) {
+        inline else => |comptime_op| {
+            for (dst, 0..) |*item, i| {
+                item.* = value.Value{ .data = .{ .integer = apply(comptime_op, lhs.at(i), rhs.at(i)) } };
+            }
+        },
+    }
+}
+
+inline fn apply(comptime op: byte.KernelOp, lhs: i64, rhs: i64) i64 {
+    return switch (op) {
+        .add => lhs + rhs,
+        .sub => lhs - rhs,
+        .mul => lhs * rhs,
+    };
+}
@@ -0,0 +1,138 @@
+//! Dense integer matrix, items are stored untagged in a single row-major
+//! allocation so rows can be processed a whole vector at a time.
+
+const std = @import("std");
+const vm = @import("vm.zig");
+
+/// Integers processed per step by the vectorized loops
+const lanes = 4;
+const Lane = @Vector(lanes, i64);
+
+/// Side of the square blocks that are transposed at once, keeps both the
+/// rows that are read and the rows that are written in cache
+const transpose_block = 16;
+
+pub const Matrix = struct {
+    rows: usize,
+    cols: usize,
+    items: []i64,
+
+    /// Zeroed matrix
+    pub fn init(allocator: std.mem.Allocator, rows: usize, cols: usize) Matrix {
+        const items = allocator.alloc(i64, rows * cols) catch |err| {
+            vm.errorHandle(err);
+            unreachable;
+        };
+        @memset(items, 0);
+        return Matrix{ .rows = rows, .cols = cols, .items = items };
+    }
+
+    pub fn deinit(self: *Matrix, allocator: std.mem.Allocator) void {
+        allocator.free(self.items);
+    }
+
+    pub fn dupe(self: *const Matrix, allocator: std.mem.Allocator) Matrix {
+        return Matrix{
+            .rows = self.rows,
+            .cols = self.cols,
+            .items = allocator.dupe(i64, self.items) catch |err| {
+                vm.errorHandle(err);
+                unreachable;
+            },
+        };
+    }
+
+    pub fn equals(self: *const Matrix, rhs: *const Matrix) bool {
+        return self.rows == rhs.rows and self.cols == rhs.cols and std.mem.eql(i64, self.items, rhs.items);
+    }
+
+    pub inline fn row(self: *const Matrix, index: usize) []i64 {
+        return self.items[index * self.cols ..][0..self.cols];
+    }
+
+    /// Null if the position is out of bounds
+    pub inline fn at(self: *const Matrix, row_index: usize, col_index: usize) ?*i64 {
+        if (row_index >= self.rows or col_index >= self.cols) {
+            return null;
+        }
+        return &self.items[row_index * self.cols + col_index];
+    }
+
+    /// Writes the sum of every row into out, which has an item per row
+    pub fn rowSums(self: *const Matrix, out: []i64) void {
+        for (out, 0..) |*sum, i| {
+            sum.* = sumOf(self.row(i));
+        }
+    }
+
+    /// Writes the sum of every column into out, which has an item per column.
+    /// Rows are added onto out in order so memory is only read sequentially.
+    pub fn colSums(self: *const Matrix, out: []i64) void {
+        @memset(out, 0);
+        for (0..self.rows) |i| {
+            addRow(out, self.row(i), 1);
+        }
+    }
+
+    pub fn transpose(self: *const Matrix, allocator: std.mem.Allocator) Matrix {
+        var result = Matrix.init(allocator, self.cols, self.rows);
+        var block_row: usize = 0;
+        while (block_row < self.rows) : (block_row += transpose_block) {
+            const row_end = @min(block_row + transpose_block, self.rows);
+            var block_col: usize = 0;
+            while (block_col < self.cols) : (block_col += transpose_block) {
+                const col_end = @min(block_col + transpose_block, self.cols);
+                for (block_row..row_end) |i| {
+                    for (block_col..col_end) |j| {
+                        result.items[j * result.cols + i] = self.items[i * self.cols + j];
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    /// Product of two matrices, the caller has to check that the columns of
+    /// lhs match the rows of rhs. Iterates in i, k, j order so the inner loop
+    /// scales a whole row of rhs into a row of the result.
+    pub fn multiply(lhs: *const Matrix, rhs: *const Matrix, allocator: std.mem.Allocator) Matrix {
+        var result = Matrix.init(allocator, lhs.rows, rhs.cols);
+        for (0..lhs.rows) |i| {
+            const out = result.row(i);
+            for (lhs.row(i), 0..) |scale, k| {
+                if (scale != 0) {
+                    addRow(out, rhs.row(k), scale);
+                }
+            }
+        }
+        return result;
+    }
+};
+
+fn sumOf(items: []const i64) i64 {
+    var acc: Lane = @splat(0);
+    var i: usize = 0;
+    while (i + lanes <= items.len) : (i += lanes) {
+        const chunk: Lane = items[i..][0..lanes].*;
+        acc += chunk;
+    }
+    var total = @reduce(.Add, acc);
+    while (i < items.len) : (i += 1) {
+        total += items[i];
+    }
+    return total;
+}
+
+/// dst += src * scale, item by item
+fn addRow(dst: []i64, src: []const i64, scale: i64) void {
+    const scale_lane: Lane = @splat(scale);
+    var i: usize = 0;
+    while (i + lanes <= dst.len) : (i += lanes) {
+        const dst_chunk: Lane = dst[i..][0..lanes].*;
+        const src_chunk: Lane = src[i..][0..lanes].*;
+        dst[i..][0..lanes].* = dst_chunk + src_chunk * scale_lane;
+    }
+    while (i < dst.len) : (i += 1) {
+        dst[i] += src[i] * scale;
+    }
+}
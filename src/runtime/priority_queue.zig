@@ -0,0 +1,112 @@
+//! Priority queue over runtime values. Items are kept in a 4-ary heap, which
+//! is half as deep as a binary heap and keeps the children of an item next to
+//! each other in memory.
+//!
+//! Ordering is passed in as a context with a `before(lhs, rhs) bool` method
+//! that is true if lhs has to come out of the queue before rhs.
+
+const std = @import("std");
+const value = @import("value.zig");
+const vm = @import("vm.zig");
+
+const arity = 4;
+
+pub const PriorityQueue = struct {
+    items: std.ArrayListUnmanaged(value.Value) = std.ArrayListUnmanaged(value.Value){},
+    comparator: ?usize = null, // function index, integer queues without one pop the smallest item first
+
+    /// Frees the queue and every object held in it, only use this for
+    /// queues that aren't tracked by the garbage collector
+    pub fn deinit(self: *PriorityQueue, allocator: std.mem.Allocator) void {
+        for (self.items.items) |*item| {
+            item.deinit(allocator);
+        }
+        self.items.deinit(allocator);
+    }
+
+    /// Frees the queue but not the objects held in it
+    pub fn deinitShallow(self: *PriorityQueue, allocator: std.mem.Allocator) void {
+        self.items.deinit(allocator);
+    }
+
+    pub fn dupe(self: *const PriorityQueue, allocator: std.mem.Allocator) PriorityQueue {
+        var items = std.ArrayListUnmanaged(value.Value).initCapacity(allocator, self.items.items.len) catch |err| {
+            vm.errorHandle(err);
+            unreachable;
+        };
+        for (self.items.items) |*item| {
+            items.appendAssumeCapacity(item.dupe(allocator));
+        }
+        return PriorityQueue{ .items = items, .comparator = self.comparator };
+    }
+
+    pub fn peek(self: *const PriorityQueue) ?value.Value {
+        if (self.items.items.len == 0) {
+            return null;
+        }
+        return self.items.items[0];
+    }
+
+    pub fn push(self: *PriorityQueue, allocator: std.mem.Allocator, item: value.Value, order: anytype) void {
+        self.items.append(allocator, item) catch |err| {
+            vm.errorHandle(err);
+            unreachable;
+        };
+        self.siftUp(self.items.items.len - 1, order);
+    }
+
+    pub fn pop(self: *PriorityQueue, order: anytype) ?value.Value {
+        const len = self.items.items.len;
+        if (len == 0) {
+            return null;
+        }
+        const top = self.items.items[0];
+        const last = self.items.pop();
+        if (len > 1) {
+            self.items.items[0] = last;
+            self.siftDown(0, order);
+        }
+        return top;
+    }
+
+    /// Moves the item up until its parent comes out before it
+    fn siftUp(self: *PriorityQueue, start: usize, order: anytype) void {
+        const items = self.items.items;
+        const item = items[start];
+        var i = start;
+        while (i > 0) {
+            const parent = (i - 1) / arity;
+            if (!order.before(item, items[parent])) {
+                break;
+            }
+            items[i] = items[parent];
+            i = parent;
+        }
+        items[i] = item;
+    }
+
+    /// Moves the item down until it comes out before all of its children
+    fn siftDown(self: *PriorityQueue, start: usize, order: anytype) void {
+        const items = self.items.items;
+        const item = items[start];
+        var i = start;
+        while (true) {
+            const first = i * arity + 1;
+            if (first >= items.len) {
+                break;
+            }
+            var best = first;
+            for (first + 1..@min(first + arity, items.len)) |child| {
+                if (order.before(items[child], items[best])) {
+                    best = child;
+                }
+            }
+            if (!order.before(items[best], item)) {
+                break;
+            }
+            items[i] = items[best];
+            i = best;
+        }
+        items[i] = item;
+    }
+};
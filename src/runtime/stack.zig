@@ -43,6 +43,13 @@ pub fn Stack(comptime T: type) type {
             }
         }
 
+        /// Pops everything after frame but the top count items, which are
+        /// moved down to the start of the frame
+        pub inline fn popFrameKeep(self: *Self, frame: usize, count: usize) void {
+            std.mem.copyForwards(T, self.items[frame .. frame + count], self.items[self.head - count .. self.head]);
+            self.head = frame + count;
+        }
+
         pub inline fn peekFrameOffset(self: *Self, frame: usize, offset: usize) *T {
             if (enable_checks) {
                 if (frame + offset > self.head) {
@@ -75,6 +82,19 @@ pub fn Stack(comptime T: type) type {
             return self.items[self.head];
         }
 
+        /// Pops the top count items, the slice is only valid until the
+        /// next push
+        pub inline fn popSlice(self: *Self, count: usize) []T {
+            if (enable_checks) {
+                if (self.head < count) {
+                    vm.errorHandle(Error.Underflow);
+                    unreachable;
+                }
+            }
+            self.head -= count;
+            return self.items[self.head .. self.head + count];
+        }
+
         pub inline fn peek(self: *Self) *T {
             if (enable_checks) {
                 if (self.head == 0) {
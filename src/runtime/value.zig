@@ -1,6 +1,10 @@
 //! Runtime value data, universal tagged union for any variable / constant
 
 const std = @import("std");
+const buffer = @import("buffer.zig");
+const hash_table = @import("hash_table.zig");
+const matrix = @import("matrix.zig");
+const priority_queue = @import("priority_queue.zig");
 const vm = @import("vm.zig");
 
 // data must be 8 bytes or lower
@@ -44,6 +48,80 @@ pub const Value = struct {
                         }
                         try writer.writeByte(']');
                     },
+                    .record => |record| {
+                        try writer.writeByte('{');
+                        for (0..record.fields.len) |i| {
+                            try writer.print("{any}", .{record.fields[i]});
+                            if (i < record.fields.len - 1) {
+                                try writer.writeAll(", ");
+                            }
+                        }
+                        try writer.writeByte('}');
+                    },
+                    .map => |*map| {
+                        try writer.writeByte('{');
+                        var iter = map.iterator();
+                        var first = true;
+                        while (iter.next()) |slot| {
+                            if (!first) {
+                                try writer.writeAll(", ");
+                            }
+                            first = false;
+                            try writer.print("{any}: {any}", .{ map.keys[slot], map.values[slot] });
+                        }
+                        try writer.writeByte('}');
+                    },
+                    .set => |*set| {
+                        try writer.writeByte('{');
+                        var iter = set.iterator();
+                        var first = true;
+                        while (iter.next()) |slot| {
+                            if (!first) {
+                                try writer.writeAll(", ");
+                            }
+                            first = false;
+                            try writer.print("{any}", .{set.keys[slot]});
+                        }
+                        try writer.writeByte('}');
+                    },
+                    .pqueue => |*queue| {
+                        try writer.writeByte('[');
+                        for (0..queue.items.items.len) |i| {
+                            try writer.print("{any}", .{queue.items.items[i]});
+                            if (i < queue.items.items.len - 1) {
+                                try writer.writeAll(", ");
+                            }
+                        }
+                        try writer.writeByte(']');
+                    },
+                    .bytes => |*buf| {
+                        try writer.writeByte('[');
+                        for (0..buf.items.len) |i| {
+                            try writer.print("{d}", .{buf.items[i]});
+                            if (i < buf.items.len - 1) {
+                                try writer.writeAll(", ");
+                            }
+                        }
+                        try writer.writeByte(']');
+                    },
+                    .matrix => |*mat| {
+                        try writer.writeByte('[');
+                        for (0..mat.rows) |i| {
+                            try writer.writeByte('[');
+                            const row = mat.row(i);
+                            for (0..row.len) |j| {
+                                try writer.print("{d}", .{row[j]});
+                                if (j < row.len - 1) {
+                                    try writer.writeAll(", ");
+                                }
+                            }
+                            try writer.writeByte(']');
+                            if (i < mat.rows - 1) {
+                                try writer.writeAll(", ");
+                            }
+                        }
+                        try writer.writeByte(']');
+                    },
                     // else => try writer.print("[Object object]", .{}),
                 }
             },
@@ -59,6 +137,43 @@ pub const Value = struct {
         }
     }
 
+    /// Feeds the contents into hasher, values that are equal hash the same
+    pub fn hash(self: *const Value, hasher: *std.hash.Wyhash) void {
+        switch (self.data) {
+            .integer => |int| hasher.update(std.mem.asBytes(&int)),
+            .boolean => |boolean| hasher.update(&[_]u8{@intFromBool(boolean)}),
+            .func => |func| hasher.update(std.mem.asBytes(&func)),
+            .object => |obj| {
+                switch (obj.data) {
+                    .string => |str| hasher.update(str.raw),
+                    .array => |array| {
+                        for (array.items.items) |*item| {
+                            item.hash(hasher);
+                        }
+                    },
+                    .record => |record| {
+                        for (record.fields) |*field| {
+                            field.hash(hasher);
+                        }
+                    },
+                    // Slot order depends on the insertion history, equal
+                    // tables only share their size
+                    .map, .set => |*table| hasher.update(std.mem.asBytes(&table.count)),
+                    .bytes => |*buf| hasher.update(buf.items),
+                    .pqueue => |*queue| {
+                        for (queue.items.items) |*item| {
+                            item.hash(hasher);
+                        }
+                    },
+                    .matrix => |*mat| {
+                        hasher.update(std.mem.asBytes(&mat.cols));
+                        hasher.update(std.mem.sliceAsBytes(mat.items));
+                    },
+                }
+            },
+        }
+    }
+
     /// Assumes both are the same type
     pub fn equals(self: *const Value, rhs: Value) bool {
         switch (self.data) {
@@ -77,6 +192,12 @@ pub const Object = struct {
     data: union(enum) {
         string: String,
         array: Array,
+        record: Record,
+        map: hash_table.HashTable,
+        set: hash_table.HashTable,
+        matrix: matrix.Matrix,
+        bytes: buffer.Bytes,
+        pqueue: priority_queue.PriorityQueue,
     },
 
     pub fn deinit(self: *Object, allocator: std.mem.Allocator) void {
@@ -95,6 +216,15 @@ pub const Object = struct {
             .array => |*array| {
                 array.items.deinit(allocator);
             },
+            .record => |*record| {
+                allocator.free(record.fields);
+            },
+            .map, .set => |*table| {
+                table.deinitShallow(allocator);
+            },
+            .pqueue => |*queue| {
+                queue.deinitShallow(allocator);
+            },
             inline else => |_| {
                 self.deinit(allocator);
             },
@@ -116,6 +246,24 @@ pub const Object = struct {
                 var array_ref = array;
                 new.data = .{ .array = array_ref.dupe(allocator) };
             },
+            .record => |record| {
+                new.data = .{ .record = record.dupe(allocator) };
+            },
+            .map => |*map| {
+                new.data = .{ .map = map.dupe(allocator) };
+            },
+            .set => |*set| {
+                new.data = .{ .set = set.dupe(allocator) };
+            },
+            .matrix => |*mat| {
+                new.data = .{ .matrix = mat.dupe(allocator) };
+            },
+            .bytes => |*buf| {
+                new.data = .{ .bytes = buf.dupe(allocator) };
+            },
+            .pqueue => |*queue| {
+                new.data = .{ .pqueue = queue.dupe(allocator) };
+            },
         }
 
         return new;
@@ -136,12 +284,46 @@ pub const Object = struct {
                 }
                 return true;
             },
+            .record => |record| {
+                for (record.fields, rhs.data.record.fields) |*field, rhs_field| {
+                    if (!field.equals(rhs_field)) {
+                        return false;
+                    }
+                }
+                return true;
+            },
+            .map => |*map| return map.equals(&rhs.data.map),
+            .set => |*set| return set.equals(&rhs.data.set),
+            .matrix => |*mat| return mat.equals(&rhs.data.matrix),
+            .bytes => |*buf| return buf.equals(&rhs.data.bytes),
+            .pqueue => |*queue| {
+                const rhs_items = rhs.data.pqueue.items.items;
+                if (queue.items.items.len != rhs_items.len) {
+                    return false;
+                }
+                for (queue.items.items, rhs_items) |*item, rhs_item| {
+                    if (!item.equals(rhs_item)) {
+                        return false;
+                    }
+                }
+                return true;
+            },
         }
     }
 };
 
 pub const String = struct {
     raw: []const u8,
+    hash_cache: ?u64 = null, // strings are immutable so the hash only has to be computed once
+
+    pub fn hash(self: *String) u64 {
+        if (self.hash_cache) |cached| {
+            return cached;
+        }
+        const computed = std.hash.Wyhash.hash(0, self.raw);
+        self.hash_cache = computed;
+        return computed;
+    }
 
     pub fn deinit(self: *String, allocator: std.mem.Allocator) void {
         allocator.free(self.raw);
@@ -153,6 +335,7 @@ pub const String = struct {
                 vm.errorHandle(err);
                 unreachable;
             },
+            .hash_cache = self.hash_cache,
         };
     }
 };
@@ -173,17 +356,43 @@ pub const Array = struct {
             unreachable;
         };
 
-        for (0..self.items.items.len) |i| {
-            new_items.append(allocator, self.items.items[i].dupe(allocator)) catch |err| {
-                vm.errorHandle(err);
-                unreachable;
-            };
+        // Copy everything at once, only nested objects need their own copy
+        new_items.appendSliceAssumeCapacity(self.items.items);
+        for (new_items.items) |*item| {
+            switch (item.data) {
+                .object => item.* = item.dupe(allocator),
+                else => {},
+            }
         }
 
         return Array{ .items = new_items };
     }
 };
 
+/// Struct instance, fields are stored in declaration order so every field
+/// is at a fixed offset
+pub const Record = struct {
+    fields: []Value,
+
+    pub fn deinit(self: *Record, allocator: std.mem.Allocator) void {
+        for (self.fields) |*field| {
+            field.deinit(allocator);
+        }
+        allocator.free(self.fields);
+    }
+
+    pub fn dupe(self: *const Record, allocator: std.mem.Allocator) Record {
+        const new_fields = allocator.alloc(Value, self.fields.len) catch |err| {
+            vm.errorHandle(err);
+            unreachable;
+        };
+        for (new_fields, self.fields) |*new_field, *field| {
+            new_field.* = field.dupe(allocator);
+        }
+        return Record{ .fields = new_fields };
+    }
+};
+
 test "Value Word Size" {
     try std.testing.expect(@sizeOf(Value) <= @sizeOf(*anyopaque));
 }
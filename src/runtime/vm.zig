@@ -2,8 +2,13 @@
 //! constants
 
 const std = @import("std");
+const buffer = @import("buffer.zig");
 const byte = @import("bytecode.zig");
 const gc = @import("gc.zig");
+const hash_table = @import("hash_table.zig");
+const kernels = @import("kernels.zig");
+const matrix = @import("matrix.zig");
+const priority_queue = @import("priority_queue.zig");
 const stack = @import("stack.zig");
 const value = @import("value.zig");
 
@@ -12,6 +17,10 @@ pub const Error = error{
     InvalidConstant,
     InvalidCallFrame,
     ArrayOutOfBounds,
+    KeyNotFound,
+    InvalidDimensions,
+    ByteOutOfRange,
+    EmptyQueue,
 } || stack.Error;
 
 pub fn errorHandle(err: Error) void {
@@ -28,6 +37,47 @@ const CallFrame = struct {
     root: bool = false,
 };
 
+/// Hashes memo keys by the contents of the argument values
+const MemoContext = struct {
+    pub fn hash(_: MemoContext, key: []const value.Value) u64 {
+        var hasher = std.hash.Wyhash.init(0);
+        for (key) |*item| {
+            item.hash(&hasher);
+        }
+        return hasher.final();
+    }
+
+    pub fn eql(_: MemoContext, lhs: []const value.Value, rhs: []const value.Value) bool {
+        for (lhs, rhs) |*lhs_item, rhs_item| {
+            if (!lhs_item.equals(rhs_item)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/// Integer queues without a comparator pop the smallest item first
+const IntOrder = struct {
+    pub inline fn before(_: IntOrder, lhs: value.Value, rhs: value.Value) bool {
+        return lhs.data.integer < rhs.data.integer;
+    }
+};
+
+/// Queue order decided by calling the queue's comparator
+const FuncOrder = struct {
+    vm: *VM,
+    func: usize,
+
+    pub fn before(self: FuncOrder, lhs: value.Value, rhs: value.Value) bool {
+        return self.vm.callFunction(self.func, &.{ lhs, rhs }).data.boolean;
+    }
+};
+
+/// Cached results of a memo function, the keys and results are owned by the
+/// table instead of the garbage collector
+const MemoTable = std.HashMapUnmanaged([]const value.Value, value.Value, MemoContext, std.hash_map.default_max_load_percentage);
+
 /// Virtual machine, executes bytecode and maintains all runtime stacks
 pub const VM = struct {
     current_func: usize = 0,
@@ -35,18 +85,63 @@ pub const VM = struct {
     constants: []const value.Value,
     eval_stack: stack.Stack(value.Value),
     call_stack: stack.Stack(CallFrame),
+    memo_tables: []MemoTable, // indexed by function
     garbage_collector: gc.GC,
     rng: std.rand.Random,
     pc: usize = 0,
     err: ?Error = null,
+    output: ?*std.ArrayList(u8) = null, // print writes here instead of stderr when set
     allocator: std.mem.Allocator,
 
+    /// Builtins called through CALL_BUILTIN, indexed by the builtin id from
+    /// compiler/builtin.zig. Builtins with a dedicated opcode are still listed
+    /// so that the ids line up.
+    const builtins = [_]*const fn (*VM) void{
+        &builtinPrint,
+        &builtinToString,
+        &builtinLength,
+        &builtinClone,
+        &builtinAppend,
+        &builtinRandom,
+        &builtinPut,
+        &builtinGet,
+        &builtinContains,
+        &builtinRemove,
+        &builtinInsert,
+        &builtinKeys,
+        &builtinMatrix,
+        &builtinMatrixRows,
+        &builtinMatrixCols,
+        &builtinRowSums,
+        &builtinColSums,
+        &builtinTranspose,
+        &builtinMatmul,
+        &builtinBytes,
+        &builtinFill,
+        &builtinCopy,
+        &builtinFind,
+        &builtinToBytes,
+        &builtinFromBytes,
+        &builtinPush,
+        &builtinPop,
+        &builtinPeek,
+        &builtinContains,
+        &builtinRemove,
+        &builtinKeys,
+    };
+
     pub fn init(allocator: std.mem.Allocator, rng: std.rand.Random, bytes: [][]const u8, constants: []const value.Value) VM {
+        const memo_tables = allocator.alloc(MemoTable, bytes.len) catch |err| {
+            errorHandle(err);
+            unreachable;
+        };
+        @memset(memo_tables, MemoTable{});
         var vm = VM{
             .bytes = bytes,
             .constants = constants,
             .eval_stack = stack.Stack(value.Value).init(allocator, 0xFFFF),
             .call_stack = stack.Stack(CallFrame).init(allocator, 0xFFFF),
+            .memo_tables = memo_tables,
             .garbage_collector = gc.GC.init(allocator),
             .rng = rng,
             .allocator = allocator,
@@ -58,6 +153,19 @@ pub const VM = struct {
     pub fn deinit(self: *VM) void {
         self.eval_stack.deinit(self.allocator);
         self.call_stack.deinit(self.allocator);
+        for (self.memo_tables) |*table| {
+            var iter = table.iterator();
+            while (iter.next()) |entry| {
+                for (entry.key_ptr.*) |item| {
+                    var owned = item;
+                    owned.deinit(self.allocator);
+                }
+                self.allocator.free(entry.key_ptr.*);
+                entry.value_ptr.deinit(self.allocator);
+            }
+            table.deinit(self.allocator);
+        }
+        self.allocator.free(self.memo_tables);
         self.garbage_collector.deinit();
     }
 
@@ -98,12 +206,39 @@ pub const VM = struct {
             .AND => self.opAnd(),
             .OR => self.opOr(),
             .BRANCH_NEQ => self.opBranchNEQ(),
+            .BRANCH_EQ => self.opBranchEQ(),
+            .BRANCH_EQ_BACK => self.opBranchEQBack(),
             .JUMP => self.opJump(),
             .JUMP_BACK => self.opJumpBack(),
             .ARRAY_INIT => self.opArrayInit(),
-            .ARRAY_PUSH => self.opArrayPush(),
+            .ARRAY_PUSH => self.builtinAppend(),
             .ARRAY_GET => self.opArrayGet(),
             .ARRAY_SET => self.opArraySet(),
+            .LENGTH => self.builtinLength(),
+            .RANDOM => self.builtinRandom(),
+            .ARRAY_KERNEL => self.opArrayKernel(),
+            .MEMO_GET => self.opMemoGet(),
+            .MEMO_PUT => self.opMemoPut(),
+            .STRUCT_INIT => self.opStructInit(),
+            .FIELD_GET => self.opFieldGet(),
+            .FIELD_SET => self.opFieldSet(),
+            .MAP_INIT => self.opTableInit(.map),
+            .SET_INIT => self.opTableInit(.set),
+            .LOCAL_ARRAY_GET => self.opLocalArrayGet(),
+            .LOCAL_ARRAY_SET => self.opLocalArraySet(),
+            .MATRIX_GET => self.opMatrixGet(),
+            .MATRIX_SET => self.opMatrixSet(),
+            .BYTES_GET => self.opBytesGet(),
+            .BYTES_SET => self.opBytesSet(),
+            .TO_BYTES => self.toBytes(self.nextByte() != 0),
+            .FROM_BYTES => self.fromBytes(self.nextByte() != 0),
+            .PQUEUE_INIT => self.opQueueInit(),
+            .ITER_NEXT => self.opIterNext(),
+            .RANGE_NEXT => self.opRangeNext(),
+            .JUMP_TABLE => self.opJumpTable(),
+            .JUMP_HASH => self.opJumpHash(),
+            .CONSTANT_REF => self.opConstantRef(),
+            .POP => self.opPop(),
         }
     }
 
@@ -119,6 +254,20 @@ pub const VM = struct {
         self.eval_stack.push(constant);
     }
 
+    /// Constants bound to const declarations can't be changed, so they are
+    /// shared instead of copied and never owned by the garbage collector
+    inline fn opConstantRef(self: *VM) void {
+        const index = self.nextByte();
+        self.eval_stack.push(self.constants[index]);
+    }
+
+    inline fn opPop(self: *VM) void {
+        const count = self.nextByte();
+        for (0..count) |_| {
+            _ = self.eval_stack.pop();
+        }
+    }
+
     inline fn opVarSet(self: *VM) void {
         const offset = self.nextByte();
         const frame = self.call_stack.peek();
@@ -205,34 +354,88 @@ pub const VM = struct {
     }
 
     inline fn opReturn(self: *VM) void {
-        const is_return = self.nextByte() != 0;
+        self.returnFrame(self.nextByte());
+    }
+
+    /// Runs a function to completion from native code and returns its result.
+    /// The frame returns to the current instruction, so the nested loop stops
+    /// as soon as the call stack is back to where it started.
+    fn callFunction(self: *VM, func: usize, args: []const value.Value) value.Value {
+        for (args) |arg| {
+            self.eval_stack.push(arg);
+        }
+        const depth = self.call_stack.head;
+        self.call_stack.push(CallFrame{
+            .func = self.current_func,
+            .index = self.pc,
+            .stack_offset = self.eval_stack.head - args.len,
+        });
+        self.current_func = func;
+        self.pc = 0;
+        while (self.call_stack.head > depth) {
+            self.nextInstr();
+        }
+        return self.eval_stack.pop();
+    }
+
+    /// Leaves the current call frame, the return values are the top count
+    /// items of the stack
+    inline fn returnFrame(self: *VM, count: u8) void {
         const call_frame = self.call_stack.pop();
         if (call_frame.root) {
+            self.pc = self.bytes[self.current_func].len;
             return;
         }
         self.current_func = call_frame.func;
         self.pc = call_frame.index;
 
-        if (is_return) {
-            const ret = self.eval_stack.pop();
-            self.eval_stack.popFrame(call_frame.stack_offset);
-            self.eval_stack.push(ret);
-        } else {
-            self.eval_stack.popFrame(call_frame.stack_offset);
+        self.eval_stack.popFrameKeep(call_frame.stack_offset, count);
+    }
+
+    inline fn opMemoGet(self: *VM) void {
+        const arg_count = self.nextByte();
+        const frame = self.call_stack.peek();
+        const args = self.eval_stack.items[frame.stack_offset .. frame.stack_offset + arg_count];
+        if (self.memo_tables[self.current_func].get(args)) |cached| {
+            const result = cached.dupe(self.allocator);
+            switch (result.data) {
+                .object => |obj| {
+                    self.garbage_collector.linkObject(obj);
+                },
+                else => {},
+            }
+            self.eval_stack.push(result);
+            self.returnFrame(1);
+        }
+    }
+
+    inline fn opMemoPut(self: *VM) void {
+        const arg_count = self.nextByte();
+        const frame = self.call_stack.peek();
+        const args = self.eval_stack.items[frame.stack_offset .. frame.stack_offset + arg_count];
+        const entry = self.memo_tables[self.current_func].getOrPut(self.allocator, args) catch |err| {
+            errorHandle(err);
+            unreachable;
+        };
+        if (entry.found_existing) {
+            return;
+        }
+
+        // The arguments and result may be collected once the call returns
+        const key = self.allocator.alloc(value.Value, arg_count) catch |err| {
+            errorHandle(err);
+            unreachable;
+        };
+        for (key, args) |*owned, *arg| {
+            owned.* = arg.dupe(self.allocator);
         }
+        entry.key_ptr.* = key;
+        entry.value_ptr.* = self.eval_stack.peek().dupe(self.allocator);
     }
 
     inline fn opCallBuiltin(self: *VM) void {
         const idx = self.nextByte();
-        switch (idx) {
-            0 => self.builtinPrint(),
-            1 => self.builtinToString(),
-            2 => self.builtinLength(),
-            3 => self.builtinClone(),
-            4 => self.builtinAppend(),
-            5 => self.builtinRandom(),
-            else => unreachable,
-        }
+        builtins[idx](self);
     }
 
     inline fn opNegate(self: *VM) void {
@@ -283,37 +486,103 @@ pub const VM = struct {
     }
 
     inline fn opBranchNEQ(self: *VM) void {
-        const offset = self.nextByte();
+        const offset = self.nextShort();
         const item = self.eval_stack.pop();
         if (!item.data.boolean) {
             self.pc += offset;
         }
     }
 
+    inline fn opBranchEQ(self: *VM) void {
+        const offset = self.nextShort();
+        const item = self.eval_stack.pop();
+        if (item.data.boolean) {
+            self.pc += offset;
+        }
+    }
+
+    inline fn opBranchEQBack(self: *VM) void {
+        const offset = self.nextShort();
+        const item = self.eval_stack.pop();
+        if (item.data.boolean) {
+            self.pc -= offset;
+        }
+    }
+
     inline fn opJump(self: *VM) void {
-        const offset = self.nextByte();
+        const offset = self.nextShort();
         self.pc += offset;
     }
 
     inline fn opJumpBack(self: *VM) void {
-        const offset = self.nextByte();
+        const offset = self.nextShort();
         self.pc -= offset;
     }
 
+    /// Bottom of a for loop over an array, the index is only ever compared
+    /// against the current length so the item is read without another check
+    inline fn opIterNext(self: *VM) void {
+        const state = self.nextByte();
+        const item = self.nextByte();
+        const offset = self.nextShort();
+        const frame = self.call_stack.peek();
+        const array = &self.eval_stack.peekFrameOffset(frame.stack_offset, state).data.object.data.array.items;
+        const index_ptr = self.eval_stack.peekFrameOffset(frame.stack_offset, @as(usize, state) + 1);
+        const index: usize = @intCast(index_ptr.data.integer);
+        if (index < array.items.len) {
+            self.eval_stack.peekFrameOffset(frame.stack_offset, item).* = array.items[index];
+            index_ptr.data.integer += 1;
+            self.pc -= offset;
+        }
+    }
+
+    /// Bottom of a for loop over a range of integers
+    inline fn opRangeNext(self: *VM) void {
+        const state = self.nextByte();
+        const item = self.nextByte();
+        const offset = self.nextShort();
+        const frame = self.call_stack.peek();
+        const current_ptr = self.eval_stack.peekFrameOffset(frame.stack_offset, state);
+        const end = self.eval_stack.peekFrameOffset(frame.stack_offset, @as(usize, state) + 1).data.integer;
+        if (current_ptr.data.integer < end) {
+            self.eval_stack.peekFrameOffset(frame.stack_offset, item).* = current_ptr.*;
+            current_ptr.data.integer += 1;
+            self.pc -= offset;
+        }
+    }
+
+    /// Values outside of the table take the default offset stored after it
+    inline fn opJumpTable(self: *VM) void {
+        const low = self.constants[self.nextByte()].data.integer;
+        const count = self.nextShort();
+        const table = self.pc;
+        self.pc += (@as(usize, count) + 1) * 2;
+        const item = self.eval_stack.pop().data.integer;
+        const slot: u64 = @bitCast(item -% low);
+        const entry = if (item >= low and slot < count) slot else count;
+        self.pc += byte.readShort(self.bytes[self.current_func], table + @as(usize, @intCast(entry)) * 2);
+    }
+
+    inline fn opJumpHash(self: *VM) void {
+        const table = &self.constants[self.nextByte()].data.object.data.map;
+        const default = self.nextShort();
+        const item = self.eval_stack.pop();
+        if (table.get(item)) |offset| {
+            self.pc += @intCast(offset.data.integer);
+        } else {
+            self.pc += default;
+        }
+    }
+
     inline fn opArrayInit(self: *VM) void {
-        const items = self.nextByte();
+        const count = self.nextWord();
+        const items = self.eval_stack.popSlice(count);
 
-        var array = std.ArrayListUnmanaged(value.Value).initCapacity(self.allocator, @intCast(items)) catch |err| {
+        var array = std.ArrayListUnmanaged(value.Value).initCapacity(self.allocator, items.len) catch |err| {
             errorHandle(err);
             unreachable;
         };
-
-        for (0..items) |_| {
-            array.append(self.allocator, self.eval_stack.pop()) catch |err| {
-                errorHandle(err);
-                unreachable;
-            };
-        }
+        array.appendSliceAssumeCapacity(items);
 
         const obj = self.garbage_collector.newObject();
         obj.data = .{
@@ -324,16 +593,6 @@ pub const VM = struct {
         self.eval_stack.push(value.Value{ .data = .{ .object = obj } });
     }
 
-    inline fn opArrayPush(self: *VM) void {
-        const array_obj = self.eval_stack.pop();
-        var array = &array_obj.data.object.data.array.items;
-        const item = self.eval_stack.pop();
-        array.append(self.allocator, item) catch |err| {
-            errorHandle(err);
-            unreachable;
-        };
-    }
-
     inline fn opArrayGet(self: *VM) void {
         const array_obj = self.eval_stack.pop();
         const array = &array_obj.data.object.data.array.items;
@@ -359,12 +618,255 @@ pub const VM = struct {
         array.items[index] = item;
     }
 
-    inline fn builtinPrint(self: *VM) void {
+    /// Fixed arrays kept in the frame occupy consecutive local slots
+    inline fn opLocalArrayGet(self: *VM) void {
+        const offset = self.nextByte();
+        const len = self.nextByte();
+        const index_value = self.eval_stack.pop();
+        const index: usize = @intCast(index_value.data.integer);
+        if (len <= index) {
+            errorHandle(Error.ArrayOutOfBounds);
+            return;
+        }
+        const frame = self.call_stack.peek();
+        const value_ptr = self.eval_stack.peekFrameOffset(frame.stack_offset, @as(usize, offset) + index);
+        self.eval_stack.push(value_ptr.*);
+    }
+
+    inline fn opLocalArraySet(self: *VM) void {
+        const offset = self.nextByte();
+        const len = self.nextByte();
+        const index_value = self.eval_stack.pop();
+        const index: usize = @intCast(index_value.data.integer);
+        const item = self.eval_stack.pop();
+        if (len <= index) {
+            errorHandle(Error.ArrayOutOfBounds);
+            return;
+        }
+        const frame = self.call_stack.peek();
+        const value_ptr = self.eval_stack.peekFrameOffset(frame.stack_offset, @as(usize, offset) + index);
+        value_ptr.* = item;
+    }
+
+    inline fn opMatrixGet(self: *VM) void {
+        const item = self.popMatrixItem();
+        self.eval_stack.push(value.Value{ .data = .{ .integer = item.* } });
+    }
+
+    inline fn opMatrixSet(self: *VM) void {
+        const item = self.popMatrixItem();
+        item.* = self.eval_stack.pop().data.integer;
+    }
+
+    /// Pops a matrix, row and column, returns the bounds checked item
+    inline fn popMatrixItem(self: *VM) *i64 {
+        const mat = &self.eval_stack.pop().data.object.data.matrix;
+        const row = self.eval_stack.pop().data.integer;
+        const col = self.eval_stack.pop().data.integer;
+        if (row < 0 or col < 0) {
+            errorHandle(Error.ArrayOutOfBounds);
+            unreachable;
+        }
+        return mat.at(@intCast(row), @intCast(col)) orelse {
+            errorHandle(Error.ArrayOutOfBounds);
+            unreachable;
+        };
+    }
+
+    inline fn opBytesGet(self: *VM) void {
+        const item = self.popByte();
+        self.eval_stack.push(value.Value{ .data = .{ .integer = item.* } });
+    }
+
+    inline fn opBytesSet(self: *VM) void {
+        const item = self.popByte();
+        item.* = toByte(self.eval_stack.pop().data.integer);
+    }
+
+    /// Pops bytes and an index, returns the bounds checked byte
+    inline fn popByte(self: *VM) *u8 {
+        const items = self.eval_stack.pop().data.object.data.bytes.items;
+        const index = self.eval_stack.pop().data.integer;
+        if (index < 0 or index >= items.len) {
+            errorHandle(Error.ArrayOutOfBounds);
+            unreachable;
+        }
+        return &items[@intCast(index)];
+    }
+
+    inline fn toByte(int: i64) u8 {
+        if (int < 0 or int > 0xFF) {
+            errorHandle(Error.ByteOutOfRange);
+            unreachable;
+        }
+        return @intCast(int);
+    }
+
+    inline fn opStructInit(self: *VM) void {
+        const count = self.nextByte();
+        const fields = self.allocator.alloc(value.Value, count) catch |err| {
+            errorHandle(err);
+            unreachable;
+        };
+        @memcpy(fields, self.eval_stack.popSlice(count));
+        const obj = self.garbage_collector.newObject();
+        obj.data = .{ .record = .{ .fields = fields } };
+        self.eval_stack.push(value.Value{ .data = .{ .object = obj } });
+    }
+
+    inline fn opFieldGet(self: *VM) void {
+        const index = self.nextByte();
+        const record = self.eval_stack.pop();
+        self.eval_stack.push(record.data.object.data.record.fields[index]);
+    }
+
+    inline fn opFieldSet(self: *VM) void {
+        const index = self.nextByte();
+        const record = self.eval_stack.pop();
+        const item = self.eval_stack.pop();
+        record.data.object.data.record.fields[index] = item;
+    }
+
+    inline fn opQueueInit(self: *VM) void {
+        const has_comparator = self.nextByte() != 0;
+        const comparator: ?usize = if (has_comparator) self.eval_stack.pop().data.func else null;
+        const obj = self.garbage_collector.newObject();
+        obj.data = .{ .pqueue = priority_queue.PriorityQueue{ .comparator = comparator } };
+        self.eval_stack.push(value.Value{ .data = .{ .object = obj } });
+    }
+
+    inline fn opTableInit(self: *VM, comptime kind: enum { map, set }) void {
+        const obj = self.garbage_collector.newObject();
+        obj.data = switch (kind) {
+            .map => .{ .map = hash_table.HashTable{ .has_values = true } },
+            .set => .{ .set = hash_table.HashTable{ .has_values = false } },
+        };
+        self.eval_stack.push(value.Value{ .data = .{ .object = obj } });
+    }
+
+    inline fn opArrayKernel(self: *VM) void {
+        const kernel: byte.Kernel = @enumFromInt(self.nextByte());
+        switch (kernel) {
+            .append_copy => self.kernelAppendCopy(),
+            .copy => self.kernelCopy(),
+            .fill => self.kernelFill(),
+            .sum => self.kernelSum(),
+            .map => {
+                const op: byte.KernelOp = @enumFromInt(self.nextByte());
+                const count = self.popCount();
+                const rhs = self.popRange(count);
+                const lhs = self.popRange(count);
+                const dst = self.popRange(count);
+                kernels.map(op, dst, .{ .array = lhs }, .{ .array = rhs });
+            },
+            .map_scalar_lhs => {
+                const op: byte.KernelOp = @enumFromInt(self.nextByte());
+                const count = self.popCount();
+                const rhs = self.popRange(count);
+                const lhs = self.eval_stack.pop().data.integer;
+                const dst = self.popRange(count);
+                kernels.map(op, dst, .{ .scalar = lhs }, .{ .array = rhs });
+            },
+            .map_scalar_rhs => {
+                const op: byte.KernelOp = @enumFromInt(self.nextByte());
+                const count = self.popCount();
+                const rhs = self.eval_stack.pop().data.integer;
+                const lhs = self.popRange(count);
+                const dst = self.popRange(count);
+                kernels.map(op, dst, .{ .array = lhs }, .{ .scalar = rhs });
+            },
+        }
+    }
+
+    inline fn kernelAppendCopy(self: *VM) void {
+        const count = self.popCount();
+        const start = self.eval_stack.pop().data.integer;
+        const src = self.eval_stack.pop();
+        const dst_obj = self.eval_stack.pop();
+        const dst = &dst_obj.data.object.data.array.items;
+
+        if (src.data.object != dst_obj.data.object) {
+            dst.appendSlice(self.allocator, arrayRange(src, start, count)) catch |err| {
+                errorHandle(err);
+                unreachable;
+            };
+            return;
+        }
+
+        // Appending to the source array, later items may have been appended
+        // by earlier iterations so they are copied one at a time
+        for (0..count) |i| {
+            const item = arrayRange(src, start + @as(i64, @intCast(i)), 1)[0];
+            dst.append(self.allocator, item) catch |err| {
+                errorHandle(err);
+                unreachable;
+            };
+        }
+    }
+
+    inline fn kernelCopy(self: *VM) void {
+        const count = self.popCount();
+        const src = self.popRange(count);
+        const dst = self.popRange(count);
+        // ascending copy handles overlap the same way the replaced loop does
+        for (dst, 0..) |*d, j| {
+            d.* = src[j];
+        }
+    }
+
+    inline fn kernelFill(self: *VM) void {
+        const count = self.popCount();
         const item = self.eval_stack.pop();
+        const dst = self.popRange(count);
+        @memset(dst, item);
+    }
+
+    inline fn kernelSum(self: *VM) void {
+        const count = self.popCount();
+        const src = self.popRange(count);
+        const acc = self.eval_stack.pop().data.integer;
+        self.eval_stack.push(value.Value{ .data = .{ .integer = acc + kernels.sum(src) } });
+    }
+
+    /// Pops a kernel trip count, loops that wouldn't run have negative counts
+    inline fn popCount(self: *VM) usize {
+        const count = self.eval_stack.pop().data.integer;
+        return if (count > 0) @intCast(count) else 0;
+    }
+
+    /// Pops an array and start index, returns the bounds checked range
+    inline fn popRange(self: *VM, count: usize) []value.Value {
+        const start = self.eval_stack.pop().data.integer;
+        const array = self.eval_stack.pop();
+        return arrayRange(array, start, count);
+    }
+
+    /// Bounds checked range of an array, errors if any index would be out of bounds
+    inline fn arrayRange(array: value.Value, start: i64, count: usize) []value.Value {
+        const items = array.data.object.data.array.items.items;
+        if (count == 0) {
+            return items[0..0];
+        }
+        if (start < 0 or @as(usize, @intCast(start)) + count > items.len) {
+            errorHandle(Error.ArrayOutOfBounds);
+            unreachable;
+        }
+        const begin: usize = @intCast(start);
+        return items[begin .. begin + count];
+    }
+
+    fn builtinPrint(self: *VM) void {
+        const item = self.eval_stack.pop();
+        if (self.output) |output| {
+            output.writer().print("{any}\n", .{item}) catch |err| {
+                errorHandle(err);
+            };
+            return;
+        }
         std.debug.print("{any}\n", .{item});
     }
 
-    inline fn builtinToString(self: *VM) void {
+    fn builtinToString(self: *VM) void {
         const item = self.eval_stack.pop();
         const raw = std.fmt.allocPrint(self.allocator, "{any}", .{item}) catch {
             return;
@@ -378,13 +880,17 @@ pub const VM = struct {
         self.eval_stack.push(value.Value{ .data = .{ .object = object } });
     }
 
-    inline fn builtinLength(self: *VM) void {
+    fn builtinLength(self: *VM) void {
         const item = self.eval_stack.pop();
         const len = switch (item.data) {
             .object => |obj| blk: {
                 switch (obj.data) {
                     .string => |string| break :blk string.raw.len,
                     .array => |array| break :blk array.items.items.len,
+                    .map, .set => |table| break :blk table.count,
+                    .bytes => |buf| break :blk buf.items.len,
+                    .pqueue => |queue| break :blk queue.items.items.len,
+                    else => unreachable,
                 }
             },
             else => unreachable,
@@ -392,7 +898,7 @@ pub const VM = struct {
         self.eval_stack.push(value.Value{ .data = .{ .integer = @intCast(len) } });
     }
 
-    inline fn builtinClone(self: *VM) void {
+    fn builtinClone(self: *VM) void {
         const item = self.eval_stack.pop();
         const dupe = item.dupe(self.allocator);
         switch (dupe.data) {
@@ -404,7 +910,7 @@ pub const VM = struct {
         self.eval_stack.push(dupe);
     }
 
-    inline fn builtinAppend(self: *VM) void {
+    fn builtinAppend(self: *VM) void {
         const item = self.eval_stack.pop();
         const array = self.eval_stack.pop();
         array.data.object.data.array.items.append(self.allocator, item) catch |err| {
@@ -413,7 +919,7 @@ pub const VM = struct {
         };
     }
 
-    inline fn builtinRandom(self: *VM) void {
+    fn builtinRandom(self: *VM) void {
         const max = self.eval_stack.pop().data.integer;
         const min = self.eval_stack.pop().data.integer;
         const raw = self.rng.int(i64);
@@ -426,6 +932,64 @@ pub const VM = struct {
         self.eval_stack.push(item);
     }
 
+    fn builtinPut(self: *VM) void {
+        const item = self.eval_stack.pop();
+        const key = self.eval_stack.pop();
+        const map = self.eval_stack.pop();
+        tableOf(map).put(self.allocator, key, item);
+    }
+
+    fn builtinGet(self: *VM) void {
+        const key = self.eval_stack.pop();
+        const map = self.eval_stack.pop();
+        const item = tableOf(map).get(key) orelse {
+            errorHandle(Error.KeyNotFound);
+            unreachable;
+        };
+        self.eval_stack.push(item);
+    }
+
+    fn builtinContains(self: *VM) void {
+        const key = self.eval_stack.pop();
+        const table = self.eval_stack.pop();
+        self.eval_stack.push(value.Value{ .data = .{ .boolean = tableOf(table).contains(key) } });
+    }
+
+    fn builtinRemove(self: *VM) void {
+        const key = self.eval_stack.pop();
+        const table = self.eval_stack.pop();
+        self.eval_stack.push(value.Value{ .data = .{ .boolean = tableOf(table).remove(key) } });
+    }
+
+    fn builtinInsert(self: *VM) void {
+        const key = self.eval_stack.pop();
+        const set = self.eval_stack.pop();
+        tableOf(set).put(self.allocator, key, undefined);
+    }
+
+    fn builtinKeys(self: *VM) void {
+        const table = tableOf(self.eval_stack.pop());
+        var keys = std.ArrayListUnmanaged(value.Value).initCapacity(self.allocator, table.count) catch |err| {
+            errorHandle(err);
+            unreachable;
+        };
+        var iter = table.iterator();
+        while (iter.next()) |slot| {
+            keys.appendAssumeCapacity(table.keys[slot]);
+        }
+        const obj = self.garbage_collector.newObject();
+        obj.data = .{ .array = .{ .items = keys } };
+        self.eval_stack.push(value.Value{ .data = .{ .object = obj } });
+    }
+
+    /// Table behind a map or set
+    inline fn tableOf(item: value.Value) *hash_table.HashTable {
+        return switch (item.data.object.data) {
+            .map, .set => |*table| table,
+            else => unreachable,
+        };
+    }
+
     /// Fetches the next byte and errors if there isn't one
     inline fn nextByte(self: *VM) u8 {
         if (self.pc >= self.bytes[self.current_func].len) {
@@ -435,4 +999,211 @@ pub const VM = struct {
         self.pc += 1;
         return ret;
     }
+
+    /// Fetches the next four bytes as a little-endian u32
+    inline fn nextWord(self: *VM) u32 {
+        const low: u32 = self.nextShort();
+        const high: u32 = self.nextShort();
+        return low | (high << 16);
+    }
+
+    /// Fetches the next two bytes as a little-endian u16
+    inline fn nextShort(self: *VM) u16 {
+        const low: u16 = self.nextByte();
+        const high: u16 = self.nextByte();
+        return low | (high << 8);
+    }
+
+    fn builtinMatrix(self: *VM) void {
+        const cols = self.eval_stack.pop().data.integer;
+        const rows = self.eval_stack.pop().data.integer;
+        if (rows < 0 or cols < 0) {
+            errorHandle(Error.InvalidDimensions);
+            unreachable;
+        }
+        self.pushMatrix(matrix.Matrix.init(self.allocator, @intCast(rows), @intCast(cols)));
+    }
+
+    fn builtinMatrixRows(self: *VM) void {
+        const mat = &self.eval_stack.pop().data.object.data.matrix;
+        self.eval_stack.push(value.Value{ .data = .{ .integer = @intCast(mat.rows) } });
+    }
+
+    fn builtinMatrixCols(self: *VM) void {
+        const mat = &self.eval_stack.pop().data.object.data.matrix;
+        self.eval_stack.push(value.Value{ .data = .{ .integer = @intCast(mat.cols) } });
+    }
+
+    fn builtinRowSums(self: *VM) void {
+        const mat = &self.eval_stack.pop().data.object.data.matrix;
+        const sums = self.allocator.alloc(i64, mat.rows) catch |err| {
+            errorHandle(err);
+            unreachable;
+        };
+        defer self.allocator.free(sums);
+        mat.rowSums(sums);
+        self.pushIntArray(sums);
+    }
+
+    fn builtinColSums(self: *VM) void {
+        const mat = &self.eval_stack.pop().data.object.data.matrix;
+        const sums = self.allocator.alloc(i64, mat.cols) catch |err| {
+            errorHandle(err);
+            unreachable;
+        };
+        defer self.allocator.free(sums);
+        mat.colSums(sums);
+        self.pushIntArray(sums);
+    }
+
+    fn builtinTranspose(self: *VM) void {
+        const mat = &self.eval_stack.pop().data.object.data.matrix;
+        self.pushMatrix(mat.transpose(self.allocator));
+    }
+
+    fn builtinMatmul(self: *VM) void {
+        const rhs = &self.eval_stack.pop().data.object.data.matrix;
+        const lhs = &self.eval_stack.pop().data.object.data.matrix;
+        if (lhs.cols != rhs.rows) {
+            errorHandle(Error.InvalidDimensions);
+            unreachable;
+        }
+        self.pushMatrix(lhs.multiply(rhs, self.allocator));
+    }
+
+    fn pushMatrix(self: *VM, mat: matrix.Matrix) void {
+        const obj = self.garbage_collector.newObject();
+        obj.data = .{ .matrix = mat };
+        self.eval_stack.push(value.Value{ .data = .{ .object = obj } });
+    }
+
+    /// Pushes a new array holding the integers
+    fn pushIntArray(self: *VM, ints: []const i64) void {
+        var items = std.ArrayListUnmanaged(value.Value).initCapacity(self.allocator, ints.len) catch |err| {
+            errorHandle(err);
+            unreachable;
+        };
+        for (ints) |int| {
+            items.appendAssumeCapacity(value.Value{ .data = .{ .integer = int } });
+        }
+        const obj = self.garbage_collector.newObject();
+        obj.data = .{ .array = .{ .items = items } };
+        self.eval_stack.push(value.Value{ .data = .{ .object = obj } });
+    }
+
+    fn builtinBytes(self: *VM) void {
+        const len = self.eval_stack.pop().data.integer;
+        if (len < 0) {
+            errorHandle(Error.InvalidDimensions);
+            unreachable;
+        }
+        self.pushBytes(buffer.Bytes.init(self.allocator, @intCast(len)));
+    }
+
+    fn builtinFill(self: *VM) void {
+        const item = toByte(self.eval_stack.pop().data.integer);
+        const buf = &self.eval_stack.pop().data.object.data.bytes;
+        @memset(buf.items, item);
+    }
+
+    fn builtinCopy(self: *VM) void {
+        const src = self.eval_stack.pop().data.object.data.bytes.items;
+        const offset = self.eval_stack.pop().data.integer;
+        const dst = &self.eval_stack.pop().data.object.data.bytes;
+        if (offset < 0 or @as(usize, @intCast(offset)) + src.len > dst.items.len) {
+            errorHandle(Error.ArrayOutOfBounds);
+            unreachable;
+        }
+        dst.copyFrom(@intCast(offset), src);
+    }
+
+    /// Pushes the index of the byte, or -1 if it isn't found
+    fn builtinFind(self: *VM) void {
+        const start = self.eval_stack.pop().data.integer;
+        const item = self.eval_stack.pop().data.integer;
+        const buf = &self.eval_stack.pop().data.object.data.bytes;
+        const found: ?usize = if (start < 0 or item < 0 or item > 0xFF)
+            null
+        else if (start >= buf.items.len)
+            null
+        else
+            buf.find(@intCast(item), @intCast(start));
+        const index: i64 = if (found) |some| @intCast(some) else -1;
+        self.eval_stack.push(value.Value{ .data = .{ .integer = index } });
+    }
+
+    fn builtinToBytes(self: *VM) void {
+        self.toBytes(false);
+    }
+
+    fn builtinFromBytes(self: *VM) void {
+        self.fromBytes(false);
+    }
+
+    /// Strings and bytes that nothing else references have their buffer taken
+    /// over instead of copied, the emptied object is left to the collector
+    fn toBytes(self: *VM, move: bool) void {
+        const str = &self.eval_stack.pop().data.object.data.string;
+        const items = if (move) blk: {
+            const raw = str.raw;
+            str.raw = raw[0..0];
+            str.hash_cache = null;
+            break :blk @constCast(raw);
+        } else self.allocator.dupe(u8, str.raw) catch |err| {
+            errorHandle(err);
+            unreachable;
+        };
+        self.pushBytes(buffer.Bytes{ .items = items });
+    }
+
+    fn fromBytes(self: *VM, move: bool) void {
+        const buf = &self.eval_stack.pop().data.object.data.bytes;
+        const raw = if (move) blk: {
+            const items = buf.items;
+            buf.items = items[0..0];
+            break :blk items;
+        } else self.allocator.dupe(u8, buf.items) catch |err| {
+            errorHandle(err);
+            unreachable;
+        };
+        const obj = self.garbage_collector.newObject();
+        obj.data = .{ .string = .{ .raw = raw } };
+        self.eval_stack.push(value.Value{ .data = .{ .object = obj } });
+    }
+
+    fn pushBytes(self: *VM, buf: buffer.Bytes) void {
+        const obj = self.garbage_collector.newObject();
+        obj.data = .{ .bytes = buf };
+        self.eval_stack.push(value.Value{ .data = .{ .object = obj } });
+    }
+
+    fn builtinPush(self: *VM) void {
+        const item = self.eval_stack.pop();
+        const queue = &self.eval_stack.pop().data.object.data.pqueue;
+        if (queue.comparator) |func| {
+            queue.push(self.allocator, item, FuncOrder{ .vm = self, .func = func });
+        } else {
+            queue.push(self.allocator, item, IntOrder{});
+        }
+    }
+
+    fn builtinPop(self: *VM) void {
+        const queue = &self.eval_stack.pop().data.object.data.pqueue;
+        const item = if (queue.comparator) |func|
+            queue.pop(FuncOrder{ .vm = self, .func = func })
+        else
+            queue.pop(IntOrder{});
+        self.eval_stack.push(item orelse {
+            errorHandle(Error.EmptyQueue);
+            unreachable;
+        });
+    }
+
+    fn builtinPeek(self: *VM) void {
+        const queue = &self.eval_stack.pop().data.object.data.pqueue;
+        self.eval_stack.push(queue.peek() orelse {
+            errorHandle(Error.EmptyQueue);
+            unreachable;
+        });
+    }
 };
@@ -0,0 +1,314 @@
+//! End to end tests, compiles small programs and checks what they print
+
+const std = @import("std");
+const byte = @import("runtime/bytecode.zig");
+const compiler = @import("compiler/compiler.zig");
+const vm = @import("runtime/vm.zig");
+
+/// Runs compiled bytecode and returns everything it printed
+fn runResult(allocator: std.mem.Allocator, result: *const compiler.CompileResult) ![]u8 {
+    var output = std.ArrayList(u8).init(allocator);
+    errdefer output.deinit();
+
+    // Fixed seed so that runs can be compared with each other
+    var rng_engine = std.rand.DefaultPrng.init(0);
+    var runtime = vm.VM.init(allocator, rng_engine.random(), result.bytecode, result.constants);
+    defer runtime.deinit();
+    runtime.output = &output;
+    runtime.run();
+
+    return output.toOwnedSlice();
+}
+
+fn expectOutput(source: []const u8, expected: []const u8) !void {
+    const allocator = std.testing.allocator;
+    var result = try compiler.compile(allocator, source, .{});
+    defer result.deinit(allocator);
+
+    const output = try runResult(allocator, &result);
+    defer allocator.free(output);
+    try std.testing.expectEqualStrings(expected, output);
+}
+
+fn hasOpcode(result: *const compiler.CompileResult, opcode: byte.Opcode) bool {
+    for (result.bytecode) |code| {
+        var i: usize = 0;
+        while (i < code.len) : (i += 1 + byte.operandLength(code, i)) {
+            if (code[i] == @intFromEnum(opcode)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/// Checks if any function of the compiled source uses the opcode
+fn expectOpcode(source: []const u8, opcode: byte.Opcode) !void {
+    const allocator = std.testing.allocator;
+    var result = try compiler.compile(allocator, source, .{});
+    defer result.deinit(allocator);
+
+    if (!hasOpcode(&result, opcode)) {
+        std.debug.print("Expected opcode {s} in bytecode\n", .{@tagName(opcode)});
+        return error.TestExpectedOpcode;
+    }
+}
+
+/// Compiles the source serially and in parallel mode, both have to print the
+/// expected output. Returns the parallel result to inspect further.
+fn expectSameOutput(source: []const u8, expected: []const u8) !compiler.CompileResult {
+    const allocator = std.testing.allocator;
+    var serial = try compiler.compile(allocator, source, .{});
+    defer serial.deinit(allocator);
+    const serial_output = try runResult(allocator, &serial);
+    defer allocator.free(serial_output);
+    try std.testing.expectEqualStrings(expected, serial_output);
+
+    var parallel = try compiler.compile(allocator, source, .{ .parallel = true });
+    errdefer parallel.deinit(allocator);
+    const parallel_output = try runResult(allocator, &parallel);
+    defer allocator.free(parallel_output);
+    try std.testing.expectEqualStrings(serial_output, parallel_output);
+    return parallel;
+}
+
+const dense_match =
+    \\for var i := 0; i < 6; i = i + 1; {
+    \\    match i {
+    \\        1, 2 => { print(10); }
+    \\        3 => { print(30); }
+    \\        4 => { print(40); }
+    \\        else => { print(0); }
+    \\    }
+    \\}
+;
+
+test "match on dense ints uses a jump table" {
+    try expectOpcode(dense_match, .JUMP_TABLE);
+    try expectOutput(dense_match, "0\n10\n10\n30\n40\n0\n");
+}
+
+const sparse_match =
+    \\fn classify(value: int) -> int {
+    \\    match value {
+    \\        1 => { return 1; }
+    \\        1000 => { return 2; }
+    \\        1000000 => { return 3; }
+    \\    }
+    \\    return 0;
+    \\}
+    \\print(classify(1000000));
+    \\print(classify(1000));
+    \\print(classify(5));
+;
+
+test "match on sparse ints uses a hash table" {
+    try expectOpcode(sparse_match, .JUMP_HASH);
+    try expectOutput(sparse_match, "3\n2\n0\n");
+}
+
+test "match on strings" {
+    const source =
+        \\fn pick(name: string) -> int {
+        \\    match name {
+        \\        "one" => { return 1; }
+        \\        "two", "deux" => { return 2; }
+        \\        else => { return 0; }
+        \\    }
+        \\    return 0;
+        \\}
+        \\print(pick("deux"));
+        \\print(pick("one"));
+        \\print(pick("three"));
+    ;
+    try expectOpcode(source, .JUMP_HASH);
+    try expectOutput(source, "2\n1\n0\n");
+}
+
+test "match without a matching case runs the default" {
+    try expectOutput(
+        \\match 7 {
+        \\    1 => { print(1); }
+        \\    else => { print(2); }
+        \\}
+        \\match 7 {
+        \\    1 => { print(1); }
+        \\}
+        \\print(3);
+    , "2\n3\n");
+}
+
+test "match cases can be int constants" {
+    try expectOutput(
+        \\const low := 1;
+        \\const high := 2;
+        \\match 2 {
+        \\    low => { print(10); }
+        \\    high => { print(20); }
+        \\}
+    , "20\n");
+}
+
+test "match rejects duplicate cases" {
+    try std.testing.expectError(error.DuplicateCase, compiler.compile(std.testing.allocator,
+        \\const one := 1;
+        \\match 1 {
+        \\    1 => { }
+        \\    2, one => { }
+        \\}
+    , .{}));
+}
+
+test "generic functions are instantiated once per binding" {
+    const allocator = std.testing.allocator;
+    const source =
+        \\fn pick<T>(first: bool, a: T, b: T) -> T {
+        \\    if first {
+        \\        return a;
+        \\    }
+        \\    return b;
+        \\}
+        \\print(pick(true, 1, 2));
+        \\print(pick(false, 3, 4));
+        \\print(pick(false, "a", "b"));
+    ;
+    var result = try compiler.compile(allocator, source, .{});
+    defer result.deinit(allocator);
+    // The root and one instance for int and string each
+    try std.testing.expectEqual(@as(usize, 3), result.bytecode.len);
+
+    const output = try runResult(allocator, &result);
+    defer allocator.free(output);
+    try std.testing.expectEqualStrings("1\n4\nb\n", output);
+}
+
+test "generic functions can call themselves" {
+    try expectOutput(
+        \\fn depth<T>(item: T, n: int) -> int {
+        \\    if n == 0 {
+        \\        return 0;
+        \\    }
+        \\    return depth(item, n - 1) + 1;
+        \\}
+        \\print(depth(true, 3));
+        \\print(depth("a", 5));
+    , "3\n5\n");
+}
+
+test "generic functions can't be nested in generic functions" {
+    try std.testing.expectError(error.UnexpectedToken, compiler.compile(std.testing.allocator,
+        \\fn outer<T>(a: T) -> T {
+        \\    fn inner<U>(b: U) -> U {
+        \\        return b;
+        \\    }
+        \\    return a;
+        \\}
+        \\print(outer(1));
+    , .{}));
+}
+
+test "parallel mode prints the same as serial mode" {
+    var result = try expectSameOutput(
+        \\fn label(n: int) -> string {
+        \\    match n {
+        \\        0 => { return "zero"; }
+        \\        1 => { return "one"; }
+        \\        2 => { return "two"; }
+        \\    }
+        \\    return "many";
+        \\}
+        \\
+        \\fn primes_sum() -> int {
+        \\    const primes := [2, 3, 5, 7, 11];
+        \\    var sum := 0;
+        \\    for prime in primes {
+        \\        sum = sum + prime;
+        \\    }
+        \\    return sum;
+        \\}
+        \\
+        \\fn greet() -> void {
+        \\    const greeting := "hello";
+        \\    print(greeting);
+        \\    return;
+        \\}
+        \\
+        \\fn fib(n: int) -> int {
+        \\    if n < 2 {
+        \\        return n;
+        \\    }
+        \\    return fib(n - 1) + fib(n - 2);
+        \\}
+        \\
+        \\fn fib_label(n: int) -> string {
+        \\    return label(fib(n));
+        \\}
+        \\
+        \\for var i := 0; i < 4; i = i + 1; {
+        \\    print(label(i));
+        \\}
+        \\print(primes_sum());
+        \\greet();
+        \\print(fib(15));
+        \\print(fib_label(3));
+        \\print("done");
+    , "zero\none\ntwo\nmany\n28\nhello\n610\ntwo\ndone\n");
+    defer result.deinit(std.testing.allocator);
+
+    // Every kind of constant survives relocation
+    try std.testing.expect(hasOpcode(&result, .JUMP_TABLE));
+    try std.testing.expect(hasOpcode(&result, .CONSTANT_REF));
+}
+
+test "parallel mode shares function constants between call sites" {
+    const allocator = std.testing.allocator;
+    // More calls than there are constant slots in a function's unit
+    const calls = 300;
+    var source = std.ArrayList(u8).init(allocator);
+    defer source.deinit();
+    try source.appendSlice("fn one() -> int {\n    return 1;\n}\nfn count() -> int {\n    var total := 0;\n");
+    for (0..calls) |_| {
+        try source.appendSlice("    total = total + one();\n");
+    }
+    try source.appendSlice("    return total;\n}\nprint(count());\n");
+
+    var result = try expectSameOutput(source.items, std.fmt.comptimePrint("{d}\n", .{calls}));
+    result.deinit(allocator);
+}
+
+test "partially unrolled loops run every iteration" {
+    try expectOutput(
+        \\var count := 0;
+        \\for var i := 9223372036854775780; i < 9223372036854775807; i = i + 1; {
+        \\    count = count + 1;
+        \\}
+        \\print(count);
+        \\var n := 23;
+        \\for var j := 0; j < n; j = j + 1; {
+        \\    count = count + 1;
+        \\}
+        \\print(count);
+        \\const m := 0 - n;
+        \\for var k := 0; k > m; k = k - 2; {
+        \\    count = count - 1;
+        \\}
+        \\print(count);
+    , "27\n50\n38\n");
+}
+
+test "function and tuple types compare by their interned items" {
+    try expectOutput(
+        \\fn double(n: int) -> int {
+        \\    return n * 2;
+        \\}
+        \\fn apply(f: fn(int) -> int, n: int) -> int {
+        \\    return f(n);
+        \\}
+        \\fn split(n: int) -> (int, string) {
+        \\    return (n, to_string(n));
+        \\}
+        \\var (number, text) := split(apply(double, 21));
+        \\print(number);
+        \\print(text);
+    , "42\n42\n");
+}